@@ -0,0 +1,114 @@
+/**
+ *  Per-frame cost of frame mixing in a long chain of modules.
+ *
+ *  Every module of a tray mixes each frame it pushes with the
+ *  I3FrameMixer of that outbox (I3Module::SyncCache()).  This pushes a
+ *  G/C/D/Q/P sequence through a chain of such mixers and reports the
+ *  time per Q or P frame for
+ *
+ *    private  each mixer with cache entries of its own
+ *    shared   cache entries shared through I3FrameSnapshots, as the
+ *             mixers of an I3Tray's modules do
+ *
+ *  usage: mixing-benchmark [modules [events [keys]]]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
+
+#include <icetray/I3Frame.h>
+#include <icetray/I3FrameMixing.h>
+#include <icetray/I3Int.h>
+
+namespace {
+
+  I3FramePtr
+  make_frame(I3Frame::Stream stop, unsigned nkeys)
+  {
+    I3FramePtr frame = boost::make_shared<I3Frame>(stop);
+    for (unsigned i = 0; i < nkeys; i++)
+      frame->Put(std::string(1, stop.id()) + boost::lexical_cast<std::string>(i),
+                 boost::make_shared<I3Int>(i));
+    return frame;
+  }
+
+  struct Sequence
+  {
+    std::vector<I3FramePtr> header;
+    I3FramePtr daq, physics;
+  };
+
+  // Time pushing seq through mixers; returns microseconds per Q or P frame.
+  template <typename Mixer>
+  double
+  run(const Sequence& seq, std::vector<Mixer>& mixers, unsigned nevents)
+  {
+    for (unsigned i = 0; i < seq.header.size(); i++)
+      {
+        I3FramePtr frame = boost::make_shared<I3Frame>(*seq.header[i]);
+        for (unsigned m = 0; m < mixers.size(); m++)
+          mixers[m].Mix(*frame);
+      }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    unsigned long found = 0;
+    for (unsigned n = 0; n < nevents; n++)
+      {
+        I3FramePtr q = boost::make_shared<I3Frame>(*seq.daq);
+        q->Put("EventID", boost::make_shared<I3Int>(n));
+        for (unsigned m = 0; m < mixers.size(); m++)
+          mixers[m].Mix(*q);
+        I3FramePtr p = boost::make_shared<I3Frame>(*seq.physics);
+        for (unsigned m = 0; m < mixers.size(); m++)
+          mixers[m].Mix(*p);
+        found += p->Has("EventID") + p->Has("G0");
+      }
+    std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - start;
+    if (found != 2ul * nevents)
+      {
+        fprintf(stderr, "mixing went wrong: %lu keys found, expected %u\n",
+                found, 2 * nevents);
+        exit(1);
+      }
+    return elapsed.count() / (2 * nevents);
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  unsigned nmodules = argc > 1 ? atoi(argv[1]) : 60;
+  unsigned nevents = argc > 2 ? atoi(argv[2]) : 2000;
+  unsigned nkeys = argc > 3 ? atoi(argv[3]) : 200;
+
+  Sequence seq;
+  seq.header.push_back(make_frame(I3Frame::Geometry, nkeys));
+  seq.header.push_back(make_frame(I3Frame::Calibration, nkeys));
+  seq.header.push_back(make_frame(I3Frame::DetectorStatus, nkeys));
+  seq.daq = make_frame(I3Frame::DAQ, nkeys / 10);
+  seq.physics = make_frame(I3Frame::Physics, nkeys / 10);
+
+  printf("%u modules, %u events, %u keys per G/C/D frame\n", nmodules, nevents, nkeys);
+
+  // what each module's SyncCache() did on its own
+  std::vector<I3FrameMixer> private_mixers(nmodules);
+  double t_private = run(seq, private_mixers, nevents);
+  printf("  private %10.2f us/frame\n", t_private);
+
+  // what they do sharing the tray's I3FrameSnapshots
+  std::vector<I3FrameMixer> shared_mixers(nmodules);
+  I3FrameSnapshotsPtr snapshots = boost::make_shared<I3FrameSnapshots>();
+  for (unsigned m = 0; m < nmodules; m++)
+    shared_mixers[m].ShareSnapshots(snapshots);
+  double t_shared = run(seq, shared_mixers, nevents);
+  printf("  shared  %10.2f us/frame (%.1fx faster)\n",
+         t_shared, t_private / t_shared);
+
+  return 0;
+}
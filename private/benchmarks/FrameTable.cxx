@@ -0,0 +1,163 @@
+/**
+ *  The I3Frame's slot table: I3FlatMap against the node-based hash_map
+ *  it replaced.
+ *
+ *  Each operation runs on a table of the given number of keys, shaped
+ *  like a frame's: keys are I3FrameKeys, values are shared pointers to
+ *  a value_t-sized struct.  The hash_map allocates those with new, as
+ *  the frame did; the flat map with make_shared, as it does now.
+ *
+ *  usage: frame-table-benchmark [keys [rounds]]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <I3/hash_map.h>
+#include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
+
+#include <icetray/I3FlatMap.h>
+#include <icetray/I3FrameKey.h>
+
+namespace {
+
+  struct slot
+  {
+    std::string type_name;
+    std::vector<char> buf;
+    size_t size;
+    boost::shared_ptr<const void> ptr;
+    char stream;
+  };
+
+  typedef hash_map<I3FrameKey, boost::shared_ptr<slot>, I3FrameKey::hash> node_map;
+  typedef I3FlatMap<I3FrameKey, boost::shared_ptr<slot>, I3FrameKey::hash> flat_map;
+
+  boost::shared_ptr<slot> make_slot(node_map*, char stream)
+  {
+    boost::shared_ptr<slot> s(new slot);
+    s->stream = stream;
+    return s;
+  }
+
+  boost::shared_ptr<slot> make_slot(flat_map*, char stream)
+  {
+    boost::shared_ptr<slot> s = boost::make_shared<slot>();
+    s->stream = stream;
+    return s;
+  }
+
+  std::vector<I3FrameKey>
+  make_keys(const std::string& prefix, unsigned n)
+  {
+    std::vector<I3FrameKey> keys;
+    for (unsigned i = 0; i < n; i++)
+      keys.push_back(I3FrameKey(prefix + boost::lexical_cast<std::string>(i)));
+    return keys;
+  }
+
+  template <typename Map>
+  void fill(Map& map, const std::vector<I3FrameKey>& keys, char stream)
+  {
+    for (unsigned i = 0; i < keys.size(); i++)
+      map[keys[i]] = make_slot((Map*)0, stream);
+  }
+
+  // Time f over rounds; nanoseconds per call.
+  template <typename F>
+  double time(F f, unsigned rounds)
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned r = 0; r < rounds; r++)
+      f();
+    std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+    return elapsed.count() / rounds;
+  }
+
+  volatile size_t sink;
+
+  template <typename Map>
+  struct ops
+  {
+    const std::vector<I3FrameKey>& own;
+    const std::vector<I3FrameKey>& missing;
+    const Map& parent;
+
+    void put() const
+    {
+      Map map;
+      fill(map, own, 'P');
+      sink = map.size();
+    }
+    void get(const Map& map) const
+    {
+      size_t n = 0;
+      for (unsigned i = 0; i < own.size(); i++)
+        n += map.find(own[i])->second->stream;
+      sink = n;
+    }
+    void has(const Map& map) const
+    {
+      size_t n = 0;
+      for (unsigned i = 0; i < own.size(); i++)
+        n += map.count(own[i]) + map.count(missing[i]);
+      sink = n;
+    }
+    void merge_purge() const
+    {
+      Map map;
+      fill(map, own, 'P');
+      map.insert(parent.begin(), parent.end());
+      typename Map::iterator it = map.begin();
+      while (it != map.end())
+        {
+          if (it->second->stream != 'P')
+            map.erase(it++);
+          else
+            it++;
+        }
+      sink = map.size();
+    }
+    void copy(const Map& map) const
+    {
+      Map c(map);
+      sink = c.size();
+    }
+  };
+
+  template <typename Map>
+  void run(const char* name, unsigned nkeys, unsigned rounds)
+  {
+    std::vector<I3FrameKey> own = make_keys("own", nkeys);
+    std::vector<I3FrameKey> missing = make_keys("missing", nkeys);
+    Map parent;
+    fill(parent, make_keys("parent", 4 * nkeys), 'G');
+    Map full;
+    fill(full, own, 'P');
+
+    ops<Map> o = { own, missing, parent };
+    printf("%-8s put %9.0f  get %9.0f  has %9.0f  merge+purge %9.0f  copy %9.0f  ns\n",
+           name,
+           time([&]() { o.put(); }, rounds),
+           time([&]() { o.get(full); }, rounds),
+           time([&]() { o.has(full); }, rounds),
+           time([&]() { o.merge_purge(); }, rounds / 4 + 1),
+           time([&]() { o.copy(full); }, rounds));
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  unsigned nkeys = argc > 1 ? atoi(argv[1]) : 64;
+  unsigned rounds = argc > 2 ? atoi(argv[2]) : 20000;
+
+  printf("%u keys per table, times per pass over all of them\n", nkeys);
+  run<node_map>("hash_map", nkeys, rounds);
+  run<flat_map>("flat", nkeys, rounds);
+  return 0;
+}
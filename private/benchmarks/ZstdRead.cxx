@@ -0,0 +1,155 @@
+/**
+ *  Read throughput of .i3.zst files.
+ *
+ *  Writes a file of frame-like data through I3::dataio::open(), then
+ *  reads it back and reports MB/s of decompressed data for
+ *
+ *    dataio   I3::dataio::open() and istream::read(), as I3Reader does
+ *    raw      ZSTD_decompressStream() on fread() blocks, as zstd -d does
+ *    zstd -d  the zstd command itself, if it is on the PATH
+ *
+ *  usage: zstd-read-benchmark [megabytes [chunk bytes]]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <zstd.h>
+
+#include <icetray/open.h>
+
+namespace {
+
+  typedef std::chrono::steady_clock steady;
+
+  double
+  seconds_since(steady::time_point start)
+  {
+    return std::chrono::duration<double>(steady::now() - start).count();
+  }
+
+  // Compressible, but not trivially: runs of small numbers with some noise,
+  // a bit like the doubles and vectors in real frames.
+  void
+  write_file(const std::string& path, size_t nbytes)
+  {
+    boost::iostreams::filtering_ostream os;
+    I3::dataio::open(os, path);
+    std::vector<char> block(65536);
+    unsigned seed = 1;
+    for (size_t written = 0; written < nbytes; written += block.size())
+      {
+        for (size_t i = 0; i < block.size(); i++)
+          {
+            seed = seed * 1103515245 + 12345;
+            block[i] = (i % 8 < 5) ? char(i / 64) : char(seed >> 24);
+          }
+        os.write(&block[0], block.size());
+      }
+  }
+
+  size_t
+  read_dataio(const std::string& path, size_t chunk)
+  {
+    boost::iostreams::filtering_istream is;
+    I3::dataio::open(is, path);
+    std::vector<char> buf(chunk);
+    size_t total = 0;
+    while (is.read(&buf[0], buf.size()) || is.gcount() > 0)
+      total += is.gcount();
+    return total;
+  }
+
+  size_t
+  read_raw(const std::string& path)
+  {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f)
+      {
+        perror(path.c_str());
+        exit(1);
+      }
+    std::unique_ptr<ZSTD_DStream, size_t(*)(ZSTD_DStream*)>
+      dstream(ZSTD_createDStream(), ZSTD_freeDStream);
+    ZSTD_initDStream(dstream.get());
+    std::vector<char> in(ZSTD_DStreamInSize()), out(ZSTD_DStreamOutSize());
+    size_t total = 0, got;
+    while ((got = fread(&in[0], 1, in.size(), f)) > 0)
+      {
+        ZSTD_inBuffer input = {&in[0], got, 0};
+        while (input.pos < input.size)
+          {
+            ZSTD_outBuffer output = {&out[0], out.size(), 0};
+            size_t err = ZSTD_decompressStream(dstream.get(), &output, &input);
+            if (ZSTD_isError(err))
+              {
+                fprintf(stderr, "%s\n", ZSTD_getErrorName(err));
+                exit(1);
+              }
+            total += output.pos;
+          }
+      }
+    fclose(f);
+    return total;
+  }
+
+  void
+  report(const char* name, size_t nbytes, size_t expected, double elapsed)
+  {
+    if (nbytes != expected)
+      {
+        fprintf(stderr, "%s read %zu bytes, expected %zu\n", name, nbytes,
+                expected);
+        exit(1);
+      }
+    printf("  %-8s %8.1f MB/s\n", name, nbytes / elapsed / 1e6);
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  size_t megabytes = argc > 1 ? atoi(argv[1]) : 256;
+  size_t chunk = argc > 2 ? atoi(argv[2]) : 4096;
+
+  char path[] = "zstd-read-benchmark-XXXXXX.i3.zst";
+  int fd = mkstemps(path, 7);
+  if (fd < 0)
+    {
+      perror("mkstemps");
+      return 1;
+    }
+  close(fd);
+
+  const size_t nbytes = megabytes << 20;
+  write_file(path, nbytes);
+  printf("%zu MB, read in %zu-byte chunks\n", megabytes, chunk);
+
+  steady::time_point start = steady::now();
+  size_t got = read_dataio(path, chunk);
+  report("dataio", got, nbytes, seconds_since(start));
+
+  start = steady::now();
+  got = read_raw(path);
+  report("raw", got, nbytes, seconds_since(start));
+
+  if (system("zstd --version > /dev/null 2>&1") == 0)
+    {
+      std::string command = std::string("zstd -q -d -c ") + path + " > /dev/null";
+      start = steady::now();
+      if (system(command.c_str()) != 0)
+        {
+          fprintf(stderr, "%s failed\n", command.c_str());
+          unlink(path);
+          return 1;
+        }
+      report("zstd -d", nbytes, nbytes, seconds_since(start));
+    }
+
+  unlink(path);
+  return 0;
+}
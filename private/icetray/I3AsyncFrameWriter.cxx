@@ -0,0 +1,217 @@
+#include <icetray/I3AsyncFrameWriter.h>
+#include <icetray/open.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <boost/bind.hpp>
+#include <boost/interprocess/streams/vectorstream.hpp>
+
+namespace {
+  double
+  now()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+  }
+}
+
+I3AsyncFrameWriter::I3AsyncFrameWriter(const std::string& filename,
+                                       size_t capacity,
+                                       int compression_level,
+                                       unsigned nthreads,
+                                       unsigned frames_per_seek)
+  : filename_(filename), capacity_(capacity > 0 ? capacity : 1),
+    flushes_asked_(0), flushes_done_(0),
+    closing_(false), closed_(false)
+{
+  memset(&stats_, 0, sizeof(stats_));
+  // open here, so that a bad path is the caller's error
+  if (frames_per_seek > 0 && filename.size() > 4 &&
+      filename.compare(filename.size() - 4, 4, ".zst") == 0)
+    I3::dataio::open_seekable(ofs_, filename, frames_per_seek, 0,
+                              compression_level, nthreads);
+  else
+    I3::dataio::open(ofs_, filename, compression_level, std::ios::binary,
+                     nthreads);
+  thread_ = boost::thread(boost::bind(&I3AsyncFrameWriter::Run, this));
+}
+
+I3AsyncFrameWriter::~I3AsyncFrameWriter()
+{
+  try {
+    Close();
+  } catch (const std::exception& e) {
+    log_error("Writing '%s' failed: %s", filename_.c_str(), e.what());
+  }
+}
+
+void
+I3AsyncFrameWriter::Write(const I3Frame& frame)
+{
+  Item item;
+  item.frame = I3FramePtr(new I3Frame(frame));
+  // nothing the writing thread touches is shared with the caller's copy
+  item.frame->unshare();
+  item.stop = frame.GetStop().id();
+  Put(item);
+}
+
+void
+I3AsyncFrameWriter::Write(std::vector<char>& serialized,
+                          const I3Frame::Stream& stop)
+{
+  Item item;
+  item.bytes.swap(serialized);
+  item.stop = stop.id();
+  Put(item);
+}
+
+void
+I3AsyncFrameWriter::Put(Item& item)
+{
+  boost::mutex::scoped_lock lock(mtx_);
+  Check();
+  if (closing_)
+    log_fatal("'%s' is already closed", filename_.c_str());
+  if (queue_.size() >= capacity_)
+    {
+      stats_.stalls++;
+      double start = now();
+      while (queue_.size() >= capacity_ && !error_)
+        changed_.wait(lock);
+      stats_.stall_seconds += now() - start;
+      Check();
+    }
+  queue_.push_back(Item());
+  queue_.back().frame.swap(item.frame);
+  queue_.back().bytes.swap(item.bytes);
+  queue_.back().stop = item.stop;
+  stats_.peak = std::max(stats_.peak, queue_.size());
+  changed_.notify_all();
+}
+
+void
+I3AsyncFrameWriter::Flush()
+{
+  boost::mutex::scoped_lock lock(mtx_);
+  Check();
+  if (closed_)
+    return;
+  boost::uint64_t ticket = ++flushes_asked_;
+  changed_.notify_all();
+  while (flushes_done_ < ticket && !error_)
+    changed_.wait(lock);
+  Check();
+}
+
+void
+I3AsyncFrameWriter::Close()
+{
+  {
+    boost::mutex::scoped_lock lock(mtx_);
+    if (closed_)
+      {
+        Check();
+        return;
+      }
+    closing_ = true;
+    changed_.notify_all();
+  }
+  thread_.join();
+
+  boost::mutex::scoped_lock lock(mtx_);
+  closed_ = true;
+  Check();
+  log_debug("Wrote %llu frames to %s; the queue was full %llu times, "
+            "for %.3f s", (unsigned long long)stats_.frames,
+            filename_.c_str(), (unsigned long long)stats_.stalls,
+            stats_.stall_seconds);
+}
+
+I3AsyncFrameWriter::Stats
+I3AsyncFrameWriter::GetStats() const
+{
+  boost::mutex::scoped_lock lock(mtx_);
+  Stats stats = stats_;
+  stats.depth = queue_.size();
+  return stats;
+}
+
+void
+I3AsyncFrameWriter::Check()
+{
+  if (error_)
+    std::rethrow_exception(error_);
+}
+
+void
+I3AsyncFrameWriter::Run()
+{
+  try {
+    boost::interprocess::basic_vectorstream<std::vector<char> > buffer;
+    for (;;)
+      {
+        Item item;
+        bool flush = false;
+        {
+          boost::mutex::scoped_lock lock(mtx_);
+          while (queue_.empty() && !closing_ &&
+                 flushes_done_ == flushes_asked_)
+            changed_.wait(lock);
+          if (!queue_.empty())
+            {
+              item.frame.swap(queue_.front().frame);
+              item.bytes.swap(queue_.front().bytes);
+              item.stop = queue_.front().stop;
+              queue_.pop_front();
+              changed_.notify_all();
+            }
+          else if (flushes_done_ < flushes_asked_)
+            flush = true;
+          else
+            break;
+        }
+
+        if (flush)
+          {
+            ofs_.flush();
+            boost::mutex::scoped_lock lock(mtx_);
+            flushes_done_ = flushes_asked_;
+            changed_.notify_all();
+            continue;
+          }
+
+        if (item.frame)
+          {
+            // serialize first, to count the bytes; swapping the empty
+            // item.bytes back in leaves buffer empty and rewound
+            item.frame->save(buffer);
+            buffer.swap_vector(item.bytes);
+          }
+        I3::dataio::mark_frame(ofs_, item.stop);
+        ofs_.write(item.bytes.empty() ? 0 : &item.bytes[0], item.bytes.size());
+        if (!ofs_.good())
+          log_fatal("Error writing to '%s'", filename_.c_str());
+
+        boost::mutex::scoped_lock lock(mtx_);
+        stats_.frames++;
+        stats_.bytes += item.bytes.size();
+      }
+
+    // closing: finish the compressor, then make it all durable
+    ofs_.reset();
+    int fd = ::open(filename_.c_str(), O_RDONLY);
+    if (fd < 0 || fsync(fd) != 0)
+      log_fatal("Could not sync '%s': %s", filename_.c_str(), strerror(errno));
+    ::close(fd);
+  } catch (...) {
+    boost::mutex::scoped_lock lock(mtx_);
+    error_ = std::current_exception();
+    changed_.notify_all();
+  }
+}
@@ -28,7 +28,8 @@
 
 
 I3ConditionalModule::I3ConditionalModule(const I3Context& context) :
-  I3Module(context)
+  I3Module(context), use_if_(false), use_pick_(false),
+  nexecuted_(0), nskipped_(0)
 {
   i3_log("%s", __PRETTY_FUNCTION__);
 
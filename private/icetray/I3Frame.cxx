@@ -24,12 +24,15 @@
 #include <boost/iostreams/stream.hpp>
 #include <boost/iostreams/device/array.hpp>
 #include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/iostreams/copy.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/interprocess/streams/bufferstream.hpp>
 #include <boost/interprocess/streams/vectorstream.hpp>
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
-#include <boost/regex.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/format.hpp>
 #include <boost/utility/enable_if.hpp>
 #include <boost/type_traits/is_pod.hpp>
@@ -38,6 +41,7 @@
 #include <icetray/Utility.h>
 #include <icetray/I3Frame.h>
 #include <icetray/I3Tray.h>
+#include <icetray/I3Tracer.h>
 
 #include "crc-ccitt.h"
 
@@ -145,12 +149,16 @@ namespace {
 
 I3Frame::I3Frame(Stream stop)
   : stop_(stop),
-    drop_blobs_(true)
+    drop_blobs_(true),
+    map_(new map_t),
+    pure_(true)
 { }
 
 I3Frame::I3Frame(char stop)
   : stop_(I3Frame::Stream(stop)),
-    drop_blobs_(true)
+    drop_blobs_(true),
+    map_(new map_t),
+    pure_(true)
 { }
 
 I3Frame::I3Frame(const I3Frame& rhs)
@@ -163,43 +171,115 @@ vector<string>
 I3Frame::keys() const
 {
   vector<string> keys_;
-  for(I3Frame::map_t::const_iterator iter = map_.begin(); 
-      iter != map_.end();
+  for(I3Frame::map_t::const_iterator iter = map_->begin(); 
+      iter != map_->end();
       iter++)
     {
-      keys_.push_back(iter->first.string);
+      keys_.push_back(iter->first.str());
     }  
+  for (vector<boost::shared_ptr<const I3Frame> >::const_iterator parent = parents_.begin();
+       parent != parents_.end(); parent++)
+    for (map_t::const_iterator iter = (*parent)->map_->begin();
+         iter != (*parent)->map_->end(); iter++)
+      keys_.push_back(iter->first.str());
   std::sort(keys_.begin(), keys_.end());
+  if (!parents_.empty())
+    keys_.erase(std::unique(keys_.begin(), keys_.end()), keys_.end());
   return keys_;
 }
 
+I3Frame::size_type I3Frame::size() const
+{
+  if (parents_.empty())
+    return map_->size();
+  return keys().size();
+}
+
 I3Frame& I3Frame::operator=(const I3Frame& rhs)
 {
   if (this != &rhs)
     {
       stop_ = rhs.stop_;
       drop_blobs_ = rhs.drop_blobs_;
+      // share rhs's table until one of us changes it
       map_ = rhs.map_;
+      parents_ = rhs.parents_;
+      pure_ = rhs.pure_;
     }
 
   return *this;
 }
 
+I3Frame::map_t& I3Frame::mutable_map()
+{
+  if (!map_.unique())
+    map_ = boost::make_shared<map_t>(*map_);
+  return *map_;
+}
+
+bool I3Frame::inherits(const I3FrameKey& key) const
+{
+  for (vector<boost::shared_ptr<const I3Frame> >::const_iterator parent = parents_.begin();
+       parent != parents_.end(); parent++)
+    if ((*parent)->map_->count(key))
+      return true;
+  return false;
+}
+
+void I3Frame::flatten() const
+{
+  if (parents_.empty())
+    return;
+  // the frame holds the same keys afterwards, so this is const as far
+  // as anyone outside can tell.
+  map_t& map = const_cast<I3Frame*>(this)->mutable_map();
+  for (vector<boost::shared_ptr<const I3Frame> >::const_iterator parent = parents_.begin();
+       parent != parents_.end(); parent++)
+    map.insert((*parent)->map_->begin(), (*parent)->map_->end());
+  parents_.clear();
+  pure_ = false;
+}
+
+void I3Frame::overlay(const boost::shared_ptr<const I3Frame>& parent)
+{
+  if (!parent || parent.get() == this)
+    return;
+  if (!parent->map_->empty())
+    parents_.push_back(parent);
+  parents_.insert(parents_.end(), parent->parents_.begin(), parent->parents_.end());
+}
+
 
 I3Frame::size_type I3Frame::size(const string& key) const
 {
-  map_t::iterator iter = map_.find(key);
-  if (iter == map_.end())
+  const boost::shared_ptr<value_t>* value = lookup(key);
+  if (!value)
     log_fatal("attempt to get size of nonexistent frame object \"%s\"", key.c_str());
-  return size(*iter->second);
+  return size(**value);
+}
+
+namespace {
+  template <typename Map, typename Pred>
+  bool any_value(const Map& map, Pred pred)
+  {
+    for (typename Map::const_iterator it = map.begin(); it != map.end(); it++)
+      if (pred(*it->second))
+        return true;
+    return false;
+  }
 }
 
 void I3Frame::purge(const Stream& what)
 {
-  map_t::iterator it = map_.begin();
-  while (it != map_.end()) {
+  flatten();
+  // don't unshare the table if there is nothing to remove
+  if (!any_value(*map_, [&](const value_t& v) { return v.stream == what; }))
+    return;
+  map_t& map = mutable_map();
+  map_t::iterator it = map.begin();
+  while (it != map.end()) {
     if (it->second->stream == what)
-      map_.erase(it++);
+      map.erase(it++);
     else
       it++;
   }
@@ -207,25 +287,62 @@ void I3Frame::purge(const Stream& what)
 
 void I3Frame::purge()
 {
-  map_t::iterator it = map_.begin();
-  while (it != map_.end()) {
+  // overlaid frames are on other streams by construction
+  parents_.clear();
+  if (pure_)
+    return;
+  pure_ = true;
+  if (!any_value(*map_, [&](const value_t& v) { return v.stream != stop_; }))
+    return;
+  map_t& map = mutable_map();
+  map_t::iterator it = map.begin();
+  while (it != map.end()) {
     if (it->second->stream != stop_)
-      map_.erase(it++);
+      map.erase(it++);
     else
       it++;
   }
 }
 
+void I3Frame::unshare()
+{
+  boost::shared_ptr<map_t> map = boost::make_shared<map_t>();
+  map->reserve(map_->size());
+  for (map_t::const_iterator it = map_->begin(); it != map_->end(); it++)
+    {
+      settle(*it->second);
+      (*map)[it->first] = boost::make_shared<value_t>(*it->second);
+    }
+  map_ = map;
+}
+
 void I3Frame::merge(const I3Frame& rhs)
 {
-  map_.insert(rhs.map_.begin(), rhs.map_.end());
+  if (rhs.map_->empty() && rhs.parents_.empty())
+    return;
+  flatten();
+  pure_ = false;
+  map_t& map = mutable_map();
+  map.insert(rhs.map_->begin(), rhs.map_->end());
+  for (vector<boost::shared_ptr<const I3Frame> >::const_iterator parent = rhs.parents_.begin();
+       parent != rhs.parents_.end(); parent++)
+    map.insert((*parent)->map_->begin(), (*parent)->map_->end());
 }
 
 void I3Frame::take(const I3Frame& rhs, const string& what, const string& as)
 {
-  map_t::const_iterator iter = rhs.map_.find(what);
-  if (iter != rhs.map_.end())
-    map_[as] = iter->second;
+  const boost::shared_ptr<value_t>* value = rhs.lookup(what);
+  if (value)
+    {
+      // take a copy first: mutable_map() may unshare a table value points into
+      boost::shared_ptr<value_t> taken = *value;
+      I3FrameKey key(as);
+      if (inherits(key))
+        flatten();
+      if (taken->stream != stop_)
+        pure_ = false;
+      mutable_map()[key] = taken;
+    }
   else
     log_fatal("attempt to take \"%s\" from a frame that doesn't have one", what.c_str());
 }
@@ -233,22 +350,32 @@ void I3Frame::take(const I3Frame& rhs, const string& what, const string& as)
 I3Frame::Stream
 I3Frame::GetStop(const std::string& key) const
 {
-	map_t::const_iterator iter = map_.find(key);
-	if (iter == map_.end())
+	const boost::shared_ptr<value_t>* value = lookup(key);
+	if (!value)
 		log_fatal("The key '%s' doesn't exist in this frame", key.c_str());
 	else
-		return iter->second->stream;
+		return (*value)->stream;
 }
 
 void I3Frame::Put(const string& name, I3FrameObjectConstPtr element)
 {
-  Put(name, element, stop_);
+  Put(I3FrameKey(name), element, stop_);
 }
 
 void I3Frame::Put(const string& name, I3FrameObjectConstPtr element, const I3Frame::Stream& on_stream)
 {
-  map_t::iterator it = map_.find(name);
-  if (it != map_.end())
+  Put(I3FrameKey(name), element, on_stream);
+}
+
+void I3Frame::Put(const I3FrameKey& key, I3FrameObjectConstPtr element)
+{
+  Put(key, element, stop_);
+}
+
+void I3Frame::Put(const I3FrameKey& key, I3FrameObjectConstPtr element, const I3Frame::Stream& on_stream)
+{
+  const string& name = key.str();
+  if (lookup(key))
     {
       log_fatal("frame already contains \"%s\", of type \"%s\"", 
                 name.c_str(), type_name(name).c_str());
@@ -262,49 +389,67 @@ void I3Frame::Put(const string& name, I3FrameObjectConstPtr element, const I3Fra
               "which contains an illegal whitespace character",
               name.c_str());
   
-  boost::shared_ptr<value_t> sptr(new value_t);
-  map_[name] = sptr;
+  boost::shared_ptr<value_t> sptr = boost::make_shared<value_t>();
+  mutable_map()[key] = sptr;
   value_t& value = *sptr;
   value.size = 0;
   value.ptr = element;
   value.stream = on_stream;
+  if (on_stream != stop_)
+    pure_ = false;
 }
 
 void I3Frame::Rename(const string& fromname, const string& toname)
 {
-  map_t::iterator fromiter = map_.find(fromname);
-  if (fromiter == map_.end())
+  if (!lookup(fromname))
     log_fatal("attempt to rename \"%s\" to \"%s\", but the source is empty",
               fromname.c_str(), toname.c_str());
 
-  map_t::const_iterator toiter = map_.find(toname);
-  if (toiter != map_.end())
+  if (lookup(toname))
     log_fatal("attempt to rename \"%s\" to \"%s\", but the destination is already full",
               fromname.c_str(), toname.c_str());
 
-  map_[toname] = map_[fromname];
-  map_.erase(fromiter);
+  // the source must not show through from a parent afterwards
+  I3FrameKey from(fromname);
+  if (inherits(from))
+    flatten();
+
+  map_t& map = mutable_map();
+  boost::shared_ptr<value_t> value = map.find(from)->second;
+  map.erase(from);
+  map[I3FrameKey(toname)] = value;
 
 }
 
-void I3Frame::ChangeStream(const string& key, I3Frame::Stream stream)
+void I3Frame::ChangeStream(const string& name, I3Frame::Stream stream)
 {
-  map_t::iterator fromiter = map_.find(key);
-  if (fromiter == map_.end())
+  if (!lookup(name))
     log_fatal("attempt to change stream of \"%s\", but it doesn't exist",
-      key.c_str());
+      name.c_str());
+  I3FrameKey key(name);
+  if (!map_->count(key))
+    flatten();
+
+  map_t::iterator fromiter = mutable_map().find(key);
 
   // Duplicate value_t to avoid potential caching issues
-  boost::shared_ptr<value_t> sptr(new value_t(*fromiter->second));
+  settle(*fromiter->second);
+  boost::shared_ptr<value_t> sptr = boost::make_shared<value_t>(*fromiter->second);
   sptr->stream = stream;
   fromiter->second = sptr;
+  if (stream != stop_)
+    pure_ = false;
 }
 
 void I3Frame::Delete(const string& name)
 {
-  map_t::iterator what = map_.find(name);
-  if (what != map_.end())
-    map_.erase(what);
+  I3FrameKey key;
+  if (!I3FrameKey::Find(name, key))
+    return;
+  if (inherits(key))
+    flatten();
+  if (map_->count(key))
+    mutable_map().erase(key);
 }
 
 
@@ -326,21 +471,21 @@ string I3Frame::as_xml(const string& key) const
 
 string I3Frame::type_name(const string& key) const
 {
-  map_t::iterator iter = map_.find(key);
+  const boost::shared_ptr<value_t>* value = lookup(key);
   // first check to see if it is there, otherwise throw
-  if (iter == map_.end())
+  if (!value)
     log_fatal("attempt to get type name for \"%s\", which does not exists",
               key.c_str());
 
-  return type_name(*iter->second);
+  return type_name(**value);
 }
 
 const type_info* I3Frame::type_id(const string& key) const
 {
-  map_t::const_iterator iter = map_.find(key);
-  if (iter == map_.end())
+  const boost::shared_ptr<value_t>* value = lookup(key);
+  if (!value)
     return NULL;
-  const I3FrameObject* fo = get_impl(*iter).get();
+  const I3FrameObject* fo = get_impl(key, **value).get();
   if (fo == NULL)
     return NULL;
 
@@ -428,6 +573,23 @@ namespace
     crc.process_bytes(&pod, sizeof(T));
 #endif
   }
+
+  // same as crcit() on a container, for a buffer that isn't one
+  template <typename CRC>
+  inline void
+  crcit_bytes (const char* data, uint32_t size, CRC& crc, bool orly = true)
+  {
+    if (!orly)
+      return;
+#if BYTE_ORDER == BIG_ENDIAN
+    uint32_t swapped = size;
+    icecube::archive::portable::swap(swapped);
+    crc.process_bytes(&swapped, sizeof(size));
+#else
+    crc.process_bytes(&size, sizeof(size));
+#endif
+    crc.process_bytes(data, size);
+  }
 }    
 
 
@@ -459,12 +621,13 @@ void I3Frame::create_blob_impl(I3Frame::value_t &value)
 
 void I3Frame::create_blob(bool drop_memory_data, const std::string &key) const
 {
-  map_t::const_iterator iter = map_.find(key);
-  if (iter == map_.end())
+  const boost::shared_ptr<value_t>* found = lookup(key);
+  if (!found)
     log_fatal("Tried to create a blob for unknown key %s", key.c_str());
-  value_t& value = *(iter->second);
+  value_t& value = **found;
+  settle(value);
 
-  if (value.blob.buf.size() == 0) {
+  if (value.blob.size() == 0) {
     // only create a blob if there is none yet
     try {
       create_blob_impl(value);
@@ -480,33 +643,72 @@ void I3Frame::create_blob(bool drop_memory_data, const std::string &key) const
   }
 }
 
-void I3Frame::create_blobs(bool drop_memory_data, const std::vector<std::string>& skip) const
+void I3Frame::create_blobs_parallel(const vector<string>& keys, I3ThreadPool& pool) const
 {
-  for (map_t::iterator iter = map_.begin();
-       iter != map_.end();
+  vector<I3ThreadPool::TaskPtr> tasks(keys.size());
+  for (unsigned i = 0; i < keys.size(); i++)
+    {
+      value_t& value = **lookup(keys[i]);
+      settle(value);
+      if (value.blob.size() == 0)
+        tasks[i] = pool.Submit(boost::bind(&I3Frame::create_blob_impl, boost::ref(value)));
+    }
+
+  // wait for everything before reporting, so nothing is left running
+  // against this frame
+  vector<string> errors(keys.size());
+  for (unsigned i = 0; i < keys.size(); i++)
+    {
+      if (!tasks[i])
+        continue;
+      try {
+        tasks[i]->Wait();
+      } catch (const exception &e) {
+        errors[i] = e.what();
+      }
+    }
+  for (unsigned i = 0; i < keys.size(); i++)
+    if (!errors[i].empty())
+      log_fatal("caught \"%s\" while writing frame object \"%s\" of type \"%s\"",
+                errors[i].c_str(), keys[i].c_str(),
+                (*lookup(keys[i]))->blob.type_name.c_str());
+}
+
+void I3Frame::create_blobs(bool drop_memory_data, const I3FrameKeyMatcher& skip,
+                           I3ThreadPool* pool) const
+{
+  vector<string> keys;
+  for (map_t::const_iterator iter = map_->begin();
+       iter != map_->end();
        iter++)
   {
-    bool skipIt = false;
-    for (vector<string>::const_iterator skipIter = skip.begin();
-         !skipIt && (skipIter != skip.end());
-         skipIter++)
-      {
-        boost::regex reg(*skipIter);
-        skipIt = boost::regex_match(iter->first.string, reg);
-      }
+    bool skipIt = skip(iter->first.str());
 
     if (iter->second->stream != stop_.id())
       skipIt = true;
 
     if (skipIt) continue;
 
-    create_blob(drop_memory_data, iter->first.string);
+    keys.push_back(iter->first.str());
   }
+
+  if (pool && keys.size() > 1)
+    create_blobs_parallel(keys, *pool);
+
+  for (vector<string>::const_iterator key = keys.begin(); key != keys.end(); key++)
+    create_blob(drop_memory_data, *key);
+}
+
+namespace {
+  // what the tracer calls frame loads and saves
+  const std::string trace_load("load");
+  const std::string trace_save("save");
 }
 
 template <typename OStreamT>
-void I3Frame::save(OStreamT& os, const vector<string>& skip) const
+void I3Frame::save(OStreamT& os, const I3FrameKeyMatcher& skip, I3ThreadPool* pool) const
 {
+  I3TraceScope trace("frame", trace_save, stop_.id());
   crc_t crc;
 
   os.write(tag, sizeof(i3frame_tag_t));
@@ -519,27 +721,36 @@ void I3Frame::save(OStreamT& os, const vector<string>& skip) const
     crc.process_byte(stop_.id());
 
     // save map values in a set to check, if keys (guaranteed in a map) and pointers are
-    // unique.  skip values, where key matches an element in vector skip.
+    // unique.  skip values whose key is matched by skip.
     std::set<std::string> mapAsSet;
-    for (map_t::iterator iter = map_.begin();
-         iter != map_.end();
+    for (map_t::const_iterator iter = map_->begin();
+         iter != map_->end();
          iter++)
       {
-        bool skipIt = false;
-        for (vector<string>::const_iterator skipIter = skip.begin();
-             !skipIt && (skipIter != skip.end());
-             skipIter++)
-          {
-            boost::regex reg(*skipIter);
-            skipIt = boost::regex_match(iter->first.string, reg);
-          }
+        bool skipIt = skip(iter->first.str());
 
         if (iter->second->stream != stop_.id())
           skipIt = true;
 
         if (skipIt) continue;
 
-        mapAsSet.insert(iter->first.string);
+        mapAsSet.insert(iter->first.str());
+      }
+
+    // serialize whatever has no blob yet all at once, and drop those
+    // blobs again once they are written, as the serial path does.
+    vector<value_t*> fresh;
+    if (pool && mapAsSet.size() > 1)
+      {
+        vector<string> keys(mapAsSet.begin(), mapAsSet.end());
+        for (vector<string>::const_iterator key = keys.begin(); key != keys.end(); key++)
+          {
+            value_t& value = **lookup(*key);
+            settle(value);
+            if (value.blob.size() == 0)
+              fresh.push_back(&value);
+          }
+        create_blobs_parallel(keys, *pool);
       }
 
     i3frame_nslots_t size = mapAsSet.size();
@@ -551,11 +762,22 @@ void I3Frame::save(OStreamT& os, const vector<string>& skip) const
          iter++)
       {
         const string &key = *iter;
-        value_t& value = *map_[key];
+        value_t& value = **lookup(key);
 
         poa << make_nvp("key", key);
         crcit(key, crc);
-        if (value.blob.buf.size()) // there's a buffer there.  use it and its type_name.
+        if (value.blob.mapped) // still in place in a mapped file.  copy it over as-is.
+          {
+            string type_name = value.blob.type_name;
+            poa << make_nvp("type_name", type_name);
+            crcit(type_name, crc);
+            // this is exactly what serializing a vector<char> writes
+            uint32_t count = value.blob.size();
+            poa << make_nvp("count", count);
+            os.write(value.blob.data(), count);
+            crcit_bytes(value.blob.data(), count, crc);
+          }
+        else if (value.blob.buf.size()) // there's a buffer there.  use it and its type_name.
           {
             string type_name = value.blob.type_name;
             poa << make_nvp("type_name", type_name);
@@ -582,21 +804,61 @@ void I3Frame::save(OStreamT& os, const vector<string>& skip) const
               value.blob.reset();
           }
       }
+    if (drop_blobs_)
+      for (vector<value_t*>::const_iterator value = fresh.begin(); value != fresh.end(); value++)
+        (*value)->blob.reset();
+
     i3frame_checksum_t sum = crc.checksum();
     poa << make_nvp("checksum", sum);
   }
 }
 
 
+template <typename IStreamT>
+bool I3Frame::load(IStreamT& is, const I3FrameKeyMatcher& skip, bool verify_cksum)
+{
+  I3TraceScope trace("frame", trace_load);
+  if (!load_frame(is, skip, verify_cksum, boost::shared_ptr<const char>()))
+    return false;
+  trace.SetStop(stop_.id());
+  return true;
+}
+
+bool I3Frame::load(const boost::shared_ptr<const io::mapped_file_source>& file,
+                   uint64_t& offset, const I3FrameKeyMatcher& skip, bool verify_cksum)
+{
+  if (!file || !file->is_open())
+    log_fatal("attempt to read from a file that isn't mapped");
+  if (offset >= file->size())
+    return false;
+
+  // aliases the mapping: blobs that point into it keep it open
+  boost::shared_ptr<const char> mapping(file, file->data() + offset);
+  io::stream<io::array_source> is(mapping.get(), file->size() - offset);
+  I3TraceScope trace("frame", trace_load);
+  if (!load_frame(is, skip, verify_cksum, mapping))
+    return false;
+  trace.SetStop(stop_.id());
+  offset += uint64_t(is.tellg());
+  return true;
+}
+
 //
-//  Toplevel load interface, dispatches to versioned versions
+//  Toplevel load interface, dispatches to versioned versions.
+//  If mapping is set, it points at the first byte of the stream.
 //
 template <typename IStreamT>
-bool I3Frame::load(IStreamT& is, const vector<string>& skip, bool verify_cksum)
+bool I3Frame::load_frame(IStreamT& is, const I3FrameKeyMatcher& skip, bool verify_cksum,
+                         const boost::shared_ptr<const char>& mapping)
 {
   if (!is.good())
     log_fatal("attempt to read from stream in error state");
 
+  // everything read goes on the stream read, which need not be the one
+  // of whatever the frame already holds
+  if (!map_->empty() || !parents_.empty())
+    pure_ = false;
+
   // read and verify frame tag "[i3]", if not get version and dispatch to load_old
   i3frame_tag_t frameTagRead;
   is.read(frameTagRead, sizeof(i3frame_tag_t));
@@ -638,7 +900,7 @@ bool I3Frame::load(IStreamT& is, const vector<string>& skip, bool verify_cksum)
     if (versionRead == 4)
       return load_v4(is, skip);
     else if (versionRead == 5 || versionRead == 6)
-      return load_v56(is, skip, versionRead == 6, verify_cksum);
+      return load_v56(is, skip, versionRead == 6, verify_cksum, mapping);
     else
       log_fatal("Frame is version %u, this software can read only up to version %d", versionRead, version);
   }
@@ -653,7 +915,8 @@ bool I3Frame::load(IStreamT& is, const vector<string>& skip, bool verify_cksum)
 //
 //
 template <typename IStreamT>
-bool I3Frame::load_v56(IStreamT& is, const vector<string>& skip, bool v6, bool verify)
+bool I3Frame::load_v56(IStreamT& is, const I3FrameKeyMatcher& skip, bool v6, bool verify,
+                       const boost::shared_ptr<const char>& mapping)
 {
   if (!is.good())
     log_fatal("attempt to read from stream in error state");
@@ -661,7 +924,7 @@ bool I3Frame::load_v56(IStreamT& is, const vector<string>& skip, bool v6, bool v
   i3frame_checksum_t checksumRead;
 
   crc_t crc(v6);
-  bool calc_crc = (skip.size() == 0);
+  bool calc_crc = skip.empty();
 
   // read size of the entire (serialized) frame
   // read checksum plus entire frame and process/test checksum
@@ -676,11 +939,7 @@ bool I3Frame::load_v56(IStreamT& is, const vector<string>& skip, bool v6, bool v
     bia >> make_nvp("size", nslots);
     if (verify)
       crcit(nslots, crc, calc_crc);
-#ifdef USING_GCC_EXT_HASH_MAP
-    map_.resize(nslots);
-#else
-    map_.reserve(nslots);
-#endif
+    mutable_map().reserve(map_->size() + nslots);
 
     for (unsigned int i = 0; i < nslots; i++)
       {
@@ -694,14 +953,7 @@ bool I3Frame::load_v56(IStreamT& is, const vector<string>& skip, bool v6, bool v
         if (verify)
 	  crcit(type_name, crc, calc_crc);
 
-        bool skipIt = false;
-        for (vector<string>::const_iterator skipIter = skip.begin();
-             !skipIt && (skipIter != skip.end());
-             skipIter++)
-          {
-            boost::regex reg(*skipIter);
-            skipIt = boost::regex_match(key, reg);
-          }
+        bool skipIt = skip(key);
 
         if (skipIt)
           {
@@ -715,21 +967,41 @@ bool I3Frame::load_v56(IStreamT& is, const vector<string>& skip, bool v6, bool v
           }
         else
           {
-            boost::shared_ptr<value_t> vp(new value_t);
+            boost::shared_ptr<value_t> vp = boost::make_shared<value_t>();
 	    vp->stream = stop_.id();
-            map_[key] = vp;
+            mutable_map()[I3FrameKey(key)] = vp;
             blob_t& blob = vp->blob;
-	    try {
-	      bia >> make_nvp("buf", blob.buf);
-	    } catch (const std::bad_alloc& e) {
-	      log_fatal("Fatal length error while trying to deserialize object '%s' of type %s: object exceeds its maximum permitted size.", key.c_str(), type_name.c_str());
-	    }
-            if (blob.buf.size() == 0)
+            if (mapping)
+              {
+                // leave the buffer where it is, and just point at it
+                uint32_t count;
+                bia >> make_nvp("count", count);
+                std::streamoff pos = is.tellg();
+#ifdef WORKAROUND_LIBCPP_ISTREAM_IGNORE_ISSUE
+                istream_ignore_workaround(is, count);
+#else
+                is.ignore(count);
+#endif
+                if (!is.good() || is.gcount() != std::streamsize(count))
+                  log_fatal("mapped file ends in the middle of object '%s' of type %s",
+                            key.c_str(), type_name.c_str());
+                blob.mapped = boost::shared_ptr<const char>(mapping, mapping.get() + pos);
+                blob.mapped_size = count;
+              }
+            else
+              {
+	        try {
+	          bia >> make_nvp("buf", blob.buf);
+	        } catch (const std::bad_alloc& e) {
+	          log_fatal("Fatal length error while trying to deserialize object '%s' of type %s: object exceeds its maximum permitted size.", key.c_str(), type_name.c_str());
+	        }
+              }
+            if (blob.size() == 0)
               log_fatal("read a zero-size buffer from input stream?");
             if (verify)
-	      crcit(blob.buf, crc, calc_crc);
+	      crcit_bytes(blob.data(), blob.size(), crc, calc_crc);
             blob.type_name = type_name;
-            vp->size = blob.buf.size();
+            vp->size = blob.size();
           }
       }
 
@@ -748,7 +1020,7 @@ bool I3Frame::load_v56(IStreamT& is, const vector<string>& skip, bool v6, bool v
 //
 //
 template <typename IStreamT>
-bool I3Frame::load_v4(IStreamT& is, const vector<string>& skip)
+bool I3Frame::load_v4(IStreamT& is, const I3FrameKeyMatcher& skip)
 {
   if (!is.good())
     log_fatal("attempt to read from stream in error state");
@@ -796,14 +1068,7 @@ bool I3Frame::load_v4(IStreamT& is, const vector<string>& skip)
         bia >> make_nvp("key", key);
         bia >> make_nvp("type_name", type_name);
 
-        bool skipIt = false;
-        for (vector<string>::const_iterator skipIter = skip.begin();
-             !skipIt && (skipIter != skip.end());
-             skipIter++)
-          {
-            boost::regex reg(*skipIter);
-            skipIt = boost::regex_match(key, reg);
-          }
+        bool skipIt = skip(key);
 
         if (skipIt)
           {
@@ -817,9 +1082,9 @@ bool I3Frame::load_v4(IStreamT& is, const vector<string>& skip)
           }
         else
           {
-            boost::shared_ptr<value_t> vp(new value_t);
+            boost::shared_ptr<value_t> vp = boost::make_shared<value_t>();
 	    vp->stream = stop_.id();
-            map_[key] = vp;
+            mutable_map()[I3FrameKey(key)] = vp;
             blob_t& blob = vp->blob;
 	    try {
 	      bia >> make_nvp("buf", blob.buf);
@@ -844,7 +1109,7 @@ bool I3Frame::load_v4(IStreamT& is, const vector<string>& skip)
 //
 template <class IStream>
 bool I3Frame::load_old(IStream& is,
-                       const vector<string>& skip,
+                       const I3FrameKeyMatcher& skip,
                        uint32_t versionRead)
 {
   if (is.eof())        
@@ -869,14 +1134,7 @@ bool I3Frame::load_old(IStream& is,
       string key, type_name, buf;
       bufArchive >> make_nvp("key", key);
       bufArchive >> make_nvp("type_name", type_name);
-      bool skipIt = false;
-      for (vector<string>::const_iterator skipIter = skip.begin();
-           !skipIt && (skipIter != skip.end());
-           skipIter++)
-        {
-          boost::regex reg(*skipIter);
-          skipIt = boost::regex_match(key, reg);
-        }
+      bool skipIt = skip(key);
       if (skipIt) 
         {
 	  uint32_t count;
@@ -899,9 +1157,9 @@ bool I3Frame::load_old(IStream& is,
 	  }
 	
   
-	  boost::shared_ptr<value_t> spv(new value_t);
+	  boost::shared_ptr<value_t> spv = boost::make_shared<value_t>();
 	  spv->stream = stop_.id();
-	  map_[key] = spv;
+	  mutable_map()[I3FrameKey(key)] = spv;
 	  blob_t& blob = spv->blob;
 	  blob.type_name = type_name;
 	  blob.buf.resize(buf.size());
@@ -939,21 +1197,14 @@ ostream& operator<<(ostream& os, const I3Frame& frame)
   // 
   //  for readability print these in sorted order.
   //
-  vector<string> keys;
-  for(I3Frame::map_t::const_iterator iter = frame.map_.begin(); 
-      iter != frame.map_.end();
-      iter++)
-    {
-      keys.push_back(iter->first.string);
-    }  
-  std::sort(keys.begin(), keys.end());
+  vector<string> keys = frame.keys();
 
   os << "[ I3Frame  (" << frame.stop_.str() << "):\n";
   for(vector<string>::iterator iter = keys.begin(); 
       iter != keys.end();
       iter++)
     {
-      os << "  '" << *iter << "' [" << frame.map_[*iter]->stream << "]"
+      os << "  '" << *iter << "' [" << (*frame.lookup(*iter))->stream << "]"
 	 << " ==> ";
       os << frame.type_name(*iter);
 
@@ -972,31 +1223,102 @@ ostream& operator<<(ostream& os, const I3Frame& frame)
 
 
 
-I3FrameObjectConstPtr I3Frame::get_impl(map_t::const_reference pr) const
+I3FrameObjectPtr I3Frame::load_blob(const value_t& value)
 {
-  value_t& value = const_cast<value_t&>(*pr.second);
+  io::array_source src(value.blob.data(), value.blob.size());
+  io::filtering_istream fis(src);
+  icecube::archive::portable_binary_iarchive pia(fis);
+  I3FrameObjectPtr fop;
+  pia >> fop;
+  return fop;
+}
+
+namespace {
+  // Values are shared between frames that may be on different threads:
+  // copies, and parents mixed in with overlay().  Filling one in lazily
+  // -- ptr, pending, and dropping the blob after -- happens under one
+  // of these, picked by the value's address.
+  const size_t n_value_mutexes = 64;
+  boost::mutex value_mutexes[n_value_mutexes];
+
+  boost::mutex& value_mutex(const void* value)
+  {
+    return value_mutexes[(reinterpret_cast<size_t>(value) / 16) % n_value_mutexes];
+  }
+}
+
+void I3Frame::prefetch_impl(boost::shared_ptr<value_t> value)
+{
+  // Failures are left for get_impl() to run into and report.
+  boost::mutex::scoped_lock lock(value_mutex(value.get()));
+  if (value->ptr || value->blob.size() == 0)
+    return;
+  try {
+    value->ptr = load_blob(*value);
+  } catch (...) { }
+}
+
+void I3Frame::settle(value_t& value)
+{
+  I3ThreadPool::TaskPtr pending;
+  {
+    boost::mutex::scoped_lock lock(value_mutex(&value));
+    pending = value.pending;
+  }
+  if (!pending)
+    return;
+  // not under the lock: the task takes it too
+  pending->Wait();
+  boost::mutex::scoped_lock lock(value_mutex(&value));
+  if (value.pending == pending)
+    value.pending.reset();
+}
+
+void I3Frame::Prefetch(const vector<string>& keys, I3ThreadPool& pool) const
+{
+  for (vector<string>::const_iterator key = keys.begin(); key != keys.end(); key++)
+    {
+      const boost::shared_ptr<value_t>* found = lookup(*key);
+      if (!found)
+        continue;
+      const boost::shared_ptr<value_t>& value = *found;
+      {
+        boost::mutex::scoped_lock lock(value_mutex(value.get()));
+        if (value->pending || value->ptr || value->blob.size() == 0)
+          continue;
+      }
+      // a pool without threads runs the task right here, so submit
+      // unlocked; a second prefetch racing this one finds ptr set
+      I3ThreadPool::TaskPtr task =
+        pool.Submit(boost::bind(&I3Frame::prefetch_impl, value));
+      boost::mutex::scoped_lock lock(value_mutex(value.get()));
+      value->pending = task;
+    }
+}
+
+I3FrameObjectConstPtr I3Frame::get_impl(const string& key, value_t& value) const
+{
+  settle(value);
+  boost::mutex::scoped_lock lock(value_mutex(&value));
   if (value.ptr) 
     {
-      if (drop_blobs_)
+      // frames sharing the value may differ in drop_blobs_; whoever
+      // drops it does so under the lock, after it is no longer needed
+      if (drop_blobs_ && value.blob.size() != 0)
 	value.blob.reset();
       
       return value.ptr;
     }
-  if (!value.ptr && value.blob.buf.size() == 0)
+  if (value.blob.size() == 0)
     return I3FrameObjectConstPtr();
 
-  io::array_source src(&(value.blob.buf[0]), value.blob.buf.size());
-  io::filtering_istream fis(src);
-  icecube::archive::portable_binary_iarchive pia(fis);
-  I3FrameObjectPtr fop;
   try {
-    pia >> fop;
-    value.ptr = fop;
+    value.ptr = load_blob(value);
     if (drop_blobs_)
       value.blob.reset();
   } catch (const ar::archive_exception& e) {
       log_debug("frame caught exception \"%s\" while loading class type \"%s\" "
-                "at key \"%s\"", e.what(), value.blob.type_name.c_str(), pr.first.string.c_str());
+                "at key \"%s\"", e.what(), value.blob.type_name.c_str(), key.c_str());
     return I3FrameObjectConstPtr();
   }
   
@@ -1004,14 +1326,14 @@ I3FrameObjectConstPtr I3Frame::get_impl(map_t::const_reference pr) const
 }
 
 
-template bool I3Frame::load(io::filtering_istream&, const vector<string>&, bool);
-template bool I3Frame::load(istream& is, const vector<string>&, bool);
-template bool I3Frame::load(ifstream& is, const vector<string>&, bool);
-template bool I3Frame::load(boost::interprocess::bufferstream& is, const vector<string>&, bool);
+template bool I3Frame::load(io::filtering_istream&, const I3FrameKeyMatcher&, bool);
+template bool I3Frame::load(istream& is, const I3FrameKeyMatcher&, bool);
+template bool I3Frame::load(ifstream& is, const I3FrameKeyMatcher&, bool);
+template bool I3Frame::load(boost::interprocess::bufferstream& is, const I3FrameKeyMatcher&, bool);
 template bool I3Frame::load(boost::interprocess::basic_vectorstream<std::vector<
-char> >& is, const vector<string>&, bool);
+char> >& is, const I3FrameKeyMatcher&, bool);
 
-template void I3Frame::save(io::filtering_ostream&, const vector<string>&) const;
-template void I3Frame::save(boost::interprocess::basic_vectorstream<std::vector<char> >&, const vector<string>&) const;
-template void I3Frame::save(ostream&, const vector<string>&) const;
-template void I3Frame::save(ofstream&, const std::vector<string>&) const;
+template void I3Frame::save(io::filtering_ostream&, const I3FrameKeyMatcher&, I3ThreadPool*) const;
+template void I3Frame::save(boost::interprocess::basic_vectorstream<std::vector<char> >&, const I3FrameKeyMatcher&, I3ThreadPool*) const;
+template void I3Frame::save(ostream&, const I3FrameKeyMatcher&, I3ThreadPool*) const;
+template void I3Frame::save(ofstream&, const I3FrameKeyMatcher&, I3ThreadPool*) const;
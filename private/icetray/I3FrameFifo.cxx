@@ -0,0 +1,65 @@
+#include <icetray/I3FrameFifo.h>
+
+I3FrameFifo::I3FrameFifo(size_t capacity)
+  : head_(0), tail_(0), mask_(0), capacity_(0), highwater_(0), above_(false),
+    pushed_(0), stalls_(0), crossings_(0), peak_(0)
+{
+  SetCapacity(capacity);
+}
+
+void
+I3FrameFifo::SetCapacity(size_t capacity)
+{
+  if (!empty())
+    log_fatal("Cannot resize a fifo with %zu frames in it", size());
+  if (capacity == 0)
+    capacity = 1;
+
+  size_t nslots = 1;
+  while (nslots < capacity)
+    nslots <<= 1;
+  std::vector<I3FramePtr>(nslots).swap(slots_);
+  mask_ = nslots - 1;
+  // keep a high-water mark that sat at capacity there
+  if (highwater_ == capacity_ || highwater_ > capacity)
+    highwater_ = capacity;
+  capacity_ = capacity;
+}
+
+void
+I3FrameFifo::SetHighWater(size_t nframes)
+{
+  highwater_ = (nframes == 0 || nframes > capacity_) ? capacity_ : nframes;
+}
+
+void
+I3FrameFifo::Watermark(size_t depth)
+{
+  if (above_)
+    {
+      if (depth <= highwater_ / 2)
+        above_ = false;
+      return;
+    }
+  if (depth < highwater_)
+    return;
+
+  above_ = true;
+  if (crossings_.fetch_add(1, boost::memory_order_relaxed) == 0)
+    log_info("A frame fifo reached its high-water mark of %zu frames "
+             "(capacity %zu)", highwater_, capacity_);
+}
+
+I3FrameFifo::Stats
+I3FrameFifo::GetStats() const
+{
+  Stats stats;
+  stats.pushed = pushed_.load(boost::memory_order_relaxed);
+  stats.stalls = stalls_.load(boost::memory_order_relaxed);
+  stats.highwater = crossings_.load(boost::memory_order_relaxed);
+  stats.peak = peak_.load(boost::memory_order_relaxed);
+  // head first: from another thread, it may move on before tail is read
+  size_t head = head_.load(boost::memory_order_acquire);
+  stats.depth = tail_.load(boost::memory_order_acquire) - head;
+  return stats;
+}
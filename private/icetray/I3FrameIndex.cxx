@@ -0,0 +1,285 @@
+#include <icetray/I3FrameIndex.h>
+
+#include <algorithm>
+#include <fstream>
+#include <streambuf>
+#include <sys/stat.h>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include <icetray/serialization.h>
+#include <icetray/open.h>
+
+using namespace std;
+namespace io = boost::iostreams;
+
+namespace {
+  const uint32_t index_magic = 0x78646933; // "3idx"
+  const uint32_t index_version = 2;
+
+  // Passes reads through to another streambuf, keeping track of how
+  // far into it we are, so that tellg() works on top of a chain of
+  // decompressors that can't seek.
+  class counting_streambuf : public std::streambuf
+  {
+    std::streambuf* src_;
+    uint64_t base_;
+    char buf_[65536];
+
+  public:
+    explicit counting_streambuf(std::streambuf* src) : src_(src), base_(0)
+    {
+      setg(buf_, buf_, buf_);
+    }
+
+    uint64_t tell() const { return base_ + (gptr() - eback()); }
+
+  protected:
+    int_type underflow()
+    {
+      base_ += egptr() - eback();
+      std::streamsize n = src_->sgetn(buf_, sizeof(buf_));
+      if (n <= 0) {
+        setg(buf_, buf_, buf_);
+        return traits_type::eof();
+      }
+      setg(buf_, buf_, buf_ + n);
+      return traits_type::to_int_type(*gptr());
+    }
+
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                     std::ios_base::openmode which)
+    {
+      if (off != 0 || dir != std::ios_base::cur || !(which & std::ios_base::in))
+        return pos_type(off_type(-1));
+      return pos_type(off_type(tell()));
+    }
+  };
+
+  // Size and modification time (in ns since the epoch) of a file, or
+  // zeros if there is no such file.
+  void
+  file_stat(const std::string& filename, uint64_t& size, uint64_t& mtime)
+  {
+    struct stat st;
+    size = mtime = 0;
+    if (stat(filename.c_str(), &st) != 0)
+      return;
+#ifdef __APPLE__
+    const struct timespec& t = st.st_mtimespec;
+#else
+    const struct timespec& t = st.st_mtim;
+#endif
+    size = st.st_size;
+    mtime = uint64_t(t.tv_sec) * 1000000000 + t.tv_nsec;
+  }
+}
+
+const size_t I3FrameIndex::npos;
+
+I3FrameIndex
+I3FrameIndex::Build(const std::string& filename)
+{
+  I3FrameIndex index;
+  file_stat(filename, index.file_size_, index.file_mtime_);
+
+  io::filtering_istream ifs;
+  I3::dataio::open(ifs, filename);
+  counting_streambuf counter(ifs.rdbuf());
+  std::istream is(&counter);
+
+  for (;;)
+    {
+      uint64_t offset = counter.tell();
+      I3Frame frame;
+      if (!frame.load(is) || is.fail())
+        break;
+
+      Entry entry;
+      entry.offset = offset;
+      entry.stop = frame.GetStop();
+      entry.keys = frame.keys();
+      entry.sizes.reserve(entry.keys.size());
+      for (vector<string>::const_iterator k = entry.keys.begin();
+           k != entry.keys.end(); k++)
+        entry.sizes.push_back(frame.size(*k));
+      index.entries_.push_back(entry);
+    }
+  index.Tabulate();
+
+  log_debug("Indexed %zu frames in %s", index.entries_.size(), filename.c_str());
+  return index;
+}
+
+I3FrameIndex
+I3FrameIndex::Open(const std::string& filename)
+{
+  I3FrameIndex index;
+  std::string sidecar = SidecarName(filename);
+  uint64_t size, mtime;
+  file_stat(filename, size, mtime);
+  // a file rewritten since, even to the same size, gets a fresh index
+  if (index.Load(sidecar) && index.file_size_ == size &&
+      index.file_mtime_ == mtime)
+    return index;
+
+  index = Build(filename);
+  try {
+    index.Save(sidecar);
+  } catch (const std::exception& e) {
+    log_info("Could not write frame index '%s': %s", sidecar.c_str(), e.what());
+  }
+  return index;
+}
+
+void
+I3FrameIndex::Save(const std::string& indexfile) const
+{
+  std::ofstream ofs(indexfile.c_str(), std::ios::binary);
+  if (!ofs.is_open())
+    log_fatal("problems opening file '%s' for writing.  Check permissions, paths.",
+              indexfile.c_str());
+
+  icecube::archive::portable_binary_oarchive poa(ofs);
+  poa << make_nvp("magic", index_magic);
+  poa << make_nvp("version", index_version);
+  poa << make_nvp("file_size", file_size_);
+  poa << make_nvp("file_mtime", file_mtime_);
+  uint64_t nentries = entries_.size();
+  poa << make_nvp("size", nentries);
+  for (vector<Entry>::const_iterator e = entries_.begin(); e != entries_.end(); e++)
+    {
+      poa << make_nvp("offset", e->offset);
+      poa << make_nvp("stream", e->stop);
+      uint32_t nkeys = e->keys.size();
+      poa << make_nvp("nkeys", nkeys);
+      for (uint32_t i = 0; i < nkeys; i++)
+        {
+          poa << make_nvp("key", e->keys[i]);
+          poa << make_nvp("size", e->sizes[i]);
+        }
+    }
+  ofs.flush();
+  if (!ofs.good())
+    log_fatal("error writing frame index '%s'", indexfile.c_str());
+}
+
+bool
+I3FrameIndex::Load(const std::string& indexfile)
+{
+  std::ifstream ifs(indexfile.c_str(), std::ios::binary);
+  if (!ifs.is_open())
+    return false;
+
+  I3FrameIndex index;
+  try {
+    icecube::archive::portable_binary_iarchive pia(ifs);
+    uint32_t magic, version;
+    pia >> make_nvp("magic", magic);
+    if (!ifs.good() || magic != index_magic)
+      return false;
+    pia >> make_nvp("version", version);
+    if (version != index_version)
+      {
+        log_debug("Ignoring frame index '%s' of version %u", indexfile.c_str(), version);
+        return false;
+      }
+    pia >> make_nvp("file_size", index.file_size_);
+    pia >> make_nvp("file_mtime", index.file_mtime_);
+    uint64_t nentries;
+    pia >> make_nvp("size", nentries);
+    for (uint64_t n = 0; n < nentries && ifs.good(); n++)
+      {
+        Entry entry;
+        pia >> make_nvp("offset", entry.offset);
+        pia >> make_nvp("stream", entry.stop);
+        uint32_t nkeys;
+        pia >> make_nvp("nkeys", nkeys);
+        for (uint32_t i = 0; i < nkeys && ifs.good(); i++)
+          {
+            std::string key;
+            uint32_t size;
+            pia >> make_nvp("key", key);
+            pia >> make_nvp("size", size);
+            entry.keys.push_back(key);
+            entry.sizes.push_back(size);
+          }
+        index.entries_.push_back(entry);
+      }
+  } catch (const std::exception& e) {
+    log_debug("Could not read frame index '%s': %s", indexfile.c_str(), e.what());
+    return false;
+  }
+  if (ifs.fail())
+    return false;
+
+  index.Tabulate();
+  *this = index;
+  return true;
+}
+
+void
+I3FrameIndex::Tabulate()
+{
+  positions_.assign(256, std::vector<size_t>());
+  for (size_t i = 0; i < entries_.size(); i++)
+    positions_[(unsigned char)entries_[i].stop.id()].push_back(i);
+
+  mixed_.clear();
+  for (unsigned s = 0; s < 256; s++)
+    {
+      I3Frame::Stream stop((char)s);
+      if (!positions_[s].empty() && stop != I3Frame::Physics &&
+          stop != I3Frame::TrayInfo)
+        mixed_.push_back(stop);
+    }
+
+  const size_t nmixed = mixed_.size();
+  latest_.assign(entries_.size() * nmixed, npos);
+  for (size_t i = 1; i < entries_.size(); i++)
+    {
+      std::copy(latest_.begin() + (i - 1) * nmixed,
+                latest_.begin() + i * nmixed,
+                latest_.begin() + i * nmixed);
+      for (size_t s = 0; s < nmixed; s++)
+        if (entries_[i - 1].stop == mixed_[s])
+          latest_[i * nmixed + s] = i - 1;
+    }
+}
+
+size_t
+I3FrameIndex::Find(I3Frame::Stream stop, size_t n) const
+{
+  if (positions_.empty())
+    return npos;
+  const std::vector<size_t>& positions = positions_[(unsigned char)stop.id()];
+  return n < positions.size() ? positions[n] : npos;
+}
+
+size_t
+I3FrameIndex::Next(size_t after, I3Frame::Stream stop) const
+{
+  if (positions_.empty())
+    return npos;
+  const std::vector<size_t>& positions = positions_[(unsigned char)stop.id()];
+  std::vector<size_t>::const_iterator next = after == npos ? positions.begin() :
+    std::upper_bound(positions.begin(), positions.end(), after);
+  return next == positions.end() ? npos : *next;
+}
+
+std::vector<size_t>
+I3FrameIndex::Dependencies(size_t n) const
+{
+  std::vector<size_t> deps;
+  if (n >= entries_.size())
+    return deps;
+
+  const size_t nmixed = mixed_.size();
+  for (size_t s = 0; s < nmixed; s++)
+    {
+      size_t latest = latest_[n * nmixed + s];
+      if (latest != npos && mixed_[s] != entries_[n].stop)
+        deps.push_back(latest);
+    }
+  std::sort(deps.begin(), deps.end());
+  return deps;
+}
@@ -0,0 +1,132 @@
+#include <icetray/I3FrameKey.h>
+
+#include <boost/atomic.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace {
+  struct entry
+  {
+    entry(size_t h, const std::string& n) : hash(h), name(n) { }
+    const size_t hash;
+    const std::string name;
+  };
+
+  // Open addressing over pointers to entries, which are never freed or
+  // moved.  A full level is copied into one twice its size, and the
+  // old one is kept: readers may still be probing it.
+  struct level
+  {
+    explicit level(size_t size)
+      : mask(size - 1), used(0), slots(new boost::atomic<const entry*>[size])
+    {
+      for (size_t i = 0; i < size; i++)
+        slots[i].store(0, boost::memory_order_relaxed);
+    }
+    const size_t mask;
+    size_t used;
+    boost::atomic<const entry*>* const slots;
+  };
+
+  // Readers only load atomics: the level (acquire), then slots
+  // (acquire), which writers publish with release stores once the
+  // entry or level behind them is complete.  Writers hold mtx.
+  struct intern_table
+  {
+    intern_table() : current(new level(1024)) { }
+    boost::mutex mtx;
+    boost::atomic<level*> current;
+  };
+
+  intern_table&
+  table()
+  {
+    // never destroyed: frames torn down at exit may still hold keys
+    static intern_table* t = new intern_table;
+    return *t;
+  }
+
+  size_t
+  hash_name(const std::string& name)
+  {
+    return boost::hash<std::string>()(name);
+  }
+
+  const entry*
+  lookup(const level& l, size_t h, const std::string& name)
+  {
+    for (size_t i = h & l.mask; ; i = (i + 1) & l.mask)
+      {
+        const entry* e = l.slots[i].load(boost::memory_order_acquire);
+        if (!e)
+          return 0;
+        if (e->hash == h && e->name == name)
+          return e;
+      }
+  }
+
+  void
+  place(level& l, const entry* e)
+  {
+    size_t i = e->hash & l.mask;
+    while (l.slots[i].load(boost::memory_order_relaxed))
+      i = (i + 1) & l.mask;
+    l.slots[i].store(e, boost::memory_order_release);
+    l.used++;
+  }
+
+  const entry*
+  find(const std::string& name, size_t h)
+  {
+    return lookup(*table().current.load(boost::memory_order_acquire), h, name);
+  }
+
+  const entry*
+  intern(const std::string& name, size_t h)
+  {
+    intern_table& t = table();
+    boost::lock_guard<boost::mutex> lock(t.mtx);
+    level* l = t.current.load(boost::memory_order_relaxed);
+    if (const entry* e = lookup(*l, h, name))
+      return e;
+    // keep probes short: at most half full
+    if (2 * (l->used + 1) > l->mask + 1)
+      {
+        level* bigger = new level(2 * (l->mask + 1));
+        for (size_t i = 0; i <= l->mask; i++)
+          if (const entry* e = l->slots[i].load(boost::memory_order_relaxed))
+            place(*bigger, e);
+        t.current.store(bigger, boost::memory_order_release);
+        l = bigger;
+      }
+    const entry* e = new entry(h, name);
+    place(*l, e);
+    return e;
+  }
+}
+
+I3FrameKey::I3FrameKey(const std::string& name)
+{
+  size_t h = hash_name(name);
+  const entry* e = find(name, h);
+  if (!e)
+    e = intern(name, h);
+  name_ = &e->name;
+}
+
+bool
+I3FrameKey::Find(const std::string& name, I3FrameKey& key)
+{
+  const entry* e = find(name, hash_name(name));
+  if (!e)
+    return false;
+  key.name_ = &e->name;
+  return true;
+}
+
+const std::string&
+I3FrameKey::str() const
+{
+  static const std::string empty;
+  return name_ ? *name_ : empty;
+}
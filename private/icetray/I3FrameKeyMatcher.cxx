@@ -0,0 +1,149 @@
+#include <icetray/I3FrameKeyMatcher.h>
+
+#include <cctype>
+#include <cstring>
+#include <unordered_set>
+#include <boost/make_shared.hpp>
+#include <boost/regex.hpp>
+
+namespace {
+  // If pattern contains no regex syntax, store the string it matches in
+  // literal and return true.  Backslash-escaped punctuation counts as
+  // literal; escapes such as \d do not.
+  bool
+  parse_literal(const std::string& pattern, std::string& literal)
+  {
+    static const char* const meta = ".[]{}()*+?|^$";
+    literal.clear();
+    literal.reserve(pattern.size());
+    for (std::string::size_type i = 0; i < pattern.size(); i++)
+      {
+        char c = pattern[i];
+        if (c == '\\')
+          {
+            if (++i == pattern.size() ||
+                std::isalnum(static_cast<unsigned char>(pattern[i])))
+              return false;
+            literal += pattern[i];
+          }
+        else if (std::strchr(meta, c))
+          return false;
+        else
+          literal += c;
+      }
+    return true;
+  }
+}
+
+struct I3FrameKeyMatcher::impl
+{
+  struct node
+  {
+    node() : terminal(false) { }
+    std::vector<std::pair<char, unsigned> > next;
+    bool terminal;
+  };
+
+  std::vector<std::string> patterns;
+  std::unordered_set<std::string> exact;
+  std::vector<node> trie;
+  bool has_regex;
+  boost::regex combined;
+
+  impl() : trie(1), has_regex(false) { }
+
+  void add_prefix(const std::string& prefix)
+  {
+    unsigned n = 0;
+    for (std::string::const_iterator c = prefix.begin(); c != prefix.end(); c++)
+      {
+        unsigned child = 0;
+        for (unsigned i = 0; !child && i < trie[n].next.size(); i++)
+          if (trie[n].next[i].first == *c)
+            child = trie[n].next[i].second;
+        if (!child)
+          {
+            child = trie.size();
+            trie[n].next.push_back(std::make_pair(*c, child));
+            trie.push_back(node());
+          }
+        n = child;
+      }
+    trie[n].terminal = true;
+  }
+
+  bool match_prefix(const std::string& key) const
+  {
+    unsigned n = 0;
+    for (std::string::const_iterator c = key.begin(); ; c++)
+      {
+        if (trie[n].terminal)
+          return true;
+        if (c == key.end())
+          return false;
+        unsigned child = 0;
+        for (unsigned i = 0; !child && i < trie[n].next.size(); i++)
+          if (trie[n].next[i].first == *c)
+            child = trie[n].next[i].second;
+        if (!child)
+          return false;
+        n = child;
+      }
+  }
+};
+
+I3FrameKeyMatcher::I3FrameKeyMatcher() { }
+
+I3FrameKeyMatcher::I3FrameKeyMatcher(const std::vector<std::string>& patterns)
+{
+  if (patterns.empty())
+    return;
+
+  boost::shared_ptr<impl> m = boost::make_shared<impl>();
+  m->patterns = patterns;
+
+  std::string alternatives, literal;
+  for (std::vector<std::string>::const_iterator p = patterns.begin();
+       p != patterns.end(); p++)
+    {
+      const std::string& pattern = *p;
+      if (parse_literal(pattern, literal))
+        m->exact.insert(literal);
+      else if (pattern.size() >= 2 &&
+               pattern.compare(pattern.size() - 2, 2, ".*") == 0 &&
+               parse_literal(pattern.substr(0, pattern.size() - 2), literal))
+        m->add_prefix(literal);
+      else
+        {
+          if (!alternatives.empty())
+            alternatives += '|';
+          alternatives += "(?:" + pattern + ")";
+        }
+    }
+
+  if (!alternatives.empty())
+    {
+      m->combined.assign(alternatives, boost::regex::perl | boost::regex::optimize);
+      m->has_regex = true;
+    }
+
+  impl_ = m;
+}
+
+bool
+I3FrameKeyMatcher::operator()(const std::string& key) const
+{
+  if (!impl_)
+    return false;
+  if (!impl_->exact.empty() && impl_->exact.count(key))
+    return true;
+  if (impl_->match_prefix(key))
+    return true;
+  return impl_->has_regex && boost::regex_match(key, impl_->combined);
+}
+
+std::vector<std::string>
+I3FrameKeyMatcher::patterns() const
+{
+  return impl_ ? impl_->patterns : std::vector<std::string>();
+}
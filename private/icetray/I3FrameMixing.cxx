@@ -22,22 +22,21 @@ I3FrameMixer::UpdateDependenciesImpl(const I3Frame& frame)
       stop != I3Frame::Physics){
     //if this frame type is not in the cache, put it there
     if(sit==parent_cache_.end()){
-      parent_cache_.push_back(boost::make_shared<I3Frame>(frame));
+      parent_cache_.push_back(Snapshot(frame));
       //update the pointer to this cache entry
       sit=parent_cache_.end()-1;
     }
     //if this type is in the cache and we are tracking the order, reshuffle to
     //move it to the end
     else if(track_order_){
-      boost::shared_ptr<I3Frame> old_entry=*sit;
       std::copy(sit+1,parent_cache_.end(),sit);
-      parent_cache_.back()=old_entry;
-      *parent_cache_.back()=frame;
+      parent_cache_.back()=Snapshot(frame);
       //update the pointer to this cache entry
       sit=parent_cache_.end()-1;
     }
-    else //otherwise update the cache entry in place
-      **sit=frame;
+    else //otherwise replace the cache entry; frames mixed from the old one
+         //still overlay it, so it must not change
+      *sit=Snapshot(frame);
   }
   return(sit);
 }
@@ -58,19 +57,75 @@ void I3FrameMixer::Mix(I3Frame& frame)
               "disable_mixing is intended to indicate that the Mixer instance "
               "will only be used for dependency tracking via UpdateDependencies() "
               "and never for actual mixing.");
+  //frames pass through every module of a tray; usually the last one to
+  //push this frame has mixed it exactly as we would
+  if(IsMixed(frame))
+    return;
   frame.purge();
   //while the frame contains only its native keys, see if we should put it in
   //the cache
   auto sit = UpdateDependenciesImpl(frame);
 
-  //copy keys from all other frame types in the cache into this frame
+  //overlay all other frame types in the cache on this frame, rather than
+  //copying their keys in
   for(std::vector<boost::shared_ptr<I3Frame> >::iterator it=parent_cache_.begin(),
       end=parent_cache_.end(); it!=end; it++){
     if(it!=sit) //skip the cache entry of the same type
-      frame.merge(**it);
+      frame.overlay(*it);
   }
 }
 
+bool
+I3FrameMixer::IsMixed(const I3Frame& frame) const
+{
+  if(!frame.pure_)
+    return(false);
+  I3Frame::Stream stop=frame.GetStop();
+  std::vector<boost::shared_ptr<I3Frame> >::const_iterator sit =
+  std::find_if(parent_cache_.begin(),parent_cache_.end(),sameStop(stop));
+  if (stop != I3Frame::TrayInfo &&
+      stop != I3Frame::Physics){
+    //the cache entry must be this very frame, unmodified since
+    if(sit==parent_cache_.end() || (*sit)->map_!=frame.map_)
+      return(false);
+    if(track_order_ && sit!=parent_cache_.end()-1)
+      return(false);
+  }
+  //compare with what the overlays in Mix() would produce
+  std::vector<boost::shared_ptr<const I3Frame> >::const_iterator
+    pit=frame.parents_.begin(), pend=frame.parents_.end();
+  for(std::vector<boost::shared_ptr<I3Frame> >::const_iterator it=parent_cache_.begin(),
+      end=parent_cache_.end(); it!=end; it++){
+    if(it==sit || (*it)->map_->empty())
+      continue;
+    if(pit==pend || *pit!=*it)
+      return(false);
+    pit++;
+  }
+  return(pit==pend);
+}
+
+boost::shared_ptr<I3Frame>
+I3FrameMixer::Snapshot(const I3Frame& frame)
+{
+  if(!snapshots_)
+    return(boost::make_shared<I3Frame>(frame));
+  std::vector<boost::shared_ptr<I3Frame> >& latest=snapshots_->latest_;
+  std::vector<boost::shared_ptr<I3Frame> >::iterator lit =
+  std::find_if(latest.begin(),latest.end(),sameStop(frame.GetStop()));
+  //frames share a table only until one of them changes it, so this
+  //is still an exact copy
+  if(lit!=latest.end() && (*lit)->map_==frame.map_ &&
+     (*lit)->parents_==frame.parents_)
+    return(*lit);
+  boost::shared_ptr<I3Frame> snapshot=boost::make_shared<I3Frame>(frame);
+  if(lit==latest.end())
+    latest.push_back(snapshot);
+  else
+    *lit=snapshot;
+  return(snapshot);
+}
+
 std::vector<boost::shared_ptr<I3Frame> >
 I3FrameMixer::GetMixedFrames(I3Frame::Stream stop)
 {
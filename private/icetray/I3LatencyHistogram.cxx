@@ -0,0 +1,46 @@
+#include <icetray/I3LatencyHistogram.h>
+
+#include <algorithm>
+
+void
+I3LatencyHistogram::Merge(const I3LatencyHistogram& other)
+{
+  for (unsigned i = 0; i < NBins; i++)
+    bins_[i] += other.bins_[i];
+  count_ += other.count_;
+  max_ = std::max(max_, other.max_);
+}
+
+void
+I3LatencyHistogram::Clear()
+{
+  std::fill(bins_, bins_ + NBins, 0);
+  count_ = max_ = 0;
+}
+
+double
+I3LatencyHistogram::GetQuantile(double q) const
+{
+  if (count_ == 0)
+    return 0;
+  boost::uint64_t rank = boost::uint64_t(q * count_);
+  if (rank >= count_)
+    rank = count_ - 1;
+
+  boost::uint64_t seen = 0;
+  unsigned i = 0;
+  for (; i < NBins; i++)
+    if ((seen += bins_[i]) > rank)
+      break;
+
+  double low, high;
+  if (i < 4)
+    low = high = i;
+  else
+    {
+      unsigned e = i / 4 + 1, sub = i % 4;
+      low = double(boost::uint64_t(4 + sub) << (e - 2));
+      high = double(boost::uint64_t(5 + sub) << (e - 2));
+    }
+  return std::min((low + high) / 2, double(max_)) * 1e-9;
+}
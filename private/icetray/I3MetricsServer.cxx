@@ -0,0 +1,180 @@
+#include "I3MetricsServer.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace {
+  // how long a request waits for the tray to make a fresh snapshot
+  const long fresh_ms = 1000;
+
+  void
+  write_all(int fd, const std::string& data)
+  {
+    const char* p = data.data();
+    size_t left = data.size();
+    while (left > 0)
+      {
+        ssize_t n = send(fd, p, left, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0)
+          return;
+        p += n;
+        left -= n;
+      }
+  }
+}
+
+I3MetricsServer::I3MetricsServer(const std::string& address)
+  : listen_fd_(-1), stopping_(false), wanted_(false), generation_(0)
+{
+  if (address.compare(0, 5, "unix:") == 0)
+    {
+      path_ = address.substr(5);
+      struct sockaddr_un sa;
+      memset(&sa, 0, sizeof(sa));
+      sa.sun_family = AF_UNIX;
+      if (path_.empty() || path_.size() >= sizeof(sa.sun_path))
+        log_fatal("Bad metrics socket path \"%s\"", path_.c_str());
+      strcpy(sa.sun_path, path_.c_str());
+      unlink(path_.c_str());
+      listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (listen_fd_ < 0 ||
+          bind(listen_fd_, (struct sockaddr*)&sa, sizeof(sa)) != 0)
+        log_fatal("Could not bind metrics socket \"%s\": %s", path_.c_str(),
+                  strerror(errno));
+    }
+  else
+    {
+      std::string port = address;
+      if (port.compare(0, 10, "localhost:") == 0)
+        port = port.substr(10);
+      unsigned short number = 0;
+      try {
+        number = boost::lexical_cast<unsigned short>(port);
+      } catch (const boost::bad_lexical_cast&) {
+        log_fatal("Bad metrics address \"%s\"; expected \"unix:PATH\" or "
+                  "\"localhost:PORT\"", address.c_str());
+      }
+      struct sockaddr_in sa;
+      memset(&sa, 0, sizeof(sa));
+      sa.sin_family = AF_INET;
+      sa.sin_port = htons(number);
+      // never beyond this machine
+      sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+      int yes = 1;
+      if (listen_fd_ >= 0)
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+      if (listen_fd_ < 0 ||
+          bind(listen_fd_, (struct sockaddr*)&sa, sizeof(sa)) != 0)
+        log_fatal("Could not bind metrics port %u: %s", unsigned(number),
+                  strerror(errno));
+    }
+
+  fcntl(listen_fd_, F_SETFD, FD_CLOEXEC);
+  if (listen(listen_fd_, 8) != 0)
+    log_fatal("Could not listen for metrics requests: %s", strerror(errno));
+  thread_ = boost::thread(boost::bind(&I3MetricsServer::Run, this));
+  log_info("Serving metrics on %s", address.c_str());
+}
+
+I3MetricsServer::~I3MetricsServer()
+{
+  stopping_.store(true);
+  {
+    boost::mutex::scoped_lock lock(mtx_);
+    published_.notify_all();
+  }
+  thread_.join();
+  close(listen_fd_);
+  if (!path_.empty())
+    unlink(path_.c_str());
+}
+
+void
+I3MetricsServer::Publish(const std::string& snapshot)
+{
+  boost::mutex::scoped_lock lock(mtx_);
+  snapshot_ = snapshot;
+  generation_++;
+  wanted_.store(false, boost::memory_order_relaxed);
+  published_.notify_all();
+}
+
+void
+I3MetricsServer::Run()
+{
+  while (!stopping_.load())
+    {
+      struct pollfd pfd;
+      pfd.fd = listen_fd_;
+      pfd.events = POLLIN;
+      if (poll(&pfd, 1, 200) <= 0)
+        continue;
+      int fd = accept(listen_fd_, 0, 0);
+      if (fd < 0)
+        continue;
+      Answer(fd);
+      close(fd);
+    }
+}
+
+void
+I3MetricsServer::Answer(int fd)
+{
+  // the request itself doesn't matter; read what the client sent, up
+  // to the end of its headers
+  std::string request;
+  char buf[1024];
+  while (request.find("\r\n\r\n") == std::string::npos &&
+         request.find("\n\n") == std::string::npos && request.size() < 8192)
+    {
+      struct pollfd pfd;
+      pfd.fd = fd;
+      pfd.events = POLLIN;
+      if (poll(&pfd, 1, fresh_ms) <= 0)
+        break;
+      ssize_t n = recv(fd, buf, sizeof(buf), 0);
+      if (n <= 0)
+        break;
+      request.append(buf, n);
+    }
+
+  std::string body;
+  {
+    boost::mutex::scoped_lock lock(mtx_);
+    boost::uint64_t seen = generation_;
+    wanted_.store(true, boost::memory_order_relaxed);
+    boost::system_time until = boost::get_system_time() +
+      boost::posix_time::milliseconds(fresh_ms);
+    while (generation_ == seen && !stopping_.load())
+      if (!published_.timed_wait(lock, until))
+        break;
+    body = snapshot_;
+  }
+
+  std::ostringstream response;
+  response << "HTTP/1.0 200 OK\r\n"
+           << "Content-Type: text/plain; version=0.0.4\r\n"
+           << "Content-Length: " << body.size() << "\r\n"
+           << "Connection: close\r\n\r\n"
+           << body;
+  write_all(fd, response.str());
+}
@@ -0,0 +1,55 @@
+#ifndef ICETRAY_I3METRICSSERVER_H_INCLUDED
+#define ICETRAY_I3METRICSSERVER_H_INCLUDED
+
+#include <string>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <icetray/I3Logging.h>
+
+/**
+ * Answers HTTP requests on a Unix socket or a localhost port with the
+ * latest snapshot of a running tray's metrics, in the Prometheus text
+ * format (see I3Tray::SetMetricsAddress()).
+ *
+ * The snapshot is made on the tray's thread: a request raises
+ * Wanted(), which I3Tray checks between calls to the driving module,
+ * and waits up to a second for Publish().  If the tray doesn't come
+ * round in time, e.g. while it finishes, the last snapshot is served.
+ */
+class I3MetricsServer
+{
+ public:
+  /// @a address is "unix:PATH" or "[localhost:]PORT".
+  explicit I3MetricsServer(const std::string& address);
+  ~I3MetricsServer();
+
+  bool Wanted() const { return wanted_.load(boost::memory_order_relaxed); }
+  void Publish(const std::string& snapshot);
+
+  SET_LOGGER("I3MetricsServer");
+
+ private:
+  I3MetricsServer(const I3MetricsServer&);
+  I3MetricsServer& operator=(const I3MetricsServer&);
+
+  void Run();
+  void Answer(int fd);
+
+  int listen_fd_;
+  /// the socket file to remove, for Unix sockets
+  std::string path_;
+
+  boost::atomic<bool> stopping_, wanted_;
+  boost::mutex mtx_;
+  boost::condition_variable published_;
+  std::string snapshot_;
+  boost::uint64_t generation_;
+
+  boost::thread thread_;
+};
+
+#endif
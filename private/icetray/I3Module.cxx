@@ -23,13 +23,15 @@
 #include "icetray/I3Module.h"
 
 #include <sys/time.h>
-#include <sys/resource.h>
+#include <time.h>
 
+#include <algorithm>
 #include <boost/bind.hpp>
 #include <boost/preprocessor.hpp>
 #include <boost/foreach.hpp>
 #include <boost/python.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include "icetray/I3TrayInfo.h"
 #include "icetray/I3Context.h"
@@ -38,41 +40,94 @@
 #include "icetray/IcetrayFwd.h"
 #include "icetray/I3Frame.h"
 #include "icetray/I3FrameMixing.h"
+#include "icetray/I3Tracer.h"
 #include "icetray/impl.h"
 #include "icetray/memory.h"
 
 const double I3Module::min_report_time_ = 10;
 
+namespace {
+  // Timers of laned modules can run on several threads at once, and
+  // those of laned and staged ones off the thread that reads them
+  boost::mutex timer_mtx;
+}
+
+namespace {
+  boost::uint64_t
+  clock_ns(clockid_t clock)
+  {
+    struct timespec ts;
+    if (clock_gettime(clock, &ts) != 0)
+      return 0;
+    return boost::uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+  }
+}
+
+// CPU time of the calling thread only, as physics workers may be busy
+// elsewhere; one clock read on either side, and no rusage to fill in
 class ModuleTimer
 {
-  double& sys;
   double& user;
-  struct rusage stop, start;
-   bool fail;
+  unsigned& ncall;
+  unsigned count_;
+  bool shared_;
+  boost::uint64_t start;
  public:
-   ModuleTimer(double& s, double& u) : sys(s), user(u)
-  {
-    fail = (getrusage(RUSAGE_SELF, &start) == -1);
-  }
+  /// @a shared: lock, as the module may be timed on several threads
+  ModuleTimer(double& u, unsigned& n, bool shared, unsigned count = 1)
+    : user(u), ncall(n), count_(count), shared_(shared),
+      start(clock_ns(CLOCK_THREAD_CPUTIME_ID))
+  { }
   ~ModuleTimer()
   {
-    if (getrusage(RUSAGE_SELF, &stop) != -1 && !fail)
-      {
-	user += (stop.ru_utime.tv_sec - start.ru_utime.tv_sec);
-	user += double(stop.ru_utime.tv_usec - start.ru_utime.tv_usec) / 1E+06;
+    boost::uint64_t stop = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    boost::unique_lock<boost::mutex> lock(timer_mtx, boost::defer_lock);
+    if (shared_)
+      lock.lock();
+    ncall += count_;
+    if (stop > start)
+      user += double(stop - start) * 1e-9;
+  }
+};
 
-	sys += (stop.ru_stime.tv_sec - start.ru_stime.tv_sec);
-	sys += double(stop.ru_stime.tv_usec - start.ru_stime.tv_usec) / 1E+06;
-      }
+// wall-clock time of a Process_() call, by the stream of its frame
+class I3Module::ProcessTimer
+{
+  I3Module& module_;
+  unsigned char stream_;
+  boost::uint64_t start_;
+ public:
+  ProcessTimer(I3Module& module, const I3Frame::Stream& stream)
+    : module_(module), stream_(stream.id()), start_(clock_ns(CLOCK_MONOTONIC))
+  { }
+  ~ProcessTimer()
+  {
+    boost::uint64_t elapsed = clock_ns(CLOCK_MONOTONIC) - start_;
+    // only laned modules can be in Process_() on two threads at once,
+    // and only they and staged ones are timed off the tray's thread
+    boost::unique_lock<boost::mutex> lock(timer_mtx, boost::defer_lock);
+    if (module_.laned_ || module_.staged_)
+      lock.lock();
+    module_.latency_.Add(elapsed);
+    module_.streamcalls_[stream_]++;
+    module_.streamtime_[stream_] += elapsed;
   }
 };
 
+boost::thread_specific_ptr<I3Module::Lane> I3Module::lane_(&I3Module::LeaveLane);
+
 I3Module::I3Module(const I3Context& context)
-  : context_(context), inbox_()
+  : context_(context), inbox_(), concurrency_(Serial), batch_size_(1),
+    laned_(false), staged_(false)
 {
   nphyscall_ = ndaqcall_ = 0;
-  sysphystime_ = userphystime_ = 0;
-  sysdaqtime_ = userdaqtime_ = 0;
+  userphystime_ = userdaqtime_ = 0;
+  std::fill(streamcalls_, streamcalls_ + 256, 0);
+  std::fill(streamtime_, streamtime_ + 256, 0);
+  for (unsigned s = 0; s < 256; s++)
+    pushed_[s].store(0, boost::memory_order_relaxed);
+  should_do_ = CheckAll;
+  CompileDispatch();
   i3_log("%s done", __PRETTY_FUNCTION__);
 }
 
@@ -80,17 +135,18 @@ I3Module::~I3Module()
 {
   // only print if more than 10 seconds used.  This is kind of an
   // arbitrary number.
-  if (userphystime_ + sysphystime_ > min_report_time_)
-    log_info("%40s: %6u calls to physics %9.2fs user %9.2fs system",
-	   GetName().c_str(), nphyscall_, userphystime_, sysphystime_);
-  if (userdaqtime_ + sysdaqtime_ > min_report_time_)
-    log_info("%40s: %6u calls to DAQ %9.2fs user %9.2fs system",
-	   GetName().c_str(), ndaqcall_, userdaqtime_, sysdaqtime_);
+  if (userphystime_ > min_report_time_)
+    log_info("%40s: %6u calls to physics %9.2fs user",
+	   GetName().c_str(), nphyscall_, userphystime_);
+  if (userdaqtime_ > min_report_time_)
+    log_info("%40s: %6u calls to DAQ %9.2fs user",
+	   GetName().c_str(), ndaqcall_, userdaqtime_);
 }
 
 void
 I3Module::Flush()
 {
+  ReleaseAhead();
   for (outboxmap_t::iterator iter = outboxes_.begin();
        iter != outboxes_.end();
        iter++)
@@ -109,17 +165,33 @@ I3Module::Flush()
 }
 
 void
-I3Module::Do(void (I3Module::*f)())
+I3Module::Call(void (I3Module::*f)())
 {
 #ifdef MEMORY_TRACKING
   memory::set_label(GetName());
 #endif
   try {
-    (this->*f)();
+    if (f == &I3Module::Finish)
+      {
+        I3TraceScope trace("finish", name_);
+        // nothing more will come to overlap with: let the held frame
+        // go, and whatever Finish() pushes straight through
+        ReleaseAhead();
+        prefetch_pool_.reset();
+        (this->*f)();
+      }
+    else
+      (this->*f)();
   } catch (...) {
     log_error("%s: Exception thrown", GetName().c_str());
     throw;
   }
+}
+
+void
+I3Module::Do(void (I3Module::*f)())
+{
+  Call(f);
 
   for (outboxmap_t::iterator iter = outboxes_.begin();
        iter != outboxes_.end();
@@ -161,12 +233,53 @@ I3Module::Configure_()
   // then add one for them.
   if(outboxes_.empty())
     AddOutBox("OutBox");
+  CompileDispatch();
 }
 
 void
 I3Module::Register(const I3Frame::Stream& when, boost::function<void(I3FramePtr)> what)
 {
   methods_[when] = what;
+  // may come after Configure_(), e.g. from Python
+  registered_[(unsigned char)when.id()] = what;
+  dispatch_[(unsigned char)when.id()] = &I3Module::DispatchRegistered;
+}
+
+void
+I3Module::CompileDispatch()
+{
+  otherstops_ = (should_do_ & CheckOtherStops) ?
+    &I3Module::DispatchOtherStops : &I3Module::OtherStops;
+  std::fill(dispatch_, dispatch_ + 256, otherstops_);
+
+  struct {
+    I3Frame::Stream stream;
+    unsigned check;
+    handler_t checked, unchecked;
+  } builtins[] = {
+    { I3Frame::Physics, CheckPhysics,
+      &I3Module::DispatchPhysics, &I3Module::RunPhysics },
+    { I3Frame::DAQ, CheckDAQ, &I3Module::DispatchDAQ, &I3Module::RunDAQ },
+    { I3Frame::Geometry, CheckGeometry,
+      &I3Module::DispatchGeometry, &I3Module::Geometry },
+    { I3Frame::Calibration, CheckCalibration,
+      &I3Module::DispatchCalibration, &I3Module::Calibration },
+    { I3Frame::DetectorStatus, CheckDetectorStatus,
+      &I3Module::DispatchDetectorStatus, &I3Module::DetectorStatus },
+    { I3Frame::Simulation, CheckSimulation,
+      &I3Module::DispatchSimulation, &I3Module::Simulation },
+  };
+  for (size_t i = 0; i < sizeof(builtins)/sizeof(builtins[0]); i++)
+    dispatch_[(unsigned char)builtins[i].stream.id()] =
+      (should_do_ & builtins[i].check) ?
+      builtins[i].checked : builtins[i].unchecked;
+
+  for (methods_t::const_iterator iter = methods_.begin();
+       iter != methods_.end(); iter++)
+    {
+      registered_[(unsigned char)iter->first.id()] = iter->second;
+      dispatch_[(unsigned char)iter->first.id()] = &I3Module::DispatchRegistered;
+    }
 }
 
 void
@@ -178,6 +291,11 @@ I3Module::Process_()
     log_trace("%s: %zu frames in inbox", GetName().c_str(), inbox_->size());
 
   I3FramePtr frame = PeekFrame();
+  const I3Frame::Stream stop = frame ? frame->GetStop() : I3Frame::None;
+  ProcessTimer timer(*this, stop);
+  // the stop, and how many frames on it came before
+  I3TraceScope trace("module", name_, stop.id(),
+                     streamcalls_[(unsigned char)stop.id()]);
 
   log_trace("frame=%p", frame.get());
   if (!frame)
@@ -209,36 +327,138 @@ I3Module::Process()
   if (!frame)
     return;
 
-  methods_t::iterator miter = methods_.find(frame->GetStop());
+  (this->*dispatch_[(unsigned char)frame->GetStop().id()])(frame);
+}
+
+void
+I3Module::DispatchPhysics(I3FramePtr frame)
+{
+  if (ShouldDoPhysics(frame))
+    RunPhysics(frame);
+  else
+    (this->*otherstops_)(frame);
+}
 
-  if (miter != methods_.end())
+void
+I3Module::RunPhysics(I3FramePtr frame)
+{
+  if (batch_size_ > 1 && !(laned_ && lane_.get()))
     {
-      miter->second(frame);
+      ProcessPhysicsBatch(frame);
       return;
     }
+  ModuleTimer mt(userphystime_, nphyscall_, laned_ || staged_);
+  Physics(frame);
+}
 
-  if(frame->GetStop() == I3Frame::Physics && ShouldDoPhysics(frame))
-    {
-      ModuleTimer mt(sysphystime_, userphystime_);
-      ++nphyscall_;
-      Physics(frame);
-    }
-  else if(frame->GetStop() == I3Frame::Geometry && ShouldDoGeometry(frame))
+void
+I3Module::DispatchDAQ(I3FramePtr frame)
+{
+  if (ShouldDoDAQ(frame))
+    RunDAQ(frame);
+  else
+    (this->*otherstops_)(frame);
+}
+
+void
+I3Module::RunDAQ(I3FramePtr frame)
+{
+  ModuleTimer mt(userdaqtime_, ndaqcall_, laned_ || staged_);
+  DAQ(frame);
+}
+
+void
+I3Module::DispatchGeometry(I3FramePtr frame)
+{
+  if (ShouldDoGeometry(frame))
     Geometry(frame);
-  else if(frame->GetStop() == I3Frame::Calibration && ShouldDoCalibration(frame))
+  else
+    (this->*otherstops_)(frame);
+}
+
+void
+I3Module::DispatchCalibration(I3FramePtr frame)
+{
+  if (ShouldDoCalibration(frame))
     Calibration(frame);
-  else if(frame->GetStop() == I3Frame::DetectorStatus && ShouldDoDetectorStatus(frame))
+  else
+    (this->*otherstops_)(frame);
+}
+
+void
+I3Module::DispatchDetectorStatus(I3FramePtr frame)
+{
+  if (ShouldDoDetectorStatus(frame))
     DetectorStatus(frame);
-  else if(frame->GetStop() == I3Frame::Simulation && ShouldDoSimulation(frame))
+  else
+    (this->*otherstops_)(frame);
+}
+
+void
+I3Module::DispatchSimulation(I3FramePtr frame)
+{
+  if (ShouldDoSimulation(frame))
     Simulation(frame);
-  else if(frame->GetStop() == I3Frame::DAQ && ShouldDoDAQ(frame)) {
-    ModuleTimer mt(sysdaqtime_, userdaqtime_);
-    ++ndaqcall_;
-    DAQ(frame);
-  } else if(ShouldDoOtherStops(frame))
+  else
+    (this->*otherstops_)(frame);
+}
+
+void
+I3Module::DispatchOtherStops(I3FramePtr frame)
+{
+  if (ShouldDoOtherStops(frame))
     OtherStops(frame);
 }
 
+void
+I3Module::DispatchRegistered(I3FramePtr frame)
+{
+  registered_[(unsigned char)frame->GetStop().id()](frame);
+}
+
+void
+I3Module::ProcessPhysicsBatch(I3FramePtr frame)
+{
+  // Physics frames don't change what a mixer overlays, so consecutive
+  // ones from one fifo share their parents
+  std::vector<I3FramePtr> frames(1, frame);
+  I3FramePtr next, rejected;
+  bool process = true;
+  while (frames.size() < batch_size_ && (next = PeekFrame()) &&
+	 next->GetStop() == I3Frame::Physics)
+    {
+      PopFrame();
+      if (!(process = ShouldDoProcess(next)) ||
+	  ((should_do_ & CheckPhysics) && !ShouldDoPhysics(next)))
+	{
+	  rejected = next;
+	  break;
+	}
+      frames.push_back(next);
+    }
+
+  {
+    ModuleTimer mt(userphystime_, nphyscall_, laned_ || staged_,
+                   frames.size());
+    PhysicsBatch(frames);
+  }
+
+  // what Process_() and Process() would have done with it, now that
+  // the frames before it are through
+  if (rejected && !process)
+    PushFrame(rejected);
+  else if (rejected)
+    (this->*otherstops_)(rejected);
+}
+
+void
+I3Module::PhysicsBatch(std::vector<I3FramePtr>& frames)
+{
+  for (std::vector<I3FramePtr>::iterator it = frames.begin();
+       it != frames.end(); it++)
+    Physics(*it);
+}
+
 void
 I3Module::AddOutBox(const std::string& s)
 {
@@ -262,22 +482,38 @@ I3Module::AddParameter(const std::string& name, const std::string& description)
 I3FramePtr
 I3Module::PopFrame()
 {
-  if (!inbox_)
-    return I3FramePtr();
-
-  if (inbox_->begin() == inbox_->end())
-    return I3FramePtr();
+  if (laned_ && lane_.get())
+    {
+      if (lane_->inbox.empty())
+	return I3FramePtr();
+      I3FramePtr frame = lane_->inbox.back();
+      lane_->inbox.pop_back();
+      return frame;
+    }
 
-  I3FramePtr frame = inbox_->back();
-  inbox_->pop_back();
+  I3FramePtr frame;
+  if (inbox_)
+    inbox_->pop(frame);
   return frame;
 }
 
+I3FrameSnapshotsPtr
+I3Module::GetSnapshots()
+{
+	// inside a tray, share cache entries with the other modules
+	if (!snapshots_ && context_.Has<I3FrameSnapshotsPtr>("I3FrameSnapshots"))
+		snapshots_ = context_.Get<I3FrameSnapshotsPtr>("I3FrameSnapshots");
+	return snapshots_;
+}
+
 inline void
 I3Module::SyncCache(std::string outbox, I3FramePtr frame)
 {
-	if (cachemap_.find(outbox) == cachemap_.end())
+	if (cachemap_.find(outbox) == cachemap_.end()) {
 		cachemap_[outbox] = boost::make_shared<I3FrameMixer>();
+		if (GetSnapshots())
+			cachemap_[outbox]->ShareSnapshots(snapshots_);
+	}
 
 	boost::shared_ptr<I3FrameMixer> cache_ = cachemap_[outbox];
 	cache_->Mix(*frame);
@@ -294,25 +530,88 @@ I3Module::PushFrame(I3FramePtr frameptr, const std::string& name)
 	      "name \"%s\" which either doesn't exist or isn't connected "
 	      "to anything.  Check steering file.",
 	      GetName().c_str(), name.c_str());
+  pushed_[(unsigned char)frameptr->GetStop().id()].fetch_add(1, boost::memory_order_relaxed);
+
+  if (laned_ && lane_.get())
+    {
+      if (lane_->mixer)
+	lane_->mixer->Mix(*frameptr);
+      lane_->outbox.push_back(frameptr);
+      return;
+    }
 
   SyncCache(name, frameptr);
-  iter->second.first->push_front(frameptr);
+  if (prefetch_pool_)
+    {
+      frameptr->Prefetch(push_prefetch_keys_, *prefetch_pool_);
+      ReleaseAhead();
+      ahead_ = frameptr;
+      ahead_outboxes_.assign(1, iter);
+      log_trace("%s holding frame for fifo \"%s\"", GetName().c_str(), name.c_str());
+      return;
+    }
+  Enqueue(iter, frameptr);
 
   log_trace("%s pushed frame onto fifo \"%s\"", GetName().c_str(), name.c_str());
 }
 
+void
+I3Module::Enqueue(outboxmap_t::iterator iter, const I3FramePtr& frame)
+{
+  I3ModulePtr nextmodule = iter->second.second;
+  // nothing would ever take it off again
+  if (!nextmodule)
+    return;
+
+  // only the next module: what it pushes waits for the scheduler,
+  // unless that fifo is full too
+  while (!iter->second.first->push(frame))
+    nextmodule->Call(&I3Module::Process_);
+}
+
 void
 I3Module::PushFrame(I3FramePtr frameptr)
 {
   // Send to all outboxes
+  if (laned_ && lane_.get())
+    {
+      // I3PhysicsWorkers only runs modules with one outbox
+      PushFrame(frameptr, outboxes_.begin()->first);
+      return;
+    }
+  pushed_[(unsigned char)frameptr->GetStop().id()].fetch_add(1, boost::memory_order_relaxed);
+  if (prefetch_pool_)
+    {
+      frameptr->Prefetch(push_prefetch_keys_, *prefetch_pool_);
+      ReleaseAhead();
+      ahead_outboxes_.clear();
+    }
   for (outboxmap_t::iterator iter = outboxes_.begin();
        iter != outboxes_.end();
        iter++)
     {
       SyncCache(iter->first, frameptr);
-      iter->second.first->push_front(frameptr);
+      if (prefetch_pool_)
+        {
+          ahead_outboxes_.push_back(iter);
+          continue;
+        }
+      Enqueue(iter, frameptr);
       log_trace("%s pushed frame onto fifo \"%s\"", GetName().c_str(), iter->first.c_str());
     }
+  if (prefetch_pool_)
+    ahead_ = frameptr;
+}
+
+void
+I3Module::ReleaseAhead()
+{
+  if (!ahead_)
+    return;
+  I3FramePtr frame;
+  frame.swap(ahead_);
+  for (size_t i = 0; i < ahead_outboxes_.size(); i++)
+    Enqueue(ahead_outboxes_[i], frame);
 }
 
 void
@@ -430,25 +729,52 @@ I3Module::RequestSuspension() const
     log_warn("Suspension was requested, but this module does not seem to belong to a tray to suspend");
 }
 
+void
+I3Module::Prefetch(const std::vector<std::string>& keys)
+{
+  prefetch_keys_.insert(prefetch_keys_.end(), keys.begin(), keys.end());
+}
+
+void
+I3Module::PrefetchOnPush(const std::vector<std::string>& keys, I3ThreadPoolPtr pool)
+{
+  push_prefetch_keys_ = keys;
+  prefetch_pool_ = pool;
+}
+
 
 I3PhysicsUsage
 I3Module::ReportUsage()
 {
   I3PhysicsUsage pu;
-  pu.systime = sysphystime_ + sysdaqtime_;
+  boost::mutex::scoped_lock lock(timer_mtx);
   pu.usertime = userphystime_ + userdaqtime_;
   pu.ncall = nphyscall_ + ndaqcall_;
+
+  pu.p50 = latency_.GetQuantile(0.5);
+  pu.p99 = latency_.GetQuantile(0.99);
+  pu.max = latency_.GetMax();
+  for (unsigned s = 0; s < 256; s++)
+    {
+      if (streamcalls_[s] == 0)
+        continue;
+      I3StreamUsage& su = pu.streams[I3Frame::Stream(char(s)).str()];
+      su.ncall = streamcalls_[s];
+      su.walltime = streamtime_[s] * 1e-9;
+      pu.walltime += su.walltime;
+    }
   return pu;
 }
 
 I3FramePtr
 I3Module::PeekFrame()
 {
+  if (laned_ && lane_.get())
+    return lane_->inbox.empty() ? I3FramePtr() : lane_->inbox.back();
+
   if (!inbox_)
     return I3FramePtr();
-  if (inbox_->begin() == inbox_->end())
-    return I3FramePtr();
-  return inbox_->back();
+  return inbox_->front();
 }
 
 bool
@@ -458,6 +784,42 @@ I3Module::ShouldDoProcess(I3FramePtr frame)
   return true;
 }
 
+std::map<std::string, I3FrameFifo::Stats>
+I3Module::ReportFifos() const
+{
+  std::map<std::string, I3FrameFifo::Stats> stats;
+  for (outboxmap_t::const_iterator iter = outboxes_.begin();
+       iter != outboxes_.end();
+       iter++)
+    stats[iter->first] = iter->second.first->GetStats();
+  return stats;
+}
+
+std::map<std::string, boost::uint64_t>
+I3Module::ReportPushes() const
+{
+  std::map<std::string, boost::uint64_t> pushed;
+  for (unsigned s = 0; s < 256; s++)
+    {
+      boost::uint64_t n = pushed_[s].load(boost::memory_order_relaxed);
+      if (n)
+        pushed[I3Frame::Stream(char(s)).str()] = n;
+    }
+  return pushed;
+}
+
+void
+I3Module::SetFifoLimits(unsigned capacity, unsigned highwater)
+{
+  for (outboxmap_t::iterator iter = outboxes_.begin();
+       iter != outboxes_.end();
+       iter++)
+    {
+      iter->second.first->SetCapacity(capacity);
+      iter->second.first->SetHighWater(highwater);
+    }
+}
+
 void
 I3Module::ConnectOutBox(const std::string& outBoxName, I3ModulePtr targetModule)
 {
@@ -6,6 +6,8 @@ operator<<(std::ostream& os, const I3PhysicsUsage& ru)
 {
   os << "[Physics Usage systime:" << ru.systime 
      << " usertime:" << ru.usertime 
-     << " ncall:" << ru.ncall << "]";
+     << " ncall:" << ru.ncall
+     << " walltime:" << ru.walltime
+     << " p50:" << ru.p50 << " p99:" << ru.p99 << " max:" << ru.max << "]";
   return os;
 }
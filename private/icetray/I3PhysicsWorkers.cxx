@@ -0,0 +1,356 @@
+#include "I3PhysicsWorkers.h"
+#include "I3PipelineStage.h"
+
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/make_shared.hpp>
+
+#include <icetray/I3Factory.h>
+#include <icetray/Singleton.h>
+
+namespace {
+  bool
+  serial_stop(const I3FramePtr& frame)
+  {
+    return frame->GetStop() != I3Frame::DAQ && frame->GetStop() != I3Frame::Physics;
+  }
+}
+
+I3PhysicsWorkers::I3PhysicsWorkers(const I3Context& context,
+                                   const std::vector<I3ModulePtr>& modules,
+                                   I3ThreadPoolPtr pool)
+  : I3Module(context), pool_(pool),
+    // enough to keep every worker busy while the oldest task finishes
+    max_running_(2 * (pool->size() + 1))
+{
+  // those of the stage the modules are in (see I3PipelineStage)
+  snapshots_ = modules.front()->GetSnapshots();
+
+  // one worker per pool thread, and one for the thread waiting on them
+  // (I3ThreadPool::Task::Wait() runs tasks nobody has started yet)
+  chains_.resize(pool->size() + 1);
+  BOOST_FOREACH(I3ModulePtr module, modules)
+    {
+      module->laned_ = true;
+      chains_[0].push_back(module);
+      for (unsigned w = 1; w < chains_.size(); w++)
+        chains_[w].push_back(module->GetConcurrency() == PerWorker ?
+                             Clone(*module) : module);
+
+      mixers_.push_back(boost::make_shared<I3FrameMixer>());
+      if (snapshots_)
+        mixers_.back()->ShareSnapshots(snapshots_);
+    }
+  pending_.resize(modules.size());
+  for (unsigned w = chains_.size(); w > 0; w--)
+    idle_.push_back(w - 1);
+
+  AddOutBox("OutBox");
+}
+
+bool
+I3PhysicsWorkers::CanRun(const I3Module& module)
+{
+  if (module.outboxes_.size() != 1)
+    return false;
+  switch (module.GetConcurrency())
+    {
+    case ThreadSafe:
+      return true;
+    case PerWorker:
+      {
+        const I3ModuleFactory& factory = I3::Singleton<I3ModuleFactory>::get_const_instance();
+        if (factory.find(module.GetConfiguration().ClassName()) != factory.end())
+          return true;
+        log_warn("Module \"%s\" wants an instance per worker, but its class \"%s\" "
+                 "is not in the module factory; running it serially.",
+                 module.GetName().c_str(), module.GetConfiguration().ClassName().c_str());
+        return false;
+      }
+    default:
+      return false;
+    }
+}
+
+unsigned
+I3PhysicsWorkers::Install(I3ModulePtr driver, I3ThreadPoolPtr pool,
+                          const I3Context& context)
+{
+  std::vector<I3ModulePtr> line(1, driver);
+  while (line.back()->outboxes_.size() == 1)
+    {
+      I3ModulePtr next = line.back()->outboxes_.begin()->second.second;
+      if (I3PipelineStage* stage = dynamic_cast<I3PipelineStage*>(line.back().get()))
+        next = stage->GetFirst();
+      if (!next || std::find(line.begin(), line.end(), next) != line.end())
+        break;
+      line.push_back(next);
+    }
+
+  unsigned installed = 0;
+  for (size_t i = 1; i < line.size(); )
+    {
+      if (!CanRun(*line[i]))
+        {
+          i++;
+          continue;
+        }
+      size_t j = i;
+      while (j < line.size() && CanRun(*line[j]))
+        j++;
+
+      std::vector<I3ModulePtr> run(line.begin() + i, line.begin() + j);
+      boost::shared_ptr<I3PhysicsWorkers> workers =
+        boost::make_shared<I3PhysicsWorkers>(context, run, pool);
+      workers->SetName(run.front()->GetName() + ".." + run.back()->GetName());
+      if (I3PipelineStage* stage = dynamic_cast<I3PipelineStage*>(line[i-1].get()))
+        stage->Connect(workers);
+      else
+        line[i-1]->ConnectOutBox(line[i-1]->outboxes_.begin()->first, workers);
+      if (j < line.size())
+        workers->ConnectOutBox("OutBox", line[j]);
+      log_info("Running %s on %u workers", workers->GetName().c_str(),
+               unsigned(workers->chains_.size()));
+
+      installed++;
+      i = j;
+    }
+  return installed;
+}
+
+I3ModulePtr
+I3PhysicsWorkers::Clone(const I3Module& module)
+{
+  I3ModulePtr clone =
+    I3::Singleton<I3ModuleFactory>::get_const_instance()
+    .Create(module.GetConfiguration().ClassName())(module.GetContext());
+  clone->GetConfiguration() = module.GetConfiguration();
+  clone->SetName(module.GetName());
+  clone->Configure_();
+  if (!clone->GetConfiguration().is_ok())
+    log_fatal("Error configuring a worker's instance of module \"%s\"",
+              module.GetName().c_str());
+  if (clone->outboxes_.size() != 1)
+    log_fatal("A worker's instance of module \"%s\" has %zu outboxes, not one",
+              module.GetName().c_str(), clone->outboxes_.size());
+  clone->laned_ = true;
+  return clone;
+}
+
+std::vector<I3FramePtr>
+I3PhysicsWorkers::RunModule(I3Module& module, void (I3Module::*f)(),
+                            const std::vector<I3FramePtr>& in, I3FrameMixer* mixer)
+{
+  I3Module::Lane lane;
+  BOOST_FOREACH(const I3FramePtr& frame, in)
+    lane.inbox.push_front(frame);
+  lane.mixer = mixer;
+
+  // modules on this thread push to and pop from lane until we return
+  struct lane_scope
+  {
+    explicit lane_scope(I3Module::Lane* lane) { I3Module::lane_.reset(lane); }
+    ~lane_scope() { I3Module::lane_.release(); }
+  } scope(&lane);
+  try {
+    if (f == &I3Module::Process_)
+      {
+        while (!lane.inbox.empty())
+          module.Process_();
+      }
+    else
+      (module.*f)();
+  } catch (...) {
+    log_error("%s: Exception thrown", module.GetName().c_str());
+    throw;
+  }
+  return lane.outbox;
+}
+
+std::vector<I3FramePtr>
+I3PhysicsWorkers::RunSerial(std::vector<I3FramePtr> frames, size_t from)
+{
+  for (size_t i = from; i < chains_[0].size() && !frames.empty(); i++)
+    {
+      // the others first: worker 0's instance may change the frames
+      for (unsigned w = 1; w < chains_.size(); w++)
+        {
+          if (chains_[w][i] == chains_[0][i])
+            continue;
+          std::vector<I3FramePtr> copies;
+          BOOST_FOREACH(const I3FramePtr& frame, frames)
+            if (serial_stop(frame))
+              copies.push_back(boost::make_shared<I3Frame>(*frame));
+          if (!copies.empty())
+            RunModule(*chains_[w][i], &I3Module::Process_, copies, 0);
+        }
+      frames = RunModule(*chains_[0][i], &I3Module::Process_, frames, mixers_[i].get());
+    }
+  return frames;
+}
+
+void
+I3PhysicsWorkers::RunTask(TaskPtr task)
+{
+  unsigned w;
+  {
+    boost::mutex::scoped_lock lock(idle_mtx_);
+    i3_assert(!idle_.empty());
+    w = idle_.back();
+    idle_.pop_back();
+  }
+
+  try {
+    std::vector<I3FramePtr> frames;
+    frames.swap(task->frames);
+    const std::vector<I3ModulePtr>& chain = chains_[w];
+    for (size_t i = 0; i < chain.size() && !frames.empty(); i++)
+      {
+        // mixers_ holds still while tasks run; DAQ frames make the
+        // copies their own
+        if (!task->mixers[i])
+          {
+            task->mixers[i] = boost::make_shared<I3FrameMixer>(*mixers_[i]);
+            task->mixers[i]->ShareSnapshots(I3FrameSnapshotsPtr());
+          }
+        frames = RunModule(*chain[i], &I3Module::Process_, frames, task->mixers[i].get());
+      }
+    task->frames.swap(frames);
+  } catch (...) {
+    boost::mutex::scoped_lock lock(idle_mtx_);
+    idle_.push_back(w);
+    throw;
+  }
+
+  boost::mutex::scoped_lock lock(idle_mtx_);
+  idle_.push_back(w);
+}
+
+void
+I3PhysicsWorkers::Dispatch()
+{
+  if (!next_)
+    return;
+  TaskPtr task = next_;
+  next_.reset();
+  task->handle = pool_->Submit(boost::bind(&I3PhysicsWorkers::RunTask, this, task));
+  running_.push_back(task);
+  Emit(max_running_);
+}
+
+void
+I3PhysicsWorkers::Emit(size_t keep)
+{
+  while (!running_.empty() &&
+         (running_.size() > keep || running_.front()->handle->Done()))
+    {
+      TaskPtr task = running_.front();
+      running_.pop_front();
+      task->handle->Wait();
+
+      for (size_t i = 0; i < task->mixers.size(); i++)
+        if (task->mixers[i])
+          pending_[i] = task->mixers[i];
+      BOOST_FOREACH(const I3FramePtr& frame, task->frames)
+        PushFrame(frame);
+    }
+}
+
+void
+I3PhysicsWorkers::Commit()
+{
+  for (size_t i = 0; i < pending_.size(); i++)
+    {
+      if (!pending_[i])
+        continue;
+      if (snapshots_)
+        pending_[i]->ShareSnapshots(snapshots_);
+      mixers_[i] = pending_[i];
+      pending_[i].reset();
+    }
+}
+
+void
+I3PhysicsWorkers::Barrier(I3FramePtr frame)
+{
+  Dispatch();
+  Emit(0);
+  Commit();
+
+  std::vector<I3FramePtr> out = RunSerial(std::vector<I3FramePtr>(1, frame), 0);
+  BOOST_FOREACH(const I3FramePtr& f, out)
+    PushFrame(f);
+}
+
+void
+I3PhysicsWorkers::Process()
+{
+  I3FramePtr frame = PopFrame();
+  if (!frame)
+    return;
+
+  if (serial_stop(frame))
+    {
+      Barrier(frame);
+      return;
+    }
+
+  // a DAQ frame starts a task of its own
+  if (frame->GetStop() == I3Frame::DAQ)
+    Dispatch();
+  if (!next_)
+    {
+      next_ = boost::make_shared<Task>();
+      next_->mixers.resize(chains_[0].size());
+    }
+  next_->frames.push_back(frame);
+
+  // as does a Physics frame with no DAQ frame before it
+  if (next_->frames.front()->GetStop() != I3Frame::DAQ)
+    Dispatch();
+}
+
+void
+I3PhysicsWorkers::Finish()
+{
+  Dispatch();
+  Emit(0);
+  Commit();
+
+  // Whatever a module pushes from Finish() goes through the rest of the
+  // chain serially, every worker's instance in turn.
+  for (size_t i = 0; i < chains_[0].size(); i++)
+    for (unsigned w = 0; w < chains_.size(); w++)
+      {
+        I3Module& module = *chains_[w][i];
+        if (w > 0 && &module == chains_[0][i].get())
+          continue;
+        std::vector<I3FramePtr> out =
+          RunModule(module, &I3Module::Finish, std::vector<I3FramePtr>(), mixers_[i].get());
+        out = RunSerial(out, i + 1);
+        BOOST_FOREACH(const I3FramePtr& frame, out)
+          PushFrame(frame);
+
+        // so that I3Tray::Usage() covers every instance
+        if (w > 0)
+          {
+            I3Module& original = *chains_[0][i];
+            original.nphyscall_ += module.nphyscall_;
+            original.ndaqcall_ += module.ndaqcall_;
+            original.userphystime_ += module.userphystime_;
+            original.userdaqtime_ += module.userdaqtime_;
+            original.latency_.Merge(module.latency_);
+            for (unsigned s = 0; s < 256; s++)
+              {
+                original.streamcalls_[s] += module.streamcalls_[s];
+                original.streamtime_[s] += module.streamtime_[s];
+                module.streamcalls_[s] = 0;
+                module.streamtime_[s] = 0;
+              }
+            module.nphyscall_ = module.ndaqcall_ = 0;
+            module.userphystime_ = module.userdaqtime_ = 0;
+            module.latency_.Clear();
+          }
+      }
+}
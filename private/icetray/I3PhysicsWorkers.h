@@ -0,0 +1,105 @@
+#ifndef ICETRAY_I3PHYSICSWORKERS_H_INCLUDED
+#define ICETRAY_I3PHYSICSWORKERS_H_INCLUDED
+
+#include <deque>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <icetray/I3Module.h>
+#include <icetray/I3FrameMixing.h>
+#include <icetray/I3ThreadPool.h>
+
+/**
+ * Runs a chain of ThreadSafe and PerWorker modules (see
+ * I3Module::Concurrency) on a thread pool.  I3Tray puts one in place of
+ * every such chain when it has physics workers
+ * (I3Tray::SetPhysicsWorkers()).
+ *
+ * A DAQ frame and the Physics frames after it make one task.  Tasks run
+ * concurrently, each through one worker's instances of the modules, and
+ * what comes out of them is pushed on in the order they came in.  Any
+ * other frame is a barrier: the tasks before it are finished first, then
+ * it goes through the chain by itself, and to the other workers'
+ * PerWorker instances just as worker 0's saw it.
+ */
+class I3PhysicsWorkers : public I3Module
+{
+ public:
+  /// @a modules is the chain, in order; each passes CanRun().
+  I3PhysicsWorkers(const I3Context& context,
+                   const std::vector<I3ModulePtr>& modules,
+                   I3ThreadPoolPtr pool);
+
+  void Process();
+  void Finish();
+
+  /// Whether @a module can be part of a chain run by workers.
+  static bool CanRun(const I3Module& module);
+
+  /**
+   * Put workers in place of every chain of modules that CanRun()
+   * downstream of @a driver, as far as the modules form a single line.
+   * @return how many chains were replaced
+   */
+  static unsigned Install(I3ModulePtr driver, I3ThreadPoolPtr pool,
+                          const I3Context& context);
+
+  SET_LOGGER("I3PhysicsWorkers");
+
+ private:
+  typedef boost::shared_ptr<I3FrameMixer> I3FrameMixerPtr;
+
+  struct Task
+  {
+    std::vector<I3FramePtr> frames;
+    /// Copies of mixers_, made as frames first reach each position.
+    std::vector<I3FrameMixerPtr> mixers;
+    I3ThreadPool::TaskPtr handle;
+  };
+  typedef boost::shared_ptr<Task> TaskPtr;
+
+  /// chains_[w][i] is worker w's instance of the i'th module.
+  std::vector<std::vector<I3ModulePtr> > chains_;
+  /// The mixer of each position, as of the last frame that left the
+  /// chain.  Only changed while no task is running.
+  std::vector<I3FrameMixerPtr> mixers_;
+  /// Mixers of finished tasks, to become mixers_ at the next barrier.
+  std::vector<I3FrameMixerPtr> pending_;
+  I3ThreadPoolPtr pool_;
+
+  /// The task being gathered.
+  TaskPtr next_;
+  /// Tasks handed to the pool, oldest first.
+  std::deque<TaskPtr> running_;
+  size_t max_running_;
+
+  /// Workers not running a task.
+  std::vector<unsigned> idle_;
+  boost::mutex idle_mtx_;
+
+  I3ModulePtr Clone(const I3Module& module);
+  void Dispatch();
+  /// Push what finished tasks made, in order, until at most @a keep are
+  /// left running.
+  void Emit(size_t keep);
+  void Commit();
+  void Barrier(I3FramePtr frame);
+  void RunTask(TaskPtr task);
+
+  /**
+   * Run @a frames through worker 0's chain from position @a from, mixed
+   * with mixers_, showing the other workers' PerWorker instances what
+   * worker 0's see.  Returns what comes out at the end.
+   */
+  std::vector<I3FramePtr> RunSerial(std::vector<I3FramePtr> frames, size_t from);
+
+  /// Call @a f on @a module with @a in as its inbox; returns what it
+  /// pushed.
+  static std::vector<I3FramePtr> RunModule(I3Module& module,
+                                           void (I3Module::*f)(),
+                                           const std::vector<I3FramePtr>& in,
+                                           I3FrameMixer* mixer);
+};
+
+#endif
@@ -0,0 +1,254 @@
+#include "I3PipelineStage.h"
+
+#include <set>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/python/wrapper.hpp>
+
+#include <icetray/I3ConditionalModule.h>
+
+#include "I3Scheduler.h"
+#include "PythonFunction.h"
+
+namespace {
+  // Python needs the interpreter lock, which the thread that called
+  // I3Tray::Execute() holds throughout.
+  bool
+  uses_python(const I3Module& module)
+  {
+    if (dynamic_cast<const boost::python::detail::wrapper_base*>(&module) ||
+        dynamic_cast<const PythonFunction*>(&module))
+      return true;
+    const I3Configuration& config = module.GetConfiguration();
+    return dynamic_cast<const I3ConditionalModule*>(&module) &&
+      config.Has("If") && config.Get("If").ptr() != Py_None;
+  }
+
+  // what the stage throws at modules still pushing to it when it is
+  // torn down
+  struct stopped : std::exception
+  {
+    const char* what() const throw() { return "pipeline stage stopped"; }
+  };
+}
+
+I3PipelineStage::I3PipelineStage(const I3Context& context, unsigned capacity,
+                                 unsigned batch)
+  : I3Module(context), batch_(batch), queue_(capacity), stopping_(false),
+    done_(false), putting_(false), taking_(false), nfull_(0), nempty_(0)
+{
+  snapshots_ = boost::make_shared<I3FrameSnapshots>();
+  AddOutBox("OutBox");
+}
+
+I3PipelineStage::~I3PipelineStage()
+{
+  Stop();
+}
+
+boost::shared_ptr<I3PipelineStage>
+I3PipelineStage::Install(I3ModulePtr first, const std::vector<I3ModulePtr>& modules,
+                         unsigned capacity, unsigned batch,
+                         const I3Context& context)
+{
+  I3ModulePtr from;
+  std::string box;
+  BOOST_FOREACH(I3ModulePtr module, modules)
+    for (outboxmap_t::iterator iter = module->outboxes_.begin();
+         iter != module->outboxes_.end(); iter++)
+      {
+        if (iter->second.second != first)
+          continue;
+        if (from)
+          log_fatal("Module \"%s\" is fed by more than one outbox; it "
+                    "cannot start a pipeline stage", first->GetName().c_str());
+        from = module;
+        box = iter->first;
+      }
+  if (!from)
+    log_fatal("Nothing feeds module \"%s\"; only modules after the driving "
+              "module can start a pipeline stage", first->GetName().c_str());
+
+  boost::shared_ptr<I3PipelineStage> stage =
+    boost::make_shared<I3PipelineStage>(context, capacity, batch);
+  stage->SetName(first->GetName() + " stage");
+
+  // Everything downstream, up to the next stage, runs on the stage's
+  // thread and mixes against the stage's cache entries.
+  std::vector<I3ModulePtr> todo(1, first);
+  std::set<I3Module*> seen;
+  while (!todo.empty())
+    {
+      I3ModulePtr module = todo.back();
+      todo.pop_back();
+      if (!seen.insert(module.get()).second ||
+          dynamic_cast<I3PipelineStage*>(module.get()))
+        continue;
+      if (uses_python(*module))
+        log_fatal("Module \"%s\" calls into Python, so it cannot run in the "
+                  "pipeline stage starting at \"%s\"",
+                  module->GetName().c_str(), first->GetName().c_str());
+      module->snapshots_ = stage->snapshots_;
+      module->staged_ = true;
+      for (outboxmap_t::iterator iter = module->outboxes_.begin();
+           iter != module->outboxes_.end(); iter++)
+        if (iter->second.second)
+          todo.push_back(iter->second.second);
+    }
+
+  // fed from whatever thread runs from
+  stage->staged_ = true;
+  from->ConnectOutBox(box, stage);
+  stage->Connect(first);
+  stage->thread_ = boost::make_shared<boost::thread>(
+    boost::bind(&I3PipelineStage::Run, stage.get()));
+  log_info("Running the modules from \"%s\" on a thread of their own",
+           first->GetName().c_str());
+  return stage;
+}
+
+void
+I3PipelineStage::Connect(I3ModulePtr first)
+{
+  ConnectOutBox("OutBox", first);
+  // only Run() passes frames on, not I3Module::Do() or the tray's
+  // I3Scheduler
+  first_ = first;
+  outboxes_.begin()->second.second.reset();
+}
+
+void
+I3PipelineStage::Process()
+{
+  I3FramePtr frame = PopFrame();
+  if (!frame)
+    return;
+  // a copy of our own: a module with more than one outbox pushes this
+  // very frame to the rest of them, on this thread
+  I3FramePtr copy(new I3Frame(*frame));
+  copy->unshare();
+  Put(copy);
+}
+
+void
+I3PipelineStage::Finish()
+{
+  Put(I3FramePtr());
+  thread_->join();
+  Check();
+  log_info("%s: the queue was full %u times and empty %u times",
+           GetName().c_str(), nfull_, nempty_);
+}
+
+void
+I3PipelineStage::Put(I3FramePtr frame)
+{
+  if (done_ || stopping_)
+    {
+      Check();
+      throw stopped();
+    }
+  if (!queue_.push(frame))
+    {
+      nfull_++;
+      bool pushed;
+      {
+        boost::mutex::scoped_lock lock(mtx_);
+        putting_ = true;
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+        while (!(pushed = queue_.push(frame)) && !done_ && !stopping_)
+          changed_.wait(lock);
+        putting_ = false;
+      }
+      if (!pushed)
+        {
+          Check();
+          throw stopped();
+        }
+    }
+  Wake(taking_);
+}
+
+bool
+I3PipelineStage::Take(I3FramePtr& frame)
+{
+  if (!queue_.pop(frame))
+    {
+      nempty_++;
+      boost::mutex::scoped_lock lock(mtx_);
+      taking_ = true;
+      boost::atomic_thread_fence(boost::memory_order_seq_cst);
+      while (!stopping_ && !queue_.pop(frame))
+        changed_.wait(lock);
+      taking_ = false;
+    }
+  if (stopping_)
+    return false;
+  Wake(putting_);
+  return true;
+}
+
+void
+I3PipelineStage::Wake(const boost::atomic<bool>& waiting)
+{
+  // pairs with the fence after setting the flag: either the sleeper
+  // sees what we just did to queue_, or we see it asleep
+  boost::atomic_thread_fence(boost::memory_order_seq_cst);
+  if (!waiting)
+    return;
+  boost::mutex::scoped_lock lock(mtx_);
+  changed_.notify_all();
+}
+
+void
+I3PipelineStage::Check()
+{
+  boost::mutex::scoped_lock lock(mtx_);
+  if (error_)
+    std::rethrow_exception(error_);
+}
+
+void
+I3PipelineStage::Stop()
+{
+  {
+    boost::mutex::scoped_lock lock(mtx_);
+    stopping_ = true;
+    changed_.notify_all();
+  }
+  if (thread_ && thread_->joinable())
+    thread_->join();
+}
+
+void
+I3PipelineStage::Run()
+{
+  outboxmap_t::iterator outbox = outboxes_.begin();
+  try {
+    I3FramePtr frame;
+    while (Take(frame))
+      {
+        if (!scheduler_)
+          scheduler_ = boost::make_shared<I3Scheduler>(first_, batch_);
+        if (!frame)
+          {
+            scheduler_->Finish();
+            break;
+          }
+        // not PushFrame(), which drops frames for outboxes connected
+        // to nothing, as this one is
+        SyncCache(outbox->first, frame);
+        while (!outbox->second.first->push(frame))
+          scheduler_->Drain();
+        scheduler_->Drain();
+      }
+  } catch (...) {
+    boost::mutex::scoped_lock lock(mtx_);
+    error_ = std::current_exception();
+  }
+
+  boost::mutex::scoped_lock lock(mtx_);
+  done_ = true;
+  changed_.notify_all();
+}
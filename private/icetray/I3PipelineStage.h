@@ -0,0 +1,101 @@
+#ifndef ICETRAY_I3PIPELINESTAGE_H_INCLUDED
+#define ICETRAY_I3PIPELINESTAGE_H_INCLUDED
+
+#include <exception>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <icetray/I3FrameFifo.h>
+#include <icetray/I3Module.h>
+
+class I3Scheduler;
+
+/**
+ * The start of a pipeline stage (see I3Tray::StartStage()): the modules
+ * downstream of it run on a thread of their own.  I3Tray puts one in
+ * front of the first module of each stage.
+ *
+ * Frames cross over through an I3FrameFifo of fixed size, without
+ * locking while it is neither empty nor full; when it is full, the
+ * upstream stage waits (backpressure).  Finish() passes through
+ * once the queue has drained, and returns once the stage has finished,
+ * so Finish and Flush reach every module in order as before.  An
+ * exception thrown in the stage comes back out of the next Process()
+ * or Finish() on the upstream side.
+ *
+ * Each frame gets a key table and values of its own before it crosses
+ * (I3Frame::unshare()), and the stage mixes it afresh, against cache
+ * entries shared by its own modules only.  Nothing the frame reaches
+ * downstream is then touched by the upstream thread.
+ */
+class I3PipelineStage : public I3Module
+{
+ public:
+  I3PipelineStage(const I3Context& context, unsigned capacity,
+                  unsigned batch);
+  /// Stops the stage without finishing it, if it is still running.
+  ~I3PipelineStage();
+
+  void Process();
+  void Finish();
+
+  /**
+   * Start a stage at @a first, one of @a modules, which must have
+   * exactly one module feeding it.  The stage holds up to @a capacity
+   * frames in its queue, and runs its modules @a batch frames at a
+   * time (see I3Scheduler).
+   */
+  static boost::shared_ptr<I3PipelineStage>
+  Install(I3ModulePtr first, const std::vector<I3ModulePtr>& modules,
+          unsigned capacity, unsigned batch, const I3Context& context);
+
+  /// Feed the stage's frames to @a first.
+  void Connect(I3ModulePtr first);
+  /// The module the stage feeds.
+  I3ModulePtr GetFirst() const { return first_; }
+
+  SET_LOGGER("I3PipelineStage");
+
+ private:
+  /// The stage's thread: push what comes off queue_ on to first_.
+  void Run();
+  /// Wait for room in queue_ and append @a frame; a null frame means
+  /// Finish.
+  void Put(I3FramePtr frame);
+  /// Wait for a frame in queue_; false if the stage is stopping.
+  bool Take(I3FramePtr& frame);
+  /// Wake the other side if it is asleep in Put() or Take().
+  void Wake(const boost::atomic<bool>& waiting);
+  /// Rethrow what the stage threw, if anything.
+  void Check();
+  void Stop();
+
+  I3ModulePtr first_;
+  const unsigned batch_;
+  /// Made on the stage's thread once frames arrive, by when I3Tray
+  /// has put everything in place downstream.
+  boost::shared_ptr<I3Scheduler> scheduler_;
+  boost::shared_ptr<boost::thread> thread_;
+
+  I3FrameFifo queue_;
+  /// Set when the stage is to stop without finishing.
+  boost::atomic<bool> stopping_;
+  /// Set when the stage's thread has returned, after error_.
+  boost::atomic<bool> done_;
+  /// Set while either side is asleep on changed_.
+  boost::atomic<bool> putting_, taking_;
+  std::exception_ptr error_;
+  /// Only for sleeping when queue_ is full or empty.
+  boost::mutex mtx_;
+  boost::condition_variable changed_;
+
+  /// How often the upstream stage found the queue full, and how often
+  /// this one found it empty.
+  unsigned nfull_, nempty_;
+};
+
+#endif
@@ -0,0 +1,495 @@
+#include "I3ProcessWorkers.h"
+#include "I3Scheduler.h"
+#include "I3SharedRing.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/python.hpp>
+#include <boost/interprocess/streams/bufferstream.hpp>
+#include <boost/interprocess/streams/vectorstream.hpp>
+
+#include <icetray/I3FrameFifo.h>
+#include <icetray/I3FrameMixing.h>
+
+namespace {
+  enum { Frames = 1, FinishUp = 2, Failed = 3 };
+
+  // each way, per worker; a message bigger than this streams through
+  const size_t ring_size = 16 << 20;
+
+  bool
+  serial_stop(const I3FramePtr& frame)
+  {
+    return frame->GetStop() != I3Frame::DAQ && frame->GetStop() != I3Frame::Physics;
+  }
+
+  bool
+  parent_alive(pid_t parent)
+  {
+    return getppid() == parent;
+  }
+
+  // takes what comes out of the end of a worker's line
+  struct Collector : public I3Module
+  {
+    std::vector<I3FramePtr> frames_;
+    Collector(const I3Context& context) : I3Module(context) { }
+
+    void Process()
+    {
+      I3FramePtr frame = PopFrame();
+      if (frame)
+        frames_.push_back(frame);
+    }
+  };
+
+  std::vector<char>
+  encode(const std::vector<I3FramePtr>& frames)
+  {
+    boost::interprocess::basic_vectorstream<std::vector<char> > os;
+    boost::uint64_t n = frames.size();
+    os.write(reinterpret_cast<const char*>(&n), sizeof(n));
+    BOOST_FOREACH(const I3FramePtr& frame, frames)
+      frame->save(os);
+    return os.vector();
+  }
+
+  std::vector<I3FramePtr>
+  decode(std::vector<char>& body)
+  {
+    boost::interprocess::bufferstream is(&body[0], body.size());
+    boost::uint64_t n = 0;
+    is.read(reinterpret_cast<char*>(&n), sizeof(n));
+    std::vector<I3FramePtr> frames;
+    for (boost::uint64_t i = 0; i < n; i++)
+      {
+        I3FramePtr frame(new I3Frame);
+        if (!frame->load(is))
+          log_fatal("Truncated message from a worker process");
+        frames.push_back(frame);
+      }
+    return frames;
+  }
+}
+
+I3ProcessWorkers::I3ProcessWorkers(const I3Context& context, I3ModulePtr first,
+                                   I3ModulePtr last, unsigned nprocs,
+                                   unsigned batch)
+  : I3Module(context), first_(first), last_(last), batch_(batch), turn_(0),
+    // enough to keep every worker busy while the oldest task finishes
+    max_pending_(3 * nprocs)
+{
+  AddOutBox("OutBox");
+}
+
+I3ProcessWorkers::~I3ProcessWorkers()
+{
+  Stop();
+}
+
+boost::shared_ptr<I3ProcessWorkers>
+I3ProcessWorkers::Install(I3ModulePtr first, I3ModulePtr last,
+                          const std::vector<I3ModulePtr>& modules,
+                          unsigned nprocs, unsigned batch,
+                          const I3Context& context)
+{
+  I3ModulePtr from;
+  std::string box;
+  BOOST_FOREACH(I3ModulePtr module, modules)
+    for (outboxmap_t::iterator iter = module->outboxes_.begin();
+         iter != module->outboxes_.end(); iter++)
+      {
+        if (iter->second.second != first)
+          continue;
+        if (from)
+          log_fatal("Module \"%s\" is fed by more than one outbox; it "
+                    "cannot start the worker processes", first->GetName().c_str());
+        from = module;
+        box = iter->first;
+      }
+  if (!from)
+    log_fatal("Nothing feeds module \"%s\"; only modules after the driving "
+              "module can run in worker processes", first->GetName().c_str());
+
+  for (I3ModulePtr module = first; module != last; )
+    {
+      if (module->outboxes_.size() != 1)
+        log_fatal("Module \"%s\" has %zu outboxes; worker processes can "
+                  "only run a single line of modules",
+                  module->GetName().c_str(), module->outboxes_.size());
+      module = module->outboxes_.begin()->second.second;
+      if (!module)
+        log_fatal("Module \"%s\" does not follow \"%s\"",
+                  last->GetName().c_str(), first->GetName().c_str());
+    }
+  if (last->outboxes_.size() != 1)
+    log_fatal("Module \"%s\" has %zu outboxes; worker processes can "
+              "only run a single line of modules",
+              last->GetName().c_str(), last->outboxes_.size());
+
+  boost::shared_ptr<I3ProcessWorkers> workers =
+    boost::make_shared<I3ProcessWorkers>(context, first, last, nprocs, batch);
+  workers->SetName(first->GetName() + ".." + last->GetName());
+  I3ModulePtr next = last->outboxes_.begin()->second.second;
+  from->ConnectOutBox(box, workers);
+  if (next)
+    workers->ConnectOutBox("OutBox", next);
+
+  workers->Start(nprocs);
+  log_info("Running %s in %u worker processes", workers->GetName().c_str(),
+           nprocs);
+  return workers;
+}
+
+void
+I3ProcessWorkers::Start(unsigned nprocs)
+{
+  for (unsigned w = 0; w < nprocs; w++)
+    {
+      WorkerPtr worker = boost::make_shared<Worker>();
+      worker->pid = 0;
+      worker->in = boost::make_shared<I3SharedRing>(ring_size);
+      worker->out = boost::make_shared<I3SharedRing>(ring_size);
+      worker->exited = false;
+      worker->reaped = false;
+      worker->status = 0;
+      workers_.push_back(worker);
+    }
+
+  // or the workers print whatever is buffered again
+  std::cout.flush();
+  std::cerr.flush();
+  fflush(0);
+
+  const bool python = Py_IsInitialized();
+  for (unsigned w = 0; w < nprocs; w++)
+    {
+#if PY_VERSION_HEX >= 0x03070000
+      // pairs with PyOS_AfterFork_Child() in Serve()
+      PyGILState_STATE gil = PyGILState_UNLOCKED;
+      if (python)
+        {
+          gil = PyGILState_Ensure();
+          PyOS_BeforeFork();
+        }
+#endif
+      pid_t pid = fork();
+      if (pid == 0)
+        Serve(w);
+#if PY_VERSION_HEX >= 0x03070000
+      if (python)
+        {
+          PyOS_AfterFork_Parent();
+          PyGILState_Release(gil);
+        }
+#endif
+      if (pid < 0)
+        log_fatal("Could not start worker process %u: %s", w, strerror(errno));
+      workers_[w]->pid = pid;
+    }
+
+  // only now: threads don't survive fork()
+  for (unsigned w = 0; w < nprocs; w++)
+    workers_[w]->reader = boost::make_shared<boost::thread>(
+      boost::bind(&I3ProcessWorkers::Read, this, w));
+}
+
+void
+I3ProcessWorkers::Serve(unsigned w)
+{
+#ifdef __linux__
+  // don't outlive the tray
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+#endif
+  if (Py_IsInitialized())
+    {
+#if PY_VERSION_HEX >= 0x03070000
+      PyOS_AfterFork_Child();
+#else
+      PyOS_AfterFork();
+#endif
+    }
+
+  I3SharedRing::alive_t alive = boost::bind(parent_alive, getppid());
+  Worker& me = *workers_[w];
+  int status = 0;
+  try {
+    first_->inbox_ = boost::make_shared<I3FrameFifo>();
+    boost::shared_ptr<Collector> collector =
+      boost::make_shared<Collector>(GetContext());
+    collector->SetName(GetName() + " collector");
+    last_->ConnectOutBox(last_->outboxes_.begin()->first, collector);
+
+    I3Scheduler scheduler(first_, batch_);
+    I3FrameMixer mixer;
+    boost::uint32_t kind;
+    std::vector<char> body;
+    while (me.in->ReadMessage(kind, body, alive))
+      {
+        if (kind == FinishUp)
+          scheduler.Finish();
+        else
+          {
+            std::vector<I3FramePtr> frames = decode(body);
+            BOOST_FOREACH(const I3FramePtr& frame, frames)
+              {
+                mixer.Mix(*frame);
+                while (!first_->inbox_->push(frame))
+                  scheduler.Drain();
+              }
+          }
+        scheduler.Drain();
+
+        if (kind == FinishUp)
+          {
+            std::cout.flush();
+            std::cerr.flush();
+            fflush(0);
+          }
+        std::vector<char> reply = encode(collector->frames_);
+        collector->frames_.clear();
+        if (!me.out->WriteMessage(Frames, &reply[0], reply.size(), alive))
+          break;
+        if (kind == FinishUp)
+          _exit(0);
+      }
+    status = 1;
+  } catch (const boost::python::error_already_set&) {
+    PyErr_Print();
+    std::string what = "Python exception";
+    me.out->WriteMessage(Failed, what.data(), what.size(), alive);
+    status = 1;
+  } catch (const std::exception& e) {
+    std::string what = e.what();
+    me.out->WriteMessage(Failed, what.data(), what.size(), alive);
+    status = 1;
+  } catch (...) {
+    std::string what = "unknown exception";
+    me.out->WriteMessage(Failed, what.data(), what.size(), alive);
+    status = 1;
+  }
+  std::cout.flush();
+  std::cerr.flush();
+  fflush(0);
+  _exit(status);
+}
+
+bool
+I3ProcessWorkers::Alive(unsigned w)
+{
+  Worker& worker = *workers_[w];
+  int status;
+  if (waitpid(worker.pid, &status, WNOHANG) != worker.pid)
+    return true;
+  worker.status = status;
+  worker.reaped = true;
+  return false;
+}
+
+void
+I3ProcessWorkers::Read(unsigned w)
+{
+  Worker& worker = *workers_[w];
+  for (;;)
+    {
+      std::pair<boost::uint32_t, std::vector<char> > message;
+      bool ok = worker.out->ReadMessage(message.first, message.second,
+                                        boost::bind(&I3ProcessWorkers::Alive,
+                                                    this, w));
+      if (!ok && !worker.reaped)
+        {
+          int status;
+          if (waitpid(worker.pid, &status, 0) == worker.pid)
+            worker.status = status;
+          worker.reaped = true;
+        }
+
+      boost::mutex::scoped_lock lock(mtx_);
+      if (!ok)
+        {
+          worker.exited = true;
+          // so that nothing waits to send it more
+          worker.in->Close();
+          changed_.notify_all();
+          return;
+        }
+      worker.results.push_back(std::pair<boost::uint32_t, std::vector<char> >());
+      worker.results.back().first = message.first;
+      worker.results.back().second.swap(message.second);
+      changed_.notify_all();
+    }
+}
+
+void
+I3ProcessWorkers::Send(unsigned w, boost::uint32_t kind,
+                       const std::vector<I3FramePtr>& frames)
+{
+  std::vector<char> body = encode(frames);
+  if (!workers_[w]->in->WriteMessage(kind, &body[0], body.size()))
+    Died(w);
+  pending_.push_back(Pending());
+  pending_.back().worker = w;
+  pending_.back().keep = true;
+}
+
+std::vector<I3FramePtr>
+I3ProcessWorkers::Receive(unsigned w)
+{
+  Worker& worker = *workers_[w];
+  std::pair<boost::uint32_t, std::vector<char> > message;
+  bool exited;
+  {
+    boost::mutex::scoped_lock lock(mtx_);
+    while (worker.results.empty() && !worker.exited)
+      changed_.wait(lock);
+    exited = worker.results.empty();
+    if (!exited)
+      {
+        message.first = worker.results.front().first;
+        message.second.swap(worker.results.front().second);
+        worker.results.pop_front();
+      }
+  }
+
+  if (exited)
+    Died(w);
+  if (message.first == Failed)
+    log_fatal("Worker process %u of %s failed: %s", w, GetName().c_str(),
+              std::string(message.second.begin(), message.second.end()).c_str());
+  return decode(message.second);
+}
+
+void
+I3ProcessWorkers::Died(unsigned w)
+{
+  Worker& worker = *workers_[w];
+  std::string what;
+  {
+    boost::mutex::scoped_lock lock(mtx_);
+    while (!worker.exited)
+      changed_.wait(lock);
+    for (size_t i = 0; i < worker.results.size(); i++)
+      if (worker.results[i].first == Failed)
+        what.assign(worker.results[i].second.begin(),
+                    worker.results[i].second.end());
+  }
+  if (!what.empty())
+    log_fatal("Worker process %u of %s failed: %s", w, GetName().c_str(),
+              what.c_str());
+  log_fatal("Worker process %u of %s died (status %d)", w,
+            GetName().c_str(), worker.status);
+}
+
+void
+I3ProcessWorkers::Dispatch()
+{
+  if (next_.empty())
+    return;
+  Send(turn_, Frames, next_);
+  next_.clear();
+  turn_ = (turn_ + 1) % workers_.size();
+  Emit(max_pending_);
+}
+
+void
+I3ProcessWorkers::Emit(size_t keep)
+{
+  while (!pending_.empty())
+    {
+      Pending p = pending_.front();
+      if (pending_.size() <= keep)
+        {
+          boost::mutex::scoped_lock lock(mtx_);
+          if (workers_[p.worker]->results.empty())
+            break;
+        }
+      pending_.pop_front();
+      std::vector<I3FramePtr> frames = Receive(p.worker);
+      if (p.keep)
+        BOOST_FOREACH(const I3FramePtr& frame, frames)
+          PushFrame(frame);
+    }
+}
+
+void
+I3ProcessWorkers::Process()
+{
+  I3FramePtr frame = PopFrame();
+  if (!frame)
+    return;
+
+  if (serial_stop(frame))
+    {
+      Dispatch();
+      std::vector<I3FramePtr> frames(1, frame);
+      for (unsigned w = 0; w < workers_.size(); w++)
+        {
+          Send(w, Frames, frames);
+          pending_.back().keep = (w == 0);
+        }
+      Emit(max_pending_);
+      return;
+    }
+
+  // a DAQ frame starts a task of its own
+  if (frame->GetStop() == I3Frame::DAQ)
+    Dispatch();
+  next_.push_back(frame);
+
+  // as does a Physics frame with no DAQ frame before it
+  if (next_.front()->GetStop() != I3Frame::DAQ)
+    Dispatch();
+}
+
+void
+I3ProcessWorkers::Finish()
+{
+  Dispatch();
+  Emit(0);
+
+  for (unsigned w = 0; w < workers_.size(); w++)
+    Send(w, FinishUp, std::vector<I3FramePtr>());
+  Emit(0);
+
+  // the workers exit once they have answered
+  BOOST_FOREACH(WorkerPtr worker, workers_)
+    {
+      if (worker->reader)
+        worker->reader->join();
+      worker->reader.reset();
+      if (!WIFEXITED(worker->status) || WEXITSTATUS(worker->status) != 0)
+        log_warn("A worker process of %s exited with status %d",
+                 GetName().c_str(), worker->status);
+    }
+}
+
+void
+I3ProcessWorkers::Stop()
+{
+  BOOST_FOREACH(WorkerPtr worker, workers_)
+    {
+      if (!worker->reader)
+        continue;
+      {
+        boost::mutex::scoped_lock lock(mtx_);
+        if (!worker->exited && worker->pid > 0)
+          kill(worker->pid, SIGKILL);
+      }
+      worker->in->Close();
+      worker->out->Close();
+      worker->reader->join();
+      worker->reader.reset();
+    }
+}
@@ -0,0 +1,112 @@
+#ifndef ICETRAY_I3PROCESSWORKERS_H_INCLUDED
+#define ICETRAY_I3PROCESSWORKERS_H_INCLUDED
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <icetray/I3Module.h>
+
+class I3SharedRing;
+
+/**
+ * Runs a line of modules in worker processes forked from the tray.
+ * I3Tray puts one in place of the line when asked to
+ * (I3Tray::SetWorkerProcesses()).
+ *
+ * Frames go to the workers serialized, through rings in shared memory,
+ * and come back the same way.  A DAQ frame and the Physics frames after
+ * it make one task, handed to the workers in turn; what comes back is
+ * pushed on in the order the tasks went out.  Any other frame goes to
+ * every worker, so that each mixes its tasks against the same
+ * Geometry, Calibration and DetectorStatus, and only the first
+ * worker's copy of what comes out is kept.  When the tray finishes, so
+ * does every worker, and what each pushes from Finish() is kept.
+ *
+ * The workers are copies of the tray as it was when configured; their
+ * modules must not share state through anything but frames, and
+ * everything they put in frames must be serializable.
+ */
+class I3ProcessWorkers : public I3Module
+{
+ public:
+  /// @a first to @a last, in order, is the line run by the workers.
+  I3ProcessWorkers(const I3Context& context, I3ModulePtr first,
+                   I3ModulePtr last, unsigned nprocs, unsigned batch);
+  ~I3ProcessWorkers();
+
+  void Process();
+  void Finish();
+
+  /**
+   * Fork @a nprocs workers running @a first up to @a last, which must
+   * form a single line, and put them in its place among @a modules.
+   */
+  static boost::shared_ptr<I3ProcessWorkers>
+  Install(I3ModulePtr first, I3ModulePtr last,
+          const std::vector<I3ModulePtr>& modules, unsigned nprocs,
+          unsigned batch, const I3Context& context);
+
+  SET_LOGGER("I3ProcessWorkers");
+
+ private:
+  struct Worker
+  {
+    pid_t pid;
+    /// frames to the worker, and back
+    boost::shared_ptr<I3SharedRing> in, out;
+    boost::shared_ptr<boost::thread> reader;
+    /// messages read back but not yet taken: (kind, body)
+    std::deque<std::pair<boost::uint32_t, std::vector<char> > > results;
+    bool exited;
+    /// only touched by the reader
+    bool reaped;
+    int status;
+  };
+  typedef boost::shared_ptr<Worker> WorkerPtr;
+
+  /// A message sent, and whether its answer is pushed on.
+  struct Pending
+  {
+    unsigned worker;
+    bool keep;
+  };
+
+  I3ModulePtr first_, last_;
+  const unsigned batch_;
+  std::vector<WorkerPtr> workers_;
+  /// Guards every Worker's results and exited.
+  boost::mutex mtx_;
+  boost::condition_variable changed_;
+
+  /// The task being gathered.
+  std::vector<I3FramePtr> next_;
+  unsigned turn_;
+  std::deque<Pending> pending_;
+  size_t max_pending_;
+
+  void Start(unsigned nprocs);
+  /// The worker's side; never returns.
+  void Serve(unsigned w);
+  /// Moves worker @a w's answers from its ring to its results.
+  void Read(unsigned w);
+  bool Alive(unsigned w);
+
+  void Send(unsigned w, boost::uint32_t kind,
+            const std::vector<I3FramePtr>& frames);
+  std::vector<I3FramePtr> Receive(unsigned w);
+  /// Report why worker @a w stopped answering; throws.
+  void Died(unsigned w);
+  void Dispatch();
+  /// Push the answers to what was sent, in order, until at most @a keep
+  /// are outstanding.
+  void Emit(size_t keep);
+  void Stop();
+};
+
+#endif
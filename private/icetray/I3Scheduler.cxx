@@ -0,0 +1,90 @@
+#include "I3Scheduler.h"
+
+I3Scheduler::I3Scheduler(I3ModulePtr root, unsigned batch)
+  : root_(root), batch_(batch)
+{
+  // preorder: each module has one inbox, so the modules form a tree
+  std::vector<I3Module*> todo(1, root.get());
+  while (!todo.empty())
+    {
+      I3Module* module = todo.back();
+      todo.pop_back();
+      order_.push_back(module);
+      module->batch_size_ = batch;
+      // reversed, so that the first outbox's branch comes first
+      for (I3Module::outboxmap_t::reverse_iterator iter =
+             module->outboxes_.rbegin();
+           iter != module->outboxes_.rend(); iter++)
+        if (iter->second.second)
+          todo.push_back(iter->second.second.get());
+    }
+}
+
+void
+I3Scheduler::Source()
+{
+  if (batch_ == 0)
+    root_->Do(&I3Module::Process_);
+  else
+    root_->Call(&I3Module::Process_);
+}
+
+bool
+I3Scheduler::Ready() const
+{
+  if (batch_ <= 1)
+    return true;
+  size_t queued = 0;
+  for (I3Module::outboxmap_t::const_iterator iter = root_->outboxes_.begin();
+       iter != root_->outboxes_.end(); iter++)
+    queued += iter->second.first->size();
+  return queued >= batch_;
+}
+
+void
+I3Scheduler::Drain()
+{
+  if (batch_ == 0)
+    {
+      while (root_->inbox_ && !root_->inbox_->empty())
+        root_->Do(&I3Module::Process_);
+      return;
+    }
+
+  bool busy = true;
+  while (busy)
+    {
+      busy = false;
+      for (std::vector<I3Module*>::const_iterator it = order_.begin();
+           it != order_.end(); it++)
+        {
+          I3Module* module = *it;
+          if (!module->inbox_)
+            continue;
+          for (unsigned n = 0; n < batch_ && !module->inbox_->empty(); n++)
+            {
+              module->Call(&I3Module::Process_);
+              busy = true;
+            }
+        }
+    }
+}
+
+void
+I3Scheduler::Finish()
+{
+  if (batch_ == 0)
+    {
+      Drain();
+      root_->Do(&I3Module::Finish);
+      return;
+    }
+
+  Drain();
+  for (std::vector<I3Module*>::const_iterator it = order_.begin();
+       it != order_.end(); it++)
+    {
+      (*it)->Call(&I3Module::Finish);
+      Drain();
+    }
+}
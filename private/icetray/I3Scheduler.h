@@ -0,0 +1,56 @@
+#ifndef ICETRAY_I3SCHEDULER_H_INCLUDED
+#define ICETRAY_I3SCHEDULER_H_INCLUDED
+
+#include <vector>
+
+#include <icetray/I3Module.h>
+
+/**
+ * Moves frames through a module and everything downstream of it
+ * without recursing.  I3Tray runs the tray through one of these (see
+ * I3Tray::SetBatchSize()), and each I3PipelineStage its own modules.
+ *
+ * The modules are put in order once, each ahead of those it feeds.
+ * Drain() then goes down that list, running each module over up to a
+ * batch of the frames in its inbox, and goes round again until every
+ * fifo is empty.  Every module still sees its frames in the order they
+ * were pushed to it, and is finished only after all of them, and after
+ * the modules upstream of it.  Frames on different branches of a Fork
+ * may interleave differently than with Do().
+ *
+ * With batches of more than one frame, modules that dispatch frames
+ * with I3Module::Process() get consecutive Physics frames together in
+ * I3Module::PhysicsBatch().
+ *
+ * A batch size of zero calls I3Module::Do() instead, which takes each
+ * frame all the way down before the next.
+ */
+class I3Scheduler
+{
+ public:
+  I3Scheduler(I3ModulePtr root, unsigned batch);
+
+  /// Call Process() on the root once, e.g. on a driving module to
+  /// have it push its next frame.
+  void Source();
+
+  /// Whether the root has pushed enough frames to start a batch.
+  bool Ready() const;
+
+  /// Process every frame waiting anywhere, the root's inbox included.
+  void Drain();
+
+  /// Drain, then finish the root and the modules downstream of it,
+  /// draining what each pushes before finishing the next.
+  void Finish();
+
+  unsigned GetBatchSize() const { return batch_; }
+
+ private:
+  I3ModulePtr root_;
+  /// root_ first; every module ahead of those it feeds
+  std::vector<I3Module*> order_;
+  const unsigned batch_;
+};
+
+#endif
@@ -0,0 +1,211 @@
+#include "I3SharedRing.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include <icetray/I3Logging.h>
+
+// glibc and musl have robust mutexes, but PTHREAD_MUTEX_ROBUST is an
+// enumerator there, so it can't be tested for with #ifdef
+#if defined(__linux__)
+#define I3_ROBUST_MUTEX 1
+#endif
+
+struct I3SharedRing::Header
+{
+  pthread_mutex_t mtx;
+  pthread_cond_t changed;
+  /// total bytes ever read and written; head_ <= tail_
+  boost::uint64_t head, tail;
+  size_t capacity;
+  bool closed;
+};
+
+I3SharedRing::I3SharedRing(size_t capacity)
+  : mapped_(sizeof(Header) + capacity)
+{
+  void* mem = mmap(0, mapped_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+    log_fatal("Could not map %zu bytes of shared memory: %s", mapped_,
+              strerror(errno));
+  header_ = static_cast<Header*>(mem);
+  data_ = static_cast<char*>(mem) + sizeof(Header);
+
+  pthread_mutexattr_t mattr;
+  pthread_mutexattr_init(&mattr);
+  pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+#ifdef I3_ROBUST_MUTEX
+  // a peer that dies holding the lock doesn't take us with it
+  pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+#endif
+  pthread_mutex_init(&header_->mtx, &mattr);
+  pthread_mutexattr_destroy(&mattr);
+
+  pthread_condattr_t cattr;
+  pthread_condattr_init(&cattr);
+  pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+  pthread_cond_init(&header_->changed, &cattr);
+  pthread_condattr_destroy(&cattr);
+
+  header_->head = header_->tail = 0;
+  header_->capacity = capacity;
+  header_->closed = false;
+}
+
+I3SharedRing::~I3SharedRing()
+{
+  // the other process has its own mapping, and its own copy of us
+  munmap(header_, mapped_);
+}
+
+void
+I3SharedRing::Lock() const
+{
+  Locked(pthread_mutex_lock(&header_->mtx));
+}
+
+void
+I3SharedRing::Locked(int err) const
+{
+#ifdef I3_ROBUST_MUTEX
+  // the peer died holding the lock: take it over, and hang up
+  if (err == EOWNERDEAD)
+    {
+      header_->closed = true;
+      pthread_mutex_consistent(&header_->mtx);
+      pthread_cond_broadcast(&header_->changed);
+    }
+#else
+  (void)err;
+#endif
+}
+
+void
+I3SharedRing::Unlock() const
+{
+  pthread_mutex_unlock(&header_->mtx);
+}
+
+void
+I3SharedRing::Wait(const alive_t& alive)
+{
+  struct timeval now;
+  gettimeofday(&now, 0);
+  struct timespec until;
+  until.tv_sec = now.tv_sec;
+  until.tv_nsec = now.tv_usec * 1000 + 100000000;
+  if (until.tv_nsec >= 1000000000)
+    {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000;
+    }
+
+  int err = pthread_cond_timedwait(&header_->changed, &header_->mtx, &until);
+  Locked(err);
+  if (err == ETIMEDOUT && alive && !alive())
+    {
+      header_->closed = true;
+      pthread_cond_broadcast(&header_->changed);
+    }
+}
+
+bool
+I3SharedRing::Write(const void* data, size_t n, const alive_t& alive)
+{
+  const char* from = static_cast<const char*>(data);
+  Lock();
+  while (n > 0)
+    {
+      while (!header_->closed &&
+             header_->tail - header_->head == header_->capacity)
+        Wait(alive);
+      if (header_->closed)
+        {
+          Unlock();
+          return false;
+        }
+      size_t offset = header_->tail % header_->capacity;
+      size_t room = header_->capacity - (header_->tail - header_->head);
+      size_t count = std::min(n, std::min(room, header_->capacity - offset));
+      memcpy(data_ + offset, from, count);
+      header_->tail += count;
+      from += count;
+      n -= count;
+      pthread_cond_broadcast(&header_->changed);
+    }
+  Unlock();
+  return true;
+}
+
+bool
+I3SharedRing::Read(void* data, size_t n, const alive_t& alive)
+{
+  char* to = static_cast<char*>(data);
+  Lock();
+  while (n > 0)
+    {
+      while (!header_->closed && header_->tail == header_->head)
+        Wait(alive);
+      if (header_->tail == header_->head)
+        {
+          Unlock();
+          return false;
+        }
+      size_t offset = header_->head % header_->capacity;
+      size_t count = std::min(n, std::min(size_t(header_->tail - header_->head),
+                                          header_->capacity - offset));
+      memcpy(to, data_ + offset, count);
+      header_->head += count;
+      to += count;
+      n -= count;
+      pthread_cond_broadcast(&header_->changed);
+    }
+  Unlock();
+  return true;
+}
+
+bool
+I3SharedRing::WriteMessage(boost::uint32_t kind, const char* body, size_t n,
+                           const alive_t& alive)
+{
+  boost::uint64_t length = n;
+  return Write(&kind, sizeof(kind), alive) &&
+    Write(&length, sizeof(length), alive) &&
+    Write(body, n, alive);
+}
+
+bool
+I3SharedRing::ReadMessage(boost::uint32_t& kind, std::vector<char>& body,
+                          const alive_t& alive)
+{
+  boost::uint64_t length;
+  if (!Read(&kind, sizeof(kind), alive) ||
+      !Read(&length, sizeof(length), alive))
+    return false;
+  body.resize(length);
+  return length == 0 || Read(&body[0], length, alive);
+}
+
+void
+I3SharedRing::Close()
+{
+  Lock();
+  header_->closed = true;
+  pthread_cond_broadcast(&header_->changed);
+  Unlock();
+}
+
+bool
+I3SharedRing::Closed() const
+{
+  Lock();
+  bool closed = header_->closed;
+  Unlock();
+  return closed;
+}
@@ -0,0 +1,61 @@
+#ifndef ICETRAY_I3SHAREDRING_H_INCLUDED
+#define ICETRAY_I3SHAREDRING_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+
+/**
+ * A byte pipe between two processes: a ring buffer in anonymous shared
+ * memory, made before fork() and used by one writer and one reader on
+ * either side of it.  Writes and reads of any size block until done,
+ * so messages larger than the ring stream through it.
+ *
+ * Either side can Close() the ring, after which writes fail and reads
+ * fail once the ring is empty.  A reader or writer waiting on a peer
+ * that may have died passes a check that is called every so often
+ * while it waits; if that returns false, the ring is closed.
+ */
+class I3SharedRing
+{
+ public:
+  typedef boost::function<bool ()> alive_t;
+
+  explicit I3SharedRing(size_t capacity);
+  ~I3SharedRing();
+
+  /// Copy @a n bytes in; false if the ring was closed first.
+  bool Write(const void* data, size_t n, const alive_t& alive = alive_t());
+  /// Copy @a n bytes out; false if the ring was closed first.
+  bool Read(void* data, size_t n, const alive_t& alive = alive_t());
+
+  /// A message: @a kind, then the length of @a body, then @a body.
+  bool WriteMessage(boost::uint32_t kind, const char* body, size_t n,
+                    const alive_t& alive = alive_t());
+  bool ReadMessage(boost::uint32_t& kind, std::vector<char>& body,
+                   const alive_t& alive = alive_t());
+
+  void Close();
+  bool Closed() const;
+
+ private:
+  I3SharedRing(const I3SharedRing&);
+  I3SharedRing& operator=(const I3SharedRing&);
+
+  struct Header;
+  void Lock() const;
+  void Unlock() const;
+  /// Check what locking the mutex returned, recovering it if its owner
+  /// died.
+  void Locked(int err) const;
+  /// Wait a little for the other side; closes the ring if @a alive
+  /// says the other side is gone.
+  void Wait(const alive_t& alive);
+
+  Header* header_;
+  char* data_;
+  size_t mapped_;
+};
+
+#endif
@@ -0,0 +1,102 @@
+#include <icetray/I3ThreadPool.h>
+
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+bool
+I3ThreadPool::Task::Done() const
+{
+  boost::lock_guard<boost::mutex> lock(mtx_);
+  return state_ == Finished;
+}
+
+void
+I3ThreadPool::Task::Run()
+{
+  {
+    boost::lock_guard<boost::mutex> lock(mtx_);
+    if (state_ != Queued)
+      return;
+    state_ = Running;
+  }
+
+  std::exception_ptr error;
+  try {
+    f_();
+  } catch (...) {
+    error = std::current_exception();
+  }
+
+  boost::lock_guard<boost::mutex> lock(mtx_);
+  error_ = error;
+  f_.clear();
+  state_ = Finished;
+  done_.notify_all();
+}
+
+void
+I3ThreadPool::Task::Wait()
+{
+  Run();
+
+  boost::unique_lock<boost::mutex> lock(mtx_);
+  while (state_ != Finished)
+    done_.wait(lock);
+  if (error_)
+    std::rethrow_exception(error_);
+}
+
+I3ThreadPool::I3ThreadPool(unsigned nthreads) : stopping_(false)
+{
+  for (unsigned i = 0; i < nthreads; i++)
+    threads_.push_back(boost::make_shared<boost::thread>(
+        boost::bind(&I3ThreadPool::Work, this)));
+}
+
+I3ThreadPool::~I3ThreadPool()
+{
+  {
+    boost::lock_guard<boost::mutex> lock(mtx_);
+    stopping_ = true;
+  }
+  wakeup_.notify_all();
+  for (unsigned i = 0; i < threads_.size(); i++)
+    threads_[i]->join();
+}
+
+I3ThreadPool::TaskPtr
+I3ThreadPool::Submit(const boost::function<void ()>& f)
+{
+  TaskPtr task(new Task(f));
+  if (threads_.empty())
+    {
+      task->Run();
+      return task;
+    }
+
+  {
+    boost::lock_guard<boost::mutex> lock(mtx_);
+    queue_.push_back(task);
+  }
+  wakeup_.notify_one();
+  return task;
+}
+
+void
+I3ThreadPool::Work()
+{
+  for (;;)
+    {
+      TaskPtr task;
+      {
+        boost::unique_lock<boost::mutex> lock(mtx_);
+        while (queue_.empty() && !stopping_)
+          wakeup_.wait(lock);
+        if (queue_.empty())
+          return;
+        task = queue_.front();
+        queue_.pop_front();
+      }
+      task->Run();
+    }
+}
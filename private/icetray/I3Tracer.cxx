@@ -0,0 +1,176 @@
+#include <icetray/I3Tracer.h>
+#include <icetray/I3Logging.h>
+
+#include <cstdio>
+#include <fstream>
+#include <vector>
+#include <time.h>
+#include <unistd.h>
+#include <boost/foreach.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+boost::atomic<bool> I3Tracer::enabled_(false);
+
+namespace {
+  struct Event
+  {
+    const char* category;
+    std::string name;
+    char stop;
+    boost::int64_t seq;
+    boost::uint64_t start, end;
+  };
+
+  struct Buffer
+  {
+    unsigned tid;
+    std::vector<Event> events;
+  };
+  typedef boost::shared_ptr<Buffer> BufferPtr;
+
+  // every thread's buffer, kept after the thread is gone
+  boost::mutex buffers_mtx;
+  std::vector<BufferPtr> buffers;
+  boost::uint64_t origin = 0;
+
+  void leave(Buffer*) { }
+  boost::thread_specific_ptr<Buffer> local(&leave);
+
+  Buffer&
+  local_buffer()
+  {
+    if (!local.get())
+      {
+        BufferPtr buffer = boost::make_shared<Buffer>();
+        boost::mutex::scoped_lock lock(buffers_mtx);
+        buffer->tid = buffers.size();
+        buffers.push_back(buffer);
+        local.reset(buffer.get());
+      }
+    return *local;
+  }
+
+  void
+  write_string(std::ostream& os, const std::string& s)
+  {
+    os << '"';
+    BOOST_FOREACH(char c, s)
+      {
+        if (c == '"' || c == '\\')
+          os << '\\' << c;
+        else if ((unsigned char)c < 0x20)
+          {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+            os << escaped;
+          }
+        else
+          os << c;
+      }
+    os << '"';
+  }
+
+  void
+  write_us(std::ostream& os, boost::uint64_t ns)
+  {
+    char us[32];
+    snprintf(us, sizeof(us), "%llu.%03u", (unsigned long long)(ns / 1000),
+             unsigned(ns % 1000));
+    os << us;
+  }
+}
+
+boost::uint64_t
+I3Tracer::Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return boost::uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void
+I3Tracer::Start()
+{
+  {
+    boost::mutex::scoped_lock lock(buffers_mtx);
+    BOOST_FOREACH(BufferPtr buffer, buffers)
+      buffer->events.clear();
+    origin = Now();
+  }
+  enabled_.store(true, boost::memory_order_release);
+}
+
+void
+I3Tracer::Stop()
+{
+  enabled_.store(false, boost::memory_order_release);
+}
+
+void
+I3Tracer::Record(const char* category, const std::string& name, char stop,
+                 boost::int64_t seq, boost::uint64_t start, boost::uint64_t end)
+{
+  Buffer& buffer = local_buffer();
+  buffer.events.push_back(Event());
+  Event& event = buffer.events.back();
+  event.category = category;
+  event.name = name;
+  event.stop = stop;
+  event.seq = seq;
+  event.start = start;
+  event.end = end;
+}
+
+void
+I3Tracer::Write(const std::string& path)
+{
+  std::ofstream os(path.c_str());
+  if (!os)
+    log_fatal("Could not open trace file \"%s\"", path.c_str());
+
+  const int pid = getpid();
+  os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+  os << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+     << ",\"args\":{\"name\":\"icetray\"}}";
+
+  boost::mutex::scoped_lock lock(buffers_mtx);
+  size_t nevents = 0;
+  BOOST_FOREACH(BufferPtr buffer, buffers)
+    {
+      os << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+         << ",\"tid\":" << buffer->tid << ",\"args\":{\"name\":\"thread "
+         << buffer->tid << "\"}}";
+
+      BOOST_FOREACH(const Event& event, buffer->events)
+        {
+          os << ",\n{\"name\":";
+          write_string(os, event.name);
+          os << ",\"cat\":\"" << event.category << "\",\"ph\":\"X\",\"ts\":";
+          write_us(os, event.start > origin ? event.start - origin : 0);
+          os << ",\"dur\":";
+          write_us(os, event.end - event.start);
+          os << ",\"pid\":" << pid << ",\"tid\":" << buffer->tid;
+          if (event.stop || event.seq >= 0)
+            {
+              os << ",\"args\":{";
+              if (event.stop)
+                {
+                  os << "\"stop\":";
+                  write_string(os, std::string(1, event.stop));
+                }
+              if (event.seq >= 0)
+                os << (event.stop ? "," : "") << "\"seq\":" << event.seq;
+              os << '}';
+            }
+          os << '}';
+        }
+      nevents += buffer->events.size();
+    }
+  os << "\n]}\n";
+  if (!os)
+    log_fatal("Could not write trace file \"%s\"", path.c_str());
+  log_info("Wrote %zu trace events to %s", nevents, path.c_str());
+}
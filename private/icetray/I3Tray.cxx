@@ -28,6 +28,9 @@
 #include <iostream>
 #include <exception>
 #include <deque>
+#include <set>
+#include <algorithm>
+#include <sstream>
 
 #include <boost/python.hpp>
 #include <boost/foreach.hpp>
@@ -39,12 +42,21 @@
 #include <icetray/I3OpNewServiceFactory.h>
 #include <icetray/I3Context.h>
 #include <icetray/I3Frame.h>
+#include <icetray/I3FrameMixing.h>
 #include <icetray/I3PhysicsUsage.h>
+#include <icetray/I3ThreadPool.h>
 #include <icetray/serialization.h>
 #include <icetray/memory.h>
 
 #include "PythonFunction.h"
 #include "FunctionModule.h"
+#include "I3PhysicsWorkers.h"
+#include "I3ProcessWorkers.h"
+#include <icetray/I3Tracer.h>
+#include <icetray/open.h>
+#include "I3MetricsServer.h"
+#include "I3PipelineStage.h"
+#include "I3Scheduler.h"
 
 using namespace std;
 
@@ -77,6 +89,44 @@ I3Tray::die_messily(int sig)
 
 I3Tray *executing_tray = NULL;
 
+volatile sig_atomic_t I3Tray::snapshot_requested;
+
+void
+I3Tray::request_snapshot(int sig)
+{
+	snapshot_requested = 1;
+}
+
+namespace {
+	// Handles a signal that has no handler yet for as long as it is in
+	// scope, then puts the old action back, so that a signal after the
+	// tray is done doesn't go to a handler nothing reads any more.
+	class scoped_handler {
+	public:
+		scoped_handler(int sig, void (*handler)(int))
+		    : sig_(sig), installed_(false)
+		{
+			sigaction(sig, NULL, &oldact_);
+			if (oldact_.sa_handler == SIG_DFL) {
+				signal(sig, handler);
+				installed_ = true;
+			}
+		}
+		~scoped_handler()
+		{
+			if (installed_)
+				sigaction(sig_, &oldact_, NULL);
+		}
+	private:
+		scoped_handler(const scoped_handler&);
+		scoped_handler& operator=(const scoped_handler&);
+
+		int sig_;
+		struct sigaction oldact_;
+		bool installed_;
+	};
+}
+
 void
 I3Tray::report_usage(int sig)
 {
@@ -94,8 +144,8 @@ I3Tray::report_usage(int sig)
 	BOOST_FOREACH(const name_pair &pair, inorder) {
 		const string &name = pair.second;
 		const I3PhysicsUsage &ru = mru[pair.second];
-		log_info("%40s: %6u calls to daq + physics %9.2fs user %9.2fs system",
-		    name.c_str(), ru.ncall, ru.usertime, ru.systime);
+		log_info("%40s: %6u calls to daq + physics %9.2fs user",
+		    name.c_str(), ru.ncall, ru.usertime);
 		if ((acc_time += ru.usertime)/total_time > 0.9)
 			break;
 	}
@@ -105,10 +155,14 @@ void noOpDeleter(I3Tray*){}
 
 I3Tray::I3Tray() :
     boxes_connected(false), configure_called(false),
-    execute_called(false), suspension_requested(false)
+    execute_called(false), suspension_requested(false),
+    thread_pool_size(0), physics_workers(0), stage_queue_size(16),
+    fifo_capacity(I3FrameFifo::DefaultCapacity), fifo_highwater(0),
+    batch_size(0), worker_processes(0)
 {
 	memory::set_label("I3Tray");
 	master_context.Put(boost::shared_ptr<I3Tray>(this,noOpDeleter),"I3Tray");
+	master_context.Put(boost::make_shared<I3FrameSnapshots>(), "I3FrameSnapshots");
 	// Note that the following is deeply unsafe, but necessary for
 	// tray info service for now
 	master_context.Put(boost::shared_ptr<I3TrayInfoService>(new
@@ -333,12 +387,19 @@ I3Tray::Configure()
 		log_fatal("Calling %s with no modules added. "
 		    "You probably want some.", __PRETTY_FUNCTION__);
 
+	if (thread_pool_size > 0) {
+		thread_pool = boost::make_shared<I3ThreadPool>(thread_pool_size);
+		master_context.Put(thread_pool, "I3ThreadPool");
+		log_debug("Started %u worker threads", thread_pool_size);
+	}
+
 	//
 	// Create the services in the order they were added.
 	//
 	BOOST_FOREACH(const string& objectname, factories_in_order) {
 		memory::set_label(objectname);
 		I3ServiceFactoryPtr factory = factories[objectname];
+		I3TraceScope trace("configure", objectname);
 		try {
 			factory->Configure();
 		} catch (...) {
@@ -367,6 +428,7 @@ I3Tray::Configure()
 	BOOST_FOREACH(const string& objectname, modules_in_order) {
 		memory::set_label(objectname);
 		I3ModulePtr module = modules[objectname];
+		I3TraceScope trace("configure", objectname);
 		try {
 			module->Configure_();
 		} catch (...) {
@@ -423,6 +485,65 @@ I3Tray::Configure()
 		log_fatal("No driving module! Have you set up a circular "
 		    "tray?");
 
+	vector<I3ModulePtr> all;
+	BOOST_FOREACH(const std::string &modname, modules_in_order) {
+		modules[modname]->SetFifoLimits(fifo_capacity,
+		    fifo_highwater);
+		all.push_back(modules[modname]);
+	}
+	BOOST_FOREACH(const std::string &modname, stage_starts) {
+		if (modules.find(modname) == modules.end())
+			log_fatal("Cannot start a stage at \"%s\": there is no "
+			    "such module", modname.c_str());
+		I3PipelineStage::Install(modules[modname], all,
+		    stage_queue_size, batch_size, master_context);
+	}
+
+	if (worker_processes > 0) {
+		// the thread pool is already running, and its threads
+		// wouldn't survive the fork()
+		if (!stage_starts.empty() || physics_workers > 0 ||
+		    thread_pool_size > 0)
+			log_fatal("Worker processes cannot be combined with "
+			    "pipeline stages, physics workers or a thread "
+			    "pool");
+		if (modules.find(workers_first) == modules.end() ||
+		    modules.find(workers_last) == modules.end())
+			log_fatal("Cannot run \"%s\" to \"%s\" in worker "
+			    "processes: there is no such module",
+			    workers_first.c_str(), workers_last.c_str());
+		I3ProcessWorkers::Install(modules[workers_first],
+		    modules[workers_last], all, worker_processes, batch_size,
+		    master_context)->SetFifoLimits(fifo_capacity,
+		    fifo_highwater);
+	}
+
+	if (physics_workers > 0) {
+		physics_pool = boost::make_shared<I3ThreadPool>(physics_workers);
+		if (I3PhysicsWorkers::Install(driving_module, physics_pool,
+		    master_context) == 0)
+			log_warn("Physics workers requested, but no modules "
+			    "in line after the driving module can use them");
+	}
+
+	scheduler = boost::make_shared<I3Scheduler>(driving_module,
+	    batch_size);
+
+	// Deserialize whatever any module asked for as soon as the
+	// driving module emits a frame.
+	if (thread_pool) {
+		std::set<std::string> keys;
+		BOOST_FOREACH(const std::string &modname, modules_in_order) {
+			const vector<string> &modkeys =
+			    modules[modname]->GetPrefetchKeys();
+			keys.insert(modkeys.begin(), modkeys.end());
+		}
+		if (!keys.empty())
+			driving_module->PrefetchOnPush(
+			    vector<string>(keys.begin(), keys.end()),
+			    thread_pool);
+	}
+
 	// check that all parameters set in steering file were
 	// AddParametered and GetParametered, that all modules not the
 	// driving module have an inbox, and that every outbox is connected
@@ -469,30 +590,83 @@ I3Tray::Execute(unsigned maxCount)
 	}
 #endif
 
+	// as for SIGINFO, leave someone else's handler alone
+	snapshot_requested = 0;
+	scoped_handler snapshot_handler(SIGUSR1, request_snapshot);
+
+	if (!trace_file.empty())
+		I3Tracer::Start();
+
 	Configure();
 
+	// after Configure(), so that worker processes don't fork the
+	// server's thread
+	if (!metrics_address.empty())
+		metrics_server = boost::make_shared<I3MetricsServer>(metrics_address);
+
 	for (unsigned i=0;
              (i < maxCount) && !suspension_requested && !global_suspension_requested;
              i++) {
 		log_trace("%u/%u icetray dispatching Process_", i, maxCount);
-		driving_module->Do(&I3Module::Process_);
+		scheduler->Source();
+		if (scheduler->Ready())
+			scheduler->Drain();
+
+		if (metrics_server && metrics_server->Wanted())
+			metrics_server->Publish(Metrics());
+		if (snapshot_requested) {
+			snapshot_requested = 0;
+			log_notice("Metrics:\n%s", Metrics().c_str());
+		}
 	}
 
 	// call every module's Finish() function
 	// (this used to be in I3Tray::Finish())
-	if (modules_in_order.size() == 0 || !driving_module)
+	if (modules_in_order.size() == 0 || !driving_module) {
+		metrics_server.reset();
 		return;
+	}
 
 	log_notice("I3Tray finishing...");
 
-	driving_module->Do(&I3Module::Finish);
+	scheduler->Finish();
+
+	BOOST_FOREACH(const std::string& modname, modules_in_order) {
+		typedef std::map<std::string, I3FrameFifo::Stats> stats_t;
+		stats_t stats = modules[modname]->ReportFifos();
+		for (stats_t::const_iterator it = stats.begin();
+		    it != stats.end(); it++) {
+			if (it->second.stalls == 0 && it->second.highwater == 0)
+				continue;
+			log_info("%s: outbox %s was full %llu times and reached "
+			    "its high-water mark %llu times (at most %zu of "
+			    "%llu frames waiting)", modname.c_str(),
+			    it->first.c_str(),
+			    (unsigned long long)it->second.stalls,
+			    (unsigned long long)it->second.highwater,
+			    it->second.peak,
+			    (unsigned long long)it->second.pushed);
+		}
+	}
 
 	BOOST_FOREACH(const std::string& factname, factories_in_order) {
 		memory::set_label(factname);
 		log_trace("calling finish on factory %s", factname.c_str());
+		I3TraceScope trace("finish", factname);
 		factories[factname]->Finish();
 	}
 	memory::set_label("I3Tray");
+
+	// a last snapshot with the totals, for anyone still asking
+	if (metrics_server) {
+		metrics_server->Publish(Metrics());
+		metrics_server.reset();
+	}
+
+	if (!trace_file.empty()) {
+		I3Tracer::Stop();
+		I3Tracer::Write(trace_file);
+	}
 }
 
 map<string, I3PhysicsUsage>
@@ -512,6 +686,215 @@ I3Tray::Usage()
 }
 
 
+namespace {
+	std::string
+	label_value(const std::string &value)
+	{
+		std::string escaped;
+		BOOST_FOREACH(char c, value) {
+			if (c == '\\' || c == '"')
+				escaped += '\\';
+			if (c == '\n')
+				escaped += "\\n";
+			else
+				escaped += c;
+		}
+		return escaped;
+	}
+}
+
+std::string
+I3Tray::Metrics()
+{
+	typedef std::map<std::string, I3StreamUsage> streams_t;
+	typedef std::map<std::string, I3FrameFifo::Stats> fifos_t;
+	std::ostringstream os;
+	os.precision(9);
+
+	// frames the driving module pushed, by stream
+	os << "# TYPE icetray_frames_total counter\n";
+	if (driving_module) {
+		typedef std::map<std::string, boost::uint64_t> pushed_t;
+		pushed_t pushed = driving_module->ReportPushes();
+		BOOST_FOREACH(const pushed_t::value_type &p, pushed)
+			os << "icetray_frames_total{stream=\"" <<
+			    label_value(p.first) << "\"} " << p.second << "\n";
+	}
+
+	std::map<std::string, I3PhysicsUsage> usage = Usage();
+	os << "# TYPE icetray_module_calls_total counter\n";
+	BOOST_FOREACH(const std::string &modname, modules_in_order) {
+		BOOST_FOREACH(const streams_t::value_type &s,
+		    usage[modname].streams)
+			os << "icetray_module_calls_total{module=\"" <<
+			    label_value(modname) << "\",stream=\"" <<
+			    label_value(s.first) << "\"} " << s.second.ncall << "\n";
+	}
+	os << "# TYPE icetray_module_wall_seconds_total counter\n";
+	BOOST_FOREACH(const std::string &modname, modules_in_order) {
+		BOOST_FOREACH(const streams_t::value_type &s,
+		    usage[modname].streams)
+			os << "icetray_module_wall_seconds_total{module=\"" <<
+			    label_value(modname) << "\",stream=\"" <<
+			    label_value(s.first) << "\"} " << s.second.walltime <<
+			    "\n";
+	}
+	os << "# TYPE icetray_module_cpu_seconds_total counter\n";
+	BOOST_FOREACH(const std::string &modname, modules_in_order)
+		os << "icetray_module_cpu_seconds_total{module=\"" <<
+		    label_value(modname) << "\"} " << usage[modname].usertime <<
+		    "\n";
+	os << "# TYPE icetray_module_latency_seconds summary\n";
+	BOOST_FOREACH(const std::string &modname, modules_in_order) {
+		const I3PhysicsUsage &ru = usage[modname];
+		const std::string module = label_value(modname);
+		os << "icetray_module_latency_seconds{module=\"" << module <<
+		    "\",quantile=\"0.5\"} " << ru.p50 << "\n";
+		os << "icetray_module_latency_seconds{module=\"" << module <<
+		    "\",quantile=\"0.99\"} " << ru.p99 << "\n";
+		os << "icetray_module_latency_seconds{module=\"" << module <<
+		    "\",quantile=\"1\"} " << ru.max << "\n";
+	}
+
+	std::map<std::string, fifos_t> fifos;
+	BOOST_FOREACH(const std::string &modname, modules_in_order)
+		fifos[modname] = modules[modname]->ReportFifos();
+	const char *fifo_metrics[][2] = {
+		{"icetray_queue_depth", "gauge"},
+		{"icetray_queue_peak", "gauge"},
+		{"icetray_queue_stalls_total", "counter"},
+		{"icetray_queue_pushed_total", "counter"},
+	};
+	for (unsigned m = 0; m < 4; m++) {
+		os << "# TYPE " << fifo_metrics[m][0] << " " <<
+		    fifo_metrics[m][1] << "\n";
+		BOOST_FOREACH(const std::string &modname, modules_in_order) {
+			BOOST_FOREACH(const fifos_t::value_type &f,
+			    fifos[modname]) {
+				unsigned long long value =
+				    m == 0 ? f.second.depth :
+				    m == 1 ? f.second.peak :
+				    m == 2 ? f.second.stalls : f.second.pushed;
+				os << fifo_metrics[m][0] << "{module=\"" <<
+				    label_value(modname) << "\",outbox=\"" <<
+				    label_value(f.first) << "\"} " << value <<
+				    "\n";
+			}
+		}
+	}
+
+	os << "# TYPE icetray_io_read_bytes_total counter\n";
+	os << "icetray_io_read_bytes_total " << I3::dataio::bytes_read() << "\n";
+	os << "# TYPE icetray_io_written_bytes_total counter\n";
+	os << "icetray_io_written_bytes_total " <<
+	    I3::dataio::bytes_written() << "\n";
+
+	typedef std::map<std::string, size_t> extents_t;
+	extents_t extents = memory::get_extents();
+	os << "# TYPE icetray_memory_bytes gauge\n";
+	BOOST_FOREACH(const extents_t::value_type &e, extents)
+		os << "icetray_memory_bytes{label=\"" << label_value(e.first) <<
+		    "\"} " << e.second << "\n";
+
+	return os.str();
+}
+
+void
+I3Tray::SetMetricsAddress(const std::string& address)
+{
+	if (execute_called)
+		log_fatal("I3Tray::Execute() already called -- "
+		    "cannot serve metrics");
+	metrics_address = address;
+}
+
+void
+I3Tray::SetThreadPoolSize(unsigned nthreads)
+{
+	if (configure_called)
+		log_fatal("I3Tray::Configure() already called -- "
+		    "cannot change the thread pool");
+	thread_pool_size = nthreads;
+}
+
+void
+I3Tray::SetPhysicsWorkers(unsigned nthreads)
+{
+	if (configure_called)
+		log_fatal("I3Tray::Configure() already called -- "
+		    "cannot change the physics workers");
+	physics_workers = nthreads;
+}
+
+void
+I3Tray::StartStage(const std::string& module)
+{
+	if (configure_called)
+		log_fatal("I3Tray::Configure() already called -- "
+		    "cannot add pipeline stages");
+	if (std::find(stage_starts.begin(), stage_starts.end(), module) !=
+	    stage_starts.end())
+		log_fatal("A stage already starts at \"%s\"", module.c_str());
+	stage_starts.push_back(module);
+}
+
+void
+I3Tray::SetStageQueueSize(unsigned nframes)
+{
+	if (configure_called)
+		log_fatal("I3Tray::Configure() already called -- "
+		    "cannot change the stage queue size");
+	stage_queue_size = nframes;
+}
+
+void
+I3Tray::SetFifoCapacity(unsigned nframes)
+{
+	if (configure_called)
+		log_fatal("I3Tray::Configure() already called -- "
+		    "cannot change the fifo capacity");
+	fifo_capacity = nframes;
+}
+
+void
+I3Tray::SetFifoHighWater(unsigned nframes)
+{
+	if (configure_called)
+		log_fatal("I3Tray::Configure() already called -- "
+		    "cannot change the fifo high-water mark");
+	fifo_highwater = nframes;
+}
+
+void
+I3Tray::SetBatchSize(unsigned nframes)
+{
+	if (configure_called)
+		log_fatal("I3Tray::Configure() already called -- "
+		    "cannot change the batch size");
+	batch_size = nframes;
+}
+
+void
+I3Tray::SetWorkerProcesses(unsigned nprocs, const std::string& first,
+    const std::string& last)
+{
+	if (configure_called)
+		log_fatal("I3Tray::Configure() already called -- "
+		    "cannot change the worker processes");
+	worker_processes = nprocs;
+	workers_first = first;
+	workers_last = last;
+}
+
+void
+I3Tray::SetTraceFile(const std::string& path)
+{
+	if (execute_called)
+		log_fatal("I3Tray::Execute() already called -- "
+		    "cannot start tracing");
+	trace_file = path;
+}
+
 void
 I3Tray::Finish()
 {
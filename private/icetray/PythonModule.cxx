@@ -30,6 +30,7 @@
 #include <icetray/PythonModule.h>
 #include <icetray/impl.h>
 #include <boost/python/import.hpp>
+#include <boost/python/stl_iterator.hpp>
 
 namespace bp = boost::python;
 template <typename Base>
@@ -277,6 +278,33 @@ PythonModule<Base>::Physics(I3FramePtr frame)
     Base::Physics(frame);
 }
 
+template <typename Base>
+void 
+PythonModule<Base>::PhysicsBatch(std::vector<I3FramePtr>& frames)
+{
+  i3_log("%s", __PRETTY_FUNCTION__);
+  if (bp::override batch = this->get_override("PhysicsBatch"))
+    {
+      bp::list pyframes;
+      for (std::vector<I3FramePtr>::const_iterator it = frames.begin();
+	   it != frames.end(); it++)
+	pyframes.append(*it);
+      batch(pyframes);
+    }
+  else
+    Base::PhysicsBatch(frames);
+}
+
+template <typename Base>
+void 
+PythonModule<Base>::PyPhysicsBatch(const bp::list& pyframes)
+{
+  std::vector<I3FramePtr> frames;
+  for (bp::ssize_t i = 0; i < bp::len(pyframes); i++)
+    frames.push_back(bp::extract<I3FramePtr>(pyframes[i]));
+  Base::PhysicsBatch(frames);
+}
+
 template <typename Base>
 I3FramePtr
 PythonModule<Base>::PopFrame()
@@ -305,6 +333,14 @@ PythonModule<Base>::RequestSuspension()
   return Base::RequestSuspension();
 }
 
+template <typename Base>
+void
+PythonModule<Base>::Prefetch(const bp::object& keys)
+{
+  Base::Prefetch(std::vector<std::string>(bp::stl_input_iterator<std::string>(keys),
+                                          bp::stl_input_iterator<std::string>()));
+}
+
 template <typename Base>
 void
 PythonModule<Base>::AddOutBox(const std::string& name)
@@ -74,12 +74,18 @@ struct PythonModule : Base, boost::python::wrapper<Base>
   bool ShouldDoPhysics(I3FramePtr frame);
   void Physics(I3FramePtr frame);
 
+  // a Python PhysicsBatch() gets the frames as a list
+  void PhysicsBatch(std::vector<I3FramePtr>& frames);
+  void PyPhysicsBatch(const boost::python::list& frames);
+
 
   void PushFrame(I3FramePtr frame);
   void PushFrame(I3FramePtr frame, const std::string& where);
 
   void RequestSuspension();
 
+  void Prefetch(const boost::python::object& keys);
+
   void AddOutBox(const std::string& name);
   I3FramePtr PopFrame();
 
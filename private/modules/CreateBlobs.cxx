@@ -23,10 +23,12 @@
 #include <icetray/I3Context.h>
 #include <icetray/I3Frame.h>
 #include <icetray/I3ConditionalModule.h>
+#include <icetray/I3ThreadPool.h>
 
 class CreateBlobs : public I3ConditionalModule
 {
   bool dropMemoryData_;
+  I3ThreadPoolPtr pool_;
 
  public:
   CreateBlobs(const I3Context& context)  : I3ConditionalModule(context)
@@ -39,6 +41,9 @@ class CreateBlobs : public I3ConditionalModule
   void Configure()
   {
     GetParameter("DropMemoryData", dropMemoryData_);
+    // serialize on the tray's worker threads, if it has any
+    if (context_.Has<I3ThreadPoolPtr>("I3ThreadPool"))
+      pool_ = context_.Get<I3ThreadPoolPtr>("I3ThreadPool");
   }
 
   void Process(){
@@ -48,7 +53,7 @@ class CreateBlobs : public I3ConditionalModule
 
     // Just force creation of all frame item blobs.
     // To the user this should look like a no-op.
-    frame->create_blobs(dropMemoryData_);
+    frame->create_blobs(dropMemoryData_, I3FrameKeyMatcher(), pool_.get());
 
     PushFrame(frame,"OutBox");
   }
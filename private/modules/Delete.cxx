@@ -98,18 +98,12 @@ void Delete::Process()
     {
       if (!iter->empty())
         {
-          I3Frame::typename_iterator jter = frame->typename_begin();
-          while (jter != frame->typename_end())
-            {
-              if (boost::starts_with(jter->first, *iter))
-                {
-                  frame->Delete((jter++)->first);
-                }
-              else
-                {
-                  ++jter;
-                }
-            }
+          // a copy of the keys: deleting changes the frame's table
+          vector<string> keys = frame->keys();
+          for (vector<string>::const_iterator key = keys.begin();
+               key != keys.end(); key++)
+            if (boost::starts_with(*key, *iter))
+              frame->Delete(*key);
         }
     }
 
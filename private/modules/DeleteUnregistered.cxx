@@ -62,12 +62,13 @@ void DeleteUnregistered::Process()
   I3FramePtr frame = PopFrame();
   
   vector<string> deleteme;
-  for (I3Frame::typename_iterator iter = frame->typename_begin();
-       iter != frame->typename_end();
+  vector<string> keys = frame->keys();
+  for (vector<string>::const_iterator iter = keys.begin();
+       iter != keys.end();
        iter++){
-    I3FrameObjectConstPtr fop = frame->Get<I3FrameObjectConstPtr>(iter->first);
-    if(!fop && frame->Has(iter->first))
-       deleteme.push_back(iter->first);
+    I3FrameObjectConstPtr fop = frame->Get<I3FrameObjectConstPtr>(*iter);
+    if(!fop)
+       deleteme.push_back(*iter);
   }
   for (unsigned i=0; i<deleteme.size(); i++)
     frame->Delete(deleteme[i]);
@@ -65,8 +65,7 @@ void Keep::Process()
 
   for(set<string>::const_iterator iter = keys_.begin(); iter != keys_.end(); ++iter)
   {
-    I3Frame::typename_iterator jter = frame->typename_find(*iter);
-    if(jter != frame->typename_end()) newFrame->take(*frame, *iter);
+    if(frame->Has(*iter)) newFrame->take(*frame, *iter);
   }
  
   PushFrame(newFrame, "OutBox"); 
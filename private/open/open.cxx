@@ -20,6 +20,9 @@
  *
  */
 #include <string>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
 
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
@@ -28,14 +31,20 @@
 #include <boost/iostreams/categories.hpp>
 #include <boost/iostreams/device/file.hpp>
 #include <boost/iostreams/device/file_descriptor.hpp>
+#include <boost/iostreams/positioning.hpp>
+#include <boost/iostreams/operations.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
 
 #include <icetray/I3Logging.h>
+#include <icetray/open.h>
 #include <icetray/counter64.hpp>
 
 #include "http_source.hpp"
 #include "socket_source.hpp"
 #include "zstd_filter.hpp"
+#include "readahead_source.hpp"
 
 #ifdef I3_WITH_LIBARCHIVE
 #include "archive_filter.hpp"
@@ -49,7 +58,81 @@ namespace I3 {
 
     namespace io = boost::iostreams;
 
+    namespace {
+      boost::atomic<uint64_t> read_total(0), written_total(0);
+      const std::streamsize read_block = 128*1024;
+
+      // threads for zstd compression: as asked, or from $I3_ZSTD_THREADS
+      unsigned zstd_threads(unsigned nthreads)
+      {
+        const char* env = getenv("I3_ZSTD_THREADS");
+        if (nthreads > 0 || !env)
+          return nthreads;
+        try {
+          nthreads = boost::lexical_cast<unsigned>(env);
+        } catch (const boost::bad_lexical_cast&) {
+          log_fatal("I3_ZSTD_THREADS=\"%s\" is not a number of threads", env);
+        }
+        return nthreads;
+      }
+
+      uint64_t read_le(const unsigned char* p, unsigned nbytes)
+      {
+        uint64_t value = 0;
+        for (unsigned i = nbytes; i-- > 0; )
+          value = (value << 8) | p[i];
+        return value;
+      }
+    }
+
+    uint64_t bytes_read() { return read_total.load(boost::memory_order_relaxed); }
+    uint64_t bytes_written() { return written_total.load(boost::memory_order_relaxed); }
+
+    static void open_chain(io::filtering_istream& ifs, const std::string& filename);
+
     void open(io::filtering_istream& ifs, const std::string& filename)
+    {
+      const char* env = getenv("I3_READAHEAD");
+      if (!env) {
+        open_chain(ifs, filename);
+        return;
+      }
+      unsigned nbuffers = 0;
+      try {
+        nbuffers = boost::lexical_cast<unsigned>(env);
+      } catch (const boost::bad_lexical_cast&) {
+        log_fatal("I3_READAHEAD=\"%s\" is not a number of buffers", env);
+      }
+      if (nbuffers == 0)
+        open_chain(ifs, filename);
+      else
+        open_readahead(ifs, filename, nbuffers);
+    }
+
+    void open_readahead(io::filtering_istream& ifs, const std::string& filename,
+                        unsigned nbuffers, size_t buffer_size)
+    {
+      // nothing to gain on a live stream, and a reading thread blocked
+      // on one could not be stopped
+      if (filename.find("socket://") == 0 || filename.find("http://") == 0) {
+        open_chain(ifs, filename);
+        return;
+      }
+
+      // errors opening the file come from here, not the reading thread
+      boost::shared_ptr<io::filtering_istream> upstream =
+        boost::make_shared<io::filtering_istream>();
+      open_chain(*upstream, filename);
+
+      if (!ifs.empty())
+        ifs.pop();
+      ifs.reset();
+      ifs.push(readahead_source(upstream, nbuffers, buffer_size), read_block);
+      log_debug("Reading %s %u buffers ahead", filename.c_str(), nbuffers);
+    }
+
+    // open() without read-ahead
+    static void open_chain(io::filtering_istream& ifs, const std::string& filename)
     {
       if (!ifs.empty())
         ifs.pop();
@@ -77,10 +160,13 @@ namespace I3 {
       }
 #endif
       if (ends_with(filename,".zst")){
-        ifs.push(zstd_decompressor());
+        ifs.push(zstd_decompressor(), zstd_decompressor::buffer_size());
         log_trace("Input file ends in .zst. Using zstd decompressor.");
 	  }
 
+      // whole blocks, rather than the default few bytes at a time, for
+      // the filters above
+      ifs.push(io::counter64(0, &read_total), read_block);
       if (filename.find("socket://") == 0) {
         boost::iostreams::file_descriptor_source fs = create_socket_source(filename);
         ifs.push(fs);
@@ -91,16 +177,102 @@ namespace I3 {
         if (!fs.is_open())
         log_fatal("problems opening file '%s' for reading.  Check permissions, paths.",
 		    filename.c_str());
-        ifs.push(fs);
+        ifs.push(fs, read_block);
       }
 
       log_debug("Opened file %s", filename.c_str());
     }
 
+    namespace {
+      // Start decompressing a seekable .zst file at the last zstd frame
+      // that begins at or before offset, and read up to offset from there.
+      void open_seek_point(io::filtering_istream& ifs, const std::string& filename,
+                           const std::vector<seek_point>& table, uint64_t offset)
+      {
+        size_t i = table.size() - 1;
+        while (i > 0 && table[i].uncompressed > offset)
+          i--;
+
+        if (!ifs.empty())
+          ifs.pop();
+        ifs.reset();
+        io::file_source fs(filename);
+        if (!fs.is_open())
+          log_fatal("problems opening file '%s' for reading.  Check permissions, paths.",
+                    filename.c_str());
+        if (io::seek(fs, table[i].compressed, std::ios_base::beg) !=
+            std::streampos(table[i].compressed))
+          log_fatal("problems seeking to offset %llu in '%s'",
+                    (unsigned long long)table[i].compressed, filename.c_str());
+        ifs.push(zstd_decompressor(), zstd_decompressor::buffer_size());
+        ifs.push(io::counter64(0, &read_total), read_block);
+        ifs.push(fs, read_block);
+
+        char buf[65536];
+        for (uint64_t left = offset - table[i].uncompressed; left > 0 && ifs.good(); ) {
+          std::streamsize n = std::min<uint64_t>(left, sizeof(buf));
+          ifs.read(buf, n);
+          left -= ifs.gcount();
+        }
+        if (!ifs.good())
+          log_fatal("'%s' ends before offset %llu", filename.c_str(),
+                    (unsigned long long)offset);
+        log_debug("Opened file %s at offset %llu, from seek point %zu",
+                  filename.c_str(), (unsigned long long)offset, i);
+      }
+    }
+
+    void open(io::filtering_istream& ifs, const std::string& filename,
+              uint64_t offset)
+    {
+      bool plain = !(ends_with(filename,".gz") || ends_with(filename,".bz2") ||
+                     ends_with(filename,".zst") || filename.find("://") != string::npos);
+#ifdef I3_WITH_LIBARCHIVE
+      plain = plain && ends_with(filename,".i3");
+#endif
+      std::vector<seek_point> table;
+      if (!plain && offset > 0)
+        table = seek_table(filename);
+      if (!table.empty()) {
+        open_seek_point(ifs, filename, table, offset);
+        return;
+      }
+      if (!plain || offset == 0) {
+        open(ifs, filename);
+        char buf[65536];
+        for (uint64_t left = offset; left > 0 && ifs.good(); ) {
+          std::streamsize n = std::min<uint64_t>(left, sizeof(buf));
+          ifs.read(buf, n);
+          left -= ifs.gcount();
+        }
+        if (!ifs.good())
+          log_fatal("'%s' ends before offset %llu", filename.c_str(),
+                    (unsigned long long)offset);
+        return;
+      }
+
+      if (!ifs.empty())
+        ifs.pop();
+      ifs.reset();
+      io::file_source fs(filename);
+      if (!fs.is_open())
+        log_fatal("problems opening file '%s' for reading.  Check permissions, paths.",
+                  filename.c_str());
+      if (io::seek(fs, offset, std::ios_base::beg) != std::streampos(offset))
+        log_fatal("problems seeking to offset %llu in '%s'",
+                  (unsigned long long)offset, filename.c_str());
+      ifs.push(io::counter64(0, &read_total));
+      ifs.push(fs);
+
+      log_debug("Opened file %s at offset %llu", filename.c_str(),
+                (unsigned long long)offset);
+    }
+
     void open(io::filtering_ostream& ofs,
 	      const std::string& filename,
 	      int compression_level,
-	      std::ios::openmode mode)
+	      std::ios::openmode mode,
+	      unsigned nthreads)
     {
       if (!ofs.empty())
         ofs.pop();
@@ -119,12 +291,12 @@ namespace I3 {
       }else if (ends_with(filename,".zst")){
         if(compression_level<=0)
           compression_level=4;
-        ofs.push(zstd_compressor(compression_level));
+        ofs.push(zstd_compressor(compression_level, zstd_threads(nthreads)));
         log_trace("Output file ends in .zst. Using zstd decompressor.");
       }else{
         log_trace("Output file doesn't end in .gz or .bz2.  Not decompressing.");
       }
-      ofs.push(io::counter64());
+      ofs.push(io::counter64(0, &written_total));
 
       io::file_sink fs(filename, mode);
       if (!fs.is_open())
@@ -133,5 +305,112 @@ namespace I3 {
       ofs.push(fs);
     }
 
+    void open_seekable(io::filtering_ostream& ofs,
+                       const std::string& filename,
+                       unsigned frames_per_seek,
+                       uint64_t bytes_per_seek,
+                       int compression_level,
+                       unsigned nthreads)
+    {
+      if (!ends_with(filename,".zst"))
+        log_fatal("'%s' doesn't end in .zst; only zstd files can be seekable.",
+                  filename.c_str());
+      if (frames_per_seek == 0 && bytes_per_seek == 0)
+        log_fatal("Seekable output needs a number of frames or bytes per seek point");
+      if (!ofs.empty())
+        ofs.pop();
+      ofs.reset();
+
+      if(compression_level<=0)
+        compression_level=4;
+      ofs.push(zstd_compressor(compression_level, zstd_threads(nthreads),
+                               frames_per_seek, bytes_per_seek));
+      ofs.push(io::counter64(0, &written_total));
+
+      io::file_sink fs(filename, std::ios::binary);
+      if (!fs.is_open())
+        log_fatal("Fatal error opening output file '%s'.  Check permissions, paths, etc.",
+		  filename.c_str());
+      ofs.push(fs);
+    }
+
+    void mark_frame(io::filtering_ostream& ofs, char stop)
+    {
+      if (ofs.empty())
+        return;
+      zstd_compressor* z = ofs.component<zstd_compressor>(0);
+      if (!z || !z->seekable())
+        return;
+      // push everything before the boundary into the compressor
+      ofs.flush();
+      z->markFrame(stop);
+    }
+
+    const uint64_t seek_point::npos;
+
+    std::vector<seek_point> seek_table(const std::string& filename)
+    {
+      std::vector<seek_point> table;
+      if (!ends_with(filename,".zst") || filename.find("://") != string::npos)
+        return table;
+      std::ifstream ifs(filename.c_str(), std::ios::binary);
+      if (!ifs.is_open())
+        return table;
+
+      ifs.seekg(0, std::ios::end);
+      uint64_t size = ifs.tellg();
+      unsigned char footer[zstd_seek::footer_size];
+      if (size < 8 + zstd_seek::footer_size ||
+          !ifs.seekg(size - zstd_seek::footer_size) ||
+          !ifs.read((char*)footer, sizeof(footer)) ||
+          read_le(footer + 4, 4) != zstd_seek::table_magic)
+        return table;
+
+      uint64_t n = read_le(footer, 4);
+      uint64_t table_size = n*zstd_seek::entry_size + zstd_seek::footer_size;
+      if (n == 0 || size < 8 + table_size)
+        return table;
+      std::vector<unsigned char> buf(8 + n*zstd_seek::entry_size);
+      if (!ifs.seekg(size - table_size - 8) ||
+          !ifs.read((char*)&buf[0], buf.size()) ||
+          read_le(&buf[0], 4) != zstd_seek::skippable_magic ||
+          read_le(&buf[4], 4) != table_size) {
+        log_warn("'%s' has a damaged seek table; ignoring it", filename.c_str());
+        return table;
+      }
+      for (uint64_t i = 0; i < n; i++) {
+        const unsigned char* entry = &buf[8 + i*zstd_seek::entry_size];
+        seek_point point;
+        point.compressed = read_le(entry, 8);
+        point.uncompressed = read_le(entry + 8, 8);
+        point.frame = read_le(entry + 16, 8);
+        point.stop = entry[24];
+        table.push_back(point);
+      }
+      return table;
+    }
+
+    mapped_file_ptr open_mapped(const std::string& filename)
+    {
+      if (ends_with(filename,".gz") || ends_with(filename,".bz2") ||
+          ends_with(filename,".zst") || filename.find("://") != string::npos)
+        log_fatal("'%s' is compressed or remote; only plain .i3 files can be mapped.",
+                  filename.c_str());
+
+      boost::shared_ptr<io::mapped_file_source> file;
+      try {
+        file.reset(new io::mapped_file_source(filename));
+      } catch (const std::exception& e) {
+        log_fatal("problems mapping file '%s' for reading: %s",
+                  filename.c_str(), e.what());
+      }
+      if (!file->is_open())
+        log_fatal("problems mapping file '%s' for reading.  Check permissions, paths.",
+                  filename.c_str());
+
+      log_debug("Mapped file %s (%zu bytes)", filename.c_str(), file->size());
+      return file;
+    }
+
   } // namespace dataio
 }  //  namespace I3
@@ -0,0 +1,130 @@
+#include <cstring>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+#include <icetray/I3Logging.h>
+#include "readahead_source.hpp"
+
+readahead_source::readahead_source(
+    boost::shared_ptr<boost::iostreams::filtering_istream> upstream,
+    unsigned nbuffers, size_t buffer_size)
+  : state_(boost::make_shared<state>(upstream, nbuffers, buffer_size))
+{ }
+
+std::streamsize
+readahead_source::read(char *s, std::streamsize size)
+{
+  return state_->read(s, size);
+}
+
+readahead_source::state::state(
+    boost::shared_ptr<boost::iostreams::filtering_istream> upstream,
+    unsigned nbuffers, size_t buffer_size)
+  : upstream_(upstream), buffer_size_(buffer_size),
+    eof_(false), stopping_(false), current_(0), pos_(0), have_current_(false)
+{
+  if (nbuffers < 2)
+    nbuffers = 2;
+  buffers_.resize(nbuffers);
+  for (size_t i = 0; i < nbuffers; i++)
+    free_.push_back(i);
+  thread_ = boost::thread(boost::bind(&state::run, this));
+}
+
+readahead_source::state::~state()
+{
+  {
+    boost::mutex::scoped_lock lock(mtx_);
+    stopping_ = true;
+    changed_.notify_all();
+  }
+  thread_.join();
+}
+
+void
+readahead_source::state::run()
+{
+  try {
+    for (;;) {
+      size_t b;
+      {
+        boost::mutex::scoped_lock lock(mtx_);
+        while (free_.empty() && !stopping_)
+          changed_.wait(lock);
+        if (stopping_)
+          return;
+        b = free_.front();
+        free_.pop_front();
+      }
+
+      // Fill the whole buffer: a decompressor hands out a little at a
+      // time, so readsome() would leave it mostly empty.  A short read
+      // is the end of the stream.
+      std::vector<char>& buffer = buffers_[b];
+      buffer.resize(buffer_size_);
+      std::streamsize got = 0;
+      while (got < std::streamsize(buffer.size()) && upstream_->good()) {
+        upstream_->read(&buffer[got], buffer.size() - got);
+        got += upstream_->gcount();
+      }
+      buffer.resize(got);
+      if (upstream_->bad() || (upstream_->fail() && !upstream_->eof()))
+        log_fatal("Read error while reading ahead");
+      bool done = !upstream_->good();
+
+      boost::mutex::scoped_lock lock(mtx_);
+      if (buffer.empty())
+        free_.push_back(b);
+      else
+        filled_.push_back(b);
+      eof_ = done;
+      changed_.notify_all();
+      if (done)
+        return;
+    }
+  } catch (...) {
+    boost::mutex::scoped_lock lock(mtx_);
+    error_ = std::current_exception();
+    changed_.notify_all();
+  }
+}
+
+std::streamsize
+readahead_source::state::read(char *s, std::streamsize size)
+{
+  std::streamsize result = 0;
+  while (result < size) {
+    if (have_current_ && pos_ < buffers_[current_].size()) {
+      std::streamsize n = std::min<std::streamsize>(size - result,
+          buffers_[current_].size() - pos_);
+      memcpy(s + result, &buffers_[current_][pos_], n);
+      pos_ += n;
+      result += n;
+      continue;
+    }
+
+    boost::mutex::scoped_lock lock(mtx_);
+    // hand the used-up buffer back to be filled again
+    if (have_current_) {
+      free_.push_back(current_);
+      have_current_ = false;
+      changed_.notify_all();
+    }
+    // return what we have rather than wait for more
+    if (result > 0 && filled_.empty())
+      break;
+    while (filled_.empty() && !eof_ && !error_)
+      changed_.wait(lock);
+    if (filled_.empty()) {
+      if (error_)
+        std::rethrow_exception(error_);
+      break;
+    }
+    current_ = filled_.front();
+    filled_.pop_front();
+    pos_ = 0;
+    have_current_ = true;
+  }
+  return result > 0 ? result : -1;
+}
@@ -0,0 +1,67 @@
+#ifndef READAHEAD_SOURCE_HPP
+#define READAHEAD_SOURCE_HPP
+
+#include <deque>
+#include <exception>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/iostreams/categories.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+/**
+ * A source that reads another stream -- typically a file under a
+ * decompressor -- on a thread of its own, filling up to nbuffers
+ * buffers ahead of whoever reads from it, each with what one read of
+ * the stream gives, up to buffer_size bytes.  Reading and decompressing
+ * then overlap with what the reader does with the data.  Errors on the
+ * reading thread are thrown from read().
+ */
+struct readahead_source{
+  typedef char char_type;
+  typedef boost::iostreams::source_tag category;
+
+  readahead_source(boost::shared_ptr<boost::iostreams::filtering_istream> upstream,
+                   unsigned nbuffers, size_t buffer_size);
+
+  std::streamsize read(char *s, std::streamsize size);
+
+  class state;
+  boost::shared_ptr<state> state_;
+};
+
+class readahead_source::state{
+ public:
+  state(boost::shared_ptr<boost::iostreams::filtering_istream> upstream,
+        unsigned nbuffers, size_t buffer_size);
+  ~state();
+
+  std::streamsize read(char *s, std::streamsize size);
+
+ private:
+  state(const state&);
+  state& operator=(const state&);
+
+  void run();
+
+  boost::shared_ptr<boost::iostreams::filtering_istream> upstream_;
+  size_t buffer_size_;
+  std::vector<std::vector<char> > buffers_;
+
+  boost::mutex mtx_;
+  boost::condition_variable changed_;
+  // indices into buffers_: ready to fill, and filled in order
+  std::deque<size_t> free_, filled_;
+  bool eof_, stopping_;
+  std::exception_ptr error_;
+
+  // the buffer being read from, and how far
+  size_t current_, pos_;
+  bool have_current_;
+
+  boost::thread thread_;
+};
+
+#endif // READAHEAD_SOURCE_HPP
@@ -4,16 +4,59 @@
 #include <boost/iostreams/filtering_stream.hpp>
 #include <zstd.h>
 #include <algorithm>
+#include <string>
+#include <vector>
+#include <icetray/open.h>
+
+//Compressing with worker threads needs either the parameter API of zstd 1.4
+//and later, or the experimental ZSTDMT streaming API of the zstd built into
+//icetray. Either way the output is ordinary zstd frames.
+#if ZSTD_VERSION_NUMBER >= 10400
+#define I3_ZSTD_NBWORKERS
+#elif defined(I3_ZSTD_BUILTIN)
+#include "compress/zstdmt_compress.h"
+#define I3_ZSTDMT
+#endif
+
+//A seekable file is a series of independent zstd frames followed by a
+//skippable frame holding the seek table: for every zstd frame, where it
+//starts in the compressed and uncompressed streams and which I3Frame begins
+//it. Readers that don't know about the table skip it like any other
+//skippable frame. All fields are little-endian:
+//
+//  u32 skippable magic, u32 size of what follows
+//  per zstd frame: u64 compressed, u64 uncompressed, u64 frame, u8 stop
+//  u32 number of zstd frames, u32 seek table magic
+namespace zstd_seek{
+	const uint32_t skippable_magic=0x184D2A5E;
+	const uint32_t table_magic=0x6b733369; // "i3sk"
+	const size_t entry_size=25;
+	const size_t footer_size=8;
+}
 
 class zstd_compressor : public boost::iostreams::multichar_output_filter{
 public:
 	using char_type=char;
 	
-	zstd_compressor(int compressionLevel):
+	//With nWorkers greater than 1, blocks of input are compressed in parallel
+	//on that many threads.
+	//With seekFrames or seekBytes set, the output is seekable: a new zstd
+	//frame starts at the first I3Frame boundary (see markFrame()) after
+	//seekFrames I3Frames or seekBytes bytes, or, if no boundaries are ever
+	//marked, every seekBytes bytes.
+	zstd_compressor(int compressionLevel, unsigned nWorkers=0,
+	                unsigned seekFrames=0, uint64_t seekBytes=0):
 	cstream(nullptr,stream_delete),
+#ifdef I3_ZSTDMT
+	mtstream(nullptr,mtstream_delete),
+#endif
 	compressionLevel(compressionLevel),
+	nWorkers(nWorkers),
 	streamInitialized(false),
-	ibufSize(0),ibufUsed(0)
+	ibufSize(0),ibufUsed(0),
+	seekFrames(seekFrames),seekBytes(seekBytes),
+	compressedPos(0),uncompressedPos(0),
+	nFrames(0),chunkFrames(0),marked(false),endPending(false)
 	{}
 	
 	//boost::iostreams really likes to copy when it should move. This filter
@@ -21,46 +64,54 @@ public:
 	//and first real use, which in practice is the only time it's needed.
 	zstd_compressor(const zstd_compressor& other):
 	cstream(nullptr,stream_delete),
+#ifdef I3_ZSTDMT
+	mtstream(nullptr,mtstream_delete),
+#endif
 	compressionLevel(other.compressionLevel),
+	nWorkers(other.nWorkers),
 	streamInitialized(other.streamInitialized),
-	ibufSize(other.ibufSize),ibufUsed(other.ibufUsed)
+	ibufSize(other.ibufSize),ibufUsed(other.ibufUsed),
+	seekFrames(other.seekFrames),seekBytes(other.seekBytes),
+	compressedPos(0),uncompressedPos(0),
+	nFrames(0),chunkFrames(0),marked(false),endPending(false)
 	{
 		assert(!other.streamInitialized);
 		assert(!other.cstream);
 		assert(!other.ibuf);
 		assert(!other.obuf);
+		assert(other.seekTable.empty());
 	}
 	
-	zstd_compressor(zstd_compressor&& other):
-	cstream(std::move(other.cstream)),
-	compressionLevel(other.compressionLevel),
-	streamInitialized(other.streamInitialized),
-	ibuf(std::move(other.ibuf)),
-	obuf(std::move(other.obuf)),
-	ibufSize(other.ibufSize),ibufUsed(other.ibufUsed)
-	{
-		other.streamInitialized=false;
-		other.ibufSize=0;
-		other.ibufUsed=0;
-	}
-	
+	zstd_compressor(zstd_compressor&& other)=default;
 	~zstd_compressor()=default;
 	zstd_compressor& operator=(const zstd_compressor&)=delete;
-	zstd_compressor& operator=(zstd_compressor&& other){
-		if(&other!=this){
-			cstream=std::move(other.cstream);
-			compressionLevel=other.compressionLevel;
-			streamInitialized=other.streamInitialized;
-			ibuf=std::move(other.ibuf);
-			obuf=std::move(other.obuf);
-			ibufSize=other.ibufSize;
-			ibufUsed=other.ibufUsed;
-			
-			other.streamInitialized=false;
-			other.ibufSize=0;
-			other.ibufUsed=0;
-		}
-		return(*this);
+	zstd_compressor& operator=(zstd_compressor&& other)=default;
+	
+	bool seekable() const{ return(seekFrames || seekBytes); }
+	
+	//Note that an I3Frame on stream stop begins with the next byte written.
+	//Everything before it must have been flushed into this filter already.
+	void markFrame(char stop){
+		if(!seekable())
+			return;
+		if(!streamInitialized)
+			initStream();
+		marked=true;
+		I3::dataio::seek_point& current=seekTable.back();
+		if(uncompressedPos==current.uncompressed){
+			current.frame=nFrames;
+			current.stop=stop;
+			chunkFrames=1;
+		}else if((seekFrames && chunkFrames>=seekFrames) ||
+		         (seekBytes && uncompressedPos-current.uncompressed>=seekBytes)){
+			//end the zstd frame here, once there is something to follow it
+			endPending=true;
+			pendingFrame=nFrames;
+			pendingStop=stop;
+			chunkFrames=1;
+		}else
+			chunkFrames++;
+		nFrames++;
 	}
 	
 	//compress n bytes of input from src to dest
@@ -68,6 +119,10 @@ public:
 	std::streamsize write(Sink& dest, const char* src, std::streamsize n){
 		if(!streamInitialized)
 			initStream();
+		if(endPending){
+			endChunk(dest,pendingFrame,pendingStop);
+			endPending=false;
+		}
 		
 		std::streamsize result=n;
 		//Copy as much input into the input buffer as possible,
@@ -76,20 +131,23 @@ public:
 		//In practice, n tends to be _much_ smaller than ibufSize.
 		while(n>0){
 			std::streamsize to_copy=std::min(n,std::streamsize(ibufSize-ibufUsed));
+			//without I3Frame boundaries, zstd frames end after seekBytes
+			if(seekBytes && !marked){
+				uint64_t left=seekTable.back().uncompressed+seekBytes-uncompressedPos;
+				if(left==0){
+					endChunk(dest,I3::dataio::seek_point::npos,0);
+					continue;
+				}
+				to_copy=std::min<uint64_t>(to_copy,left);
+			}
 			memcpy(ibuf.get()+ibufUsed,src,to_copy);
+			src+=to_copy;
 			n-=to_copy;
 			ibufUsed+=to_copy;
+			uncompressedPos+=to_copy;
 			if(ibufUsed<ibufSize)
-				break;
-			ZSTD_inBuffer input{ibuf.get(),ibufSize,0};
-			while(input.pos<input.size){
-				ZSTD_outBuffer output{obuf.get(),ZSTD_CStreamOutSize(),0};
-				size_t result=ZSTD_compressStream(cstream.get(),&output,&input);
-				if(ZSTD_isError(result))
-					log_fatal_stream("ZSTD_compressStream() error: " << ZSTD_getErrorName(result));
-				boost::iostreams::write(dest,obuf.get(),output.pos);
-			}
-			ibufUsed=0;
+				continue;
+			compressBuffer(dest);
 		}
 		return(result);
 	}
@@ -101,44 +159,195 @@ public:
 		//finalize it and end up with a valid file.
 		if(!streamInitialized)
 			initStream();
-		if(ibufUsed){
-			ZSTD_inBuffer input{ibuf.get(),ibufUsed,0};
-			while(input.pos<input.size){
-				ZSTD_outBuffer output{obuf.get(),ZSTD_CStreamOutSize(),0};
-				size_t err=ZSTD_compressStream(cstream.get(),&output,&input);
-				if(ZSTD_isError(err))
-					log_fatal_stream("ZSTD_compressStream error: " << ZSTD_getErrorName(err));
-				boost::iostreams::write(dest,obuf.get(),output.pos);
-			}
-			ibufUsed=0;
-		}
-		size_t bytes_remaining;
-		do{
-			ZSTD_outBuffer output{obuf.get(),ZSTD_CStreamOutSize(),0};
-			bytes_remaining=ZSTD_endStream(cstream.get(),&output);
-			boost::iostreams::write(dest,obuf.get(),output.pos);
-		}while(bytes_remaining>0);
+		if(ibufUsed)
+			compressBuffer(dest);
+		finishStream(dest);
+		if(seekable())
+			writeSeekTable(dest);
 	}
 private:
 	std::unique_ptr<ZSTD_CStream,void(*)(ZSTD_CStream*)> cstream;
+#ifdef I3_ZSTDMT
+	std::unique_ptr<ZSTDMT_CCtx,void(*)(ZSTDMT_CCtx*)> mtstream;
+#endif
 	int compressionLevel;
+	unsigned nWorkers;
 	bool streamInitialized;
 	std::unique_ptr<char_type[]> ibuf;
 	std::unique_ptr<char_type[]> obuf;
-	std::size_t ibufSize, ibufUsed;
+	std::size_t ibufSize, ibufUsed, obufSize;
+	
+	unsigned seekFrames;
+	uint64_t seekBytes;
+	std::vector<I3::dataio::seek_point> seekTable;
+	uint64_t compressedPos, uncompressedPos;
+	//I3Frames marked so far, and begun in the current zstd frame
+	uint64_t nFrames;
+	unsigned chunkFrames;
+	bool marked, endPending;
+	uint64_t pendingFrame;
+	char pendingStop;
 	
 	static void stream_delete(ZSTD_CStream* stream){
 		if(stream)
 			ZSTD_freeCStream(stream);
 	}
+#ifdef I3_ZSTDMT
+	static void mtstream_delete(ZSTDMT_CCtx* stream){
+		if(stream)
+			ZSTDMT_freeCCtx(stream);
+	}
+#endif
+	
+	template<typename Sink>
+	void put(Sink& dest, const char* data, std::streamsize n){
+		boost::iostreams::write(dest,data,n);
+		compressedPos+=n;
+	}
+	
+	//compress all of ibuf, writing what comes out to dest
+	template<typename Sink>
+	void compressBuffer(Sink& dest){
+		ZSTD_inBuffer input{ibuf.get(),ibufUsed,0};
+		while(input.pos<input.size){
+			ZSTD_outBuffer output{obuf.get(),obufSize,0};
+			size_t err=compressStream(&output,&input);
+			if(ZSTD_isError(err))
+				log_fatal_stream("ZSTD_compressStream error: " << ZSTD_getErrorName(err));
+			put(dest,obuf.get(),output.pos);
+		}
+		ibufUsed=0;
+	}
+	
+	//end the current zstd frame
+	template<typename Sink>
+	void finishStream(Sink& dest){
+		size_t bytes_remaining;
+		do{
+			ZSTD_outBuffer output{obuf.get(),obufSize,0};
+			bytes_remaining=endStream(&output);
+			if(ZSTD_isError(bytes_remaining))
+				log_fatal_stream("ZSTD_endStream error: " << ZSTD_getErrorName(bytes_remaining));
+			put(dest,obuf.get(),output.pos);
+		}while(bytes_remaining>0);
+	}
+	
+	//end the current zstd frame and start another, beginning with the given
+	//I3Frame
+	template<typename Sink>
+	void endChunk(Sink& dest, uint64_t frame, char stop){
+		if(ibufUsed)
+			compressBuffer(dest);
+		finishStream(dest);
+		restartStream();
+		I3::dataio::seek_point point={compressedPos,uncompressedPos,frame,stop};
+		seekTable.push_back(point);
+	}
+	
+	template<typename Sink>
+	void writeSeekTable(Sink& dest){
+		std::string table;
+		putLE(table,zstd_seek::skippable_magic,4);
+		putLE(table,seekTable.size()*zstd_seek::entry_size+zstd_seek::footer_size,4);
+		for(const I3::dataio::seek_point& point : seekTable){
+			putLE(table,point.compressed,8);
+			putLE(table,point.uncompressed,8);
+			putLE(table,point.frame,8);
+			putLE(table,(unsigned char)point.stop,1);
+		}
+		putLE(table,seekTable.size(),4);
+		putLE(table,zstd_seek::table_magic,4);
+		put(dest,table.data(),table.size());
+	}
+	
+	static void putLE(std::string& out, uint64_t value, unsigned nbytes){
+		for(unsigned i=0; i<nbytes; i++)
+			out+=char((value>>(8*i))&0xff);
+	}
+	
+	size_t compressStream(ZSTD_outBuffer* output, ZSTD_inBuffer* input){
+#if defined(I3_ZSTD_NBWORKERS)
+		return(ZSTD_compressStream2(cstream.get(),output,input,ZSTD_e_continue));
+#else
+#if defined(I3_ZSTDMT)
+		if(mtstream)
+			return(ZSTDMT_compressStream(mtstream.get(),output,input));
+#endif
+		return(ZSTD_compressStream(cstream.get(),output,input));
+#endif
+	}
+	
+	size_t endStream(ZSTD_outBuffer* output){
+#if defined(I3_ZSTD_NBWORKERS)
+		ZSTD_inBuffer input{nullptr,0,0};
+		return(ZSTD_compressStream2(cstream.get(),output,&input,ZSTD_e_end));
+#else
+#if defined(I3_ZSTDMT)
+		if(mtstream)
+			return(ZSTDMT_endStream(mtstream.get(),output));
+#endif
+		return(ZSTD_endStream(cstream.get(),output));
+#endif
+	}
+	
+	//start a new zstd frame after endStream()
+	void restartStream(){
+#if defined(I3_ZSTD_NBWORKERS)
+		//the next ZSTD_compressStream2() starts one by itself
+#else
+#if defined(I3_ZSTDMT)
+		if(mtstream){
+			ZSTDMT_initCStream(mtstream.get(),compressionLevel);
+			return;
+		}
+#endif
+		ZSTD_initCStream(cstream.get(),compressionLevel);
+#endif
+	}
 	
 	void initStream(){
+		bool threaded=false;
+#if defined(I3_ZSTD_NBWORKERS)
+		cstream.reset(ZSTD_createCStream());
+		ZSTD_CCtx_setParameter(cstream.get(),ZSTD_c_compressionLevel,compressionLevel);
+		if(nWorkers>1){
+			size_t err=ZSTD_CCtx_setParameter(cstream.get(),ZSTD_c_nbWorkers,nWorkers);
+			if(ZSTD_isError(err))
+				log_warn_stream("zstd was built without threads; compressing on one. ("
+				                << ZSTD_getErrorName(err) << ")");
+			else
+				threaded=true;
+		}
+#elif defined(I3_ZSTDMT)
+		if(nWorkers>1){
+			mtstream.reset(ZSTDMT_createCCtx(nWorkers));
+			if(!mtstream)
+				log_fatal_stream("Could not start " << nWorkers << " zstd workers");
+			ZSTDMT_initCStream(mtstream.get(),compressionLevel);
+			threaded=true;
+		}else{
+			cstream.reset(ZSTD_createCStream());
+			ZSTD_initCStream(cstream.get(),compressionLevel);
+		}
+#else
+		if(nWorkers>1)
+			log_warn("This zstd cannot compress with worker threads; compressing on one.");
 		cstream.reset(ZSTD_createCStream());
 		ZSTD_initCStream(cstream.get(),compressionLevel);
+#endif
+		//With workers, hand over input in chunks large enough to keep them
+		//all busy rather than one block at a time.
 		ibufSize=ZSTD_CStreamInSize();
+		if(threaded)
+			ibufSize*=4*nWorkers;
 		ibufUsed=0;
+		obufSize=ZSTD_CStreamOutSize();
 		ibuf.reset(new char_type[ibufSize]);
-		obuf.reset(new char_type[ZSTD_CStreamOutSize()]);
+		obuf.reset(new char_type[obufSize]);
+		if(seekable()){
+			I3::dataio::seek_point first={0,0,I3::dataio::seek_point::npos,0};
+			seekTable.push_back(first);
+		}
 		streamInitialized=true;
 	}
 };
@@ -151,7 +360,9 @@ public:
 	dstream(nullptr,stream_delete),
 	streamInitialized(false),
 	ibufSize(0),
-	inputEnd(false)
+	obufSize(0),obufPos(0),obufUsed(0),
+	inputEnd(false),
+	outputPending(false)
 	{}
 	
 	//boost::iostreams really likes to copy when it should move. This filter
@@ -161,11 +372,14 @@ public:
 	dstream(nullptr,stream_delete),
 	streamInitialized(other.streamInitialized),
 	ibufSize(other.ibufSize),
-	inputEnd(other.inputEnd)
+	obufSize(other.obufSize),obufPos(other.obufPos),obufUsed(other.obufUsed),
+	inputEnd(other.inputEnd),
+	outputPending(other.outputPending)
 	{
 		assert(!other.streamInitialized);
 		assert(!other.dstream);
 		assert(!other.ibuf);
+		assert(!other.obuf);
 	}
 	
 	zstd_decompressor(zstd_decompressor&& other):
@@ -174,12 +388,12 @@ public:
 	ibuf(std::move(other.ibuf)),
 	ibufSize(other.ibufSize),
 	zibuf(other.zibuf),
-	inputEnd(other.inputEnd)
+	obuf(std::move(other.obuf)),
+	obufSize(other.obufSize),obufPos(other.obufPos),obufUsed(other.obufUsed),
+	inputEnd(other.inputEnd),
+	outputPending(other.outputPending)
 	{
-		other.streamInitialized=false;
-		other.ibufSize=0;
-		other.zibuf=ZSTD_inBuffer{nullptr,0,0};
-		other.inputEnd=false;
+		other.reset();
 	}
 	
 	~zstd_decompressor()=default;
@@ -191,16 +405,22 @@ public:
 			ibuf=std::move(other.ibuf);
 			ibufSize=other.ibufSize;
 			zibuf=other.zibuf;
+			obuf=std::move(other.obuf);
+			obufSize=other.obufSize;
+			obufPos=other.obufPos;
+			obufUsed=other.obufUsed;
 			inputEnd=other.inputEnd;
+			outputPending=other.outputPending;
 			
-			other.streamInitialized=false;
-			other.ibufSize=0;
-			other.zibuf=ZSTD_inBuffer{nullptr,0,0};
-			other.inputEnd=false;
+			other.reset();
 		}
 		return(*this);
 	}
 	
+	//The buffer to push this filter with, so that boost::iostreams asks for
+	//whole blocks and read() can decompress straight into its buffer.
+	static std::streamsize buffer_size(){ return(ZSTD_DStreamOutSize()); }
+	
 	//read as much input from src as necessary to write n bytes of decompressed
 	//data to dest
 	template <typename Source>
@@ -209,47 +429,54 @@ public:
 			initStream();
 		
 		std::streamsize result=0;
-		
-		//First, see if we have anything sitting in ibuf which still needs to be
-		//decompressed
-		while(zibuf.pos<zibuf.size && n>0){
-			ZSTD_outBuffer zobuf{dest,(size_t)n,0};
-			size_t err=ZSTD_decompressStream(dstream.get(), &zobuf , &zibuf);
-			if(ZSTD_isError(err))
-				log_fatal_stream("ZSTD_decompressStream error: " << ZSTD_getErrorName(err));
-			std::streamsize output_size=zobuf.pos;
-			dest+=output_size;
-			n-=output_size;
-			result+=output_size;
-		}
-		
-		//If that didn't produce enough data, we need to actually fetch more from
-		//src, insert it into ibuf, and decompress.
-		while(n>0 && !inputEnd){
-			//first, try to grab enough data to fill ibuf
-			zibuf.size=0;
-			zibuf.pos=0;
-			while(zibuf.size<ibufSize){
-				int c=boost::iostreams::get(src);
-				if(c==EOF){
-					inputEnd=true;
+		while(n>0){
+			//First, hand out what is left from an earlier small read
+			if(obufPos<obufUsed){
+				std::streamsize to_copy=std::min(n,std::streamsize(obufUsed-obufPos));
+				memcpy(dest,obuf.get()+obufPos,to_copy);
+				obufPos+=to_copy;
+				dest+=to_copy;
+				n-=to_copy;
+				result+=to_copy;
+				continue;
+			}
+			//Refill ibuf with one block read once it has all been consumed,
+			//unless zstd still holds output it could not flush last time
+			if(zibuf.pos==zibuf.size && !outputPending){
+				if(inputEnd)
 					break;
+				std::streamsize got=boost::iostreams::read(src,ibuf.get(),ibufSize);
+				if(got<0){
+					inputEnd=true;
+					got=0;
 				}
-				ibuf[zibuf.size++]=c;
+				zibuf=ZSTD_inBuffer{ibuf.get(),(size_t)got,0};
+				continue;
 			}
-			//then try to decompress data until enough output is produced
-			while(zibuf.pos<zibuf.size && n>0){
-				ZSTD_outBuffer zobuf{dest,(size_t)n,0};
-				size_t err=ZSTD_decompressStream(dstream.get(), &zobuf , &zibuf);
-				if(ZSTD_isError(err))
-					log_fatal_stream("ZSTD_decompressStream error: " << ZSTD_getErrorName(err));
-				std::streamsize output_size=zobuf.pos;
-				dest+=output_size;
-				n-=output_size;
-				result+=output_size;
+			//Decompress straight into dest if it can take a whole block;
+			//otherwise into obuf, and copy out from there.
+			bool direct=(size_t)n>=obufSize;
+			ZSTD_outBuffer zobuf=direct ?
+				ZSTD_outBuffer{dest,(size_t)n,0} :
+				ZSTD_outBuffer{obuf.get(),obufSize,0};
+			size_t err=ZSTD_decompressStream(dstream.get(), &zobuf , &zibuf);
+			if(ZSTD_isError(err))
+				log_fatal_stream("ZSTD_decompressStream error: " << ZSTD_getErrorName(err));
+			//A full output buffer may mean zstd has more to give without
+			//any more input
+			outputPending=(zobuf.pos==zobuf.size);
+			if(direct){
+				dest+=zobuf.pos;
+				n-=zobuf.pos;
+				result+=zobuf.pos;
+			}else{
+				obufPos=0;
+				obufUsed=zobuf.pos;
 			}
 		}
 		
+		if(result==0 && inputEnd)
+			return(-1);
 		return(result);
 	}
 	
@@ -261,19 +488,37 @@ private:
 	std::unique_ptr<char_type[]> ibuf;
 	std::size_t ibufSize;
 	ZSTD_inBuffer zibuf;
+	std::unique_ptr<char_type[]> obuf;
+	std::size_t obufSize, obufPos, obufUsed;
 	bool inputEnd;
+	bool outputPending;
 	
 	static void stream_delete(ZSTD_DStream* stream){
 		if(stream)
 			ZSTD_freeDStream(stream);
 	}
 	
+	void reset(){
+		streamInitialized=false;
+		ibufSize=0;
+		zibuf=ZSTD_inBuffer{nullptr,0,0};
+		obufSize=0;
+		obufPos=0;
+		obufUsed=0;
+		inputEnd=false;
+		outputPending=false;
+	}
+	
 	void initStream(){
 		dstream.reset(ZSTD_createDStream());
 		ZSTD_initDStream(dstream.get());
 		ibufSize=ZSTD_DStreamInSize();
 		ibuf.reset(new char_type[ibufSize]);
 		zibuf=ZSTD_inBuffer{ibuf.get(),0,0};
+		obufSize=ZSTD_DStreamOutSize();
+		obuf.reset(new char_type[obufSize]);
+		obufPos=0;
+		obufUsed=0;
 		streamInitialized=true;
 	}
 };
@@ -55,25 +55,28 @@ boost::shared_ptr<T> frame_get(const I3Frame* f, const std::string& where)
 static list frame_keys(I3Frame const& x)
 {
         list t;
-        for(I3Frame::typename_iterator it = x.typename_begin(); it != x.typename_end(); it++)
-          t.append(it->first);
+        std::vector<std::string> keys = x.keys();
+        for(std::vector<std::string>::const_iterator it = keys.begin(); it != keys.end(); it++)
+          t.append(*it);
         return t;
 }
 
 static list frame_values(I3Frame const& x)
 {
         list t;
-        for(I3Frame::typename_iterator it=x.typename_begin(); it!=x.typename_end(); ++it)
-          t.append(frame_get<I3FrameObject>(&x, it->first));
+        std::vector<std::string> keys = x.keys();
+        for(std::vector<std::string>::const_iterator it=keys.begin(); it!=keys.end(); ++it)
+          t.append(frame_get<I3FrameObject>(&x, *it));
         return t;
 }
 
 static list frame_items(I3Frame const& x)
 {
   list t;
-  for(I3Frame::typename_iterator it=x.typename_begin(); it!=x.typename_end(); ++it)
+  std::vector<std::string> keys = x.keys();
+  for(std::vector<std::string>::const_iterator it=keys.begin(); it!=keys.end(); ++it)
     {
-      t.append(boost::python::make_tuple(it->first, frame_get<I3FrameObject>(&x, it->first)));
+      t.append(boost::python::make_tuple(*it, frame_get<I3FrameObject>(&x, *it)));
     }
   return t;
 }
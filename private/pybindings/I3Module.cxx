@@ -24,6 +24,7 @@ namespace {
       .def("PopFrame", &module_t::PopFrame) \
       .def("Process", &module_t::PyProcess) \
       .def("RequestSuspension",&module_t::RequestSuspension) \
+      .def("Prefetch", &module_t::Prefetch) \
       .def("ShouldDoGeometry", &module_t::ShouldDoGeometry) \
       .def("Geometry", &module_t::Geometry) \
       .def("ShouldDoCalibration", &module_t::ShouldDoCalibration) \
@@ -36,6 +37,7 @@ namespace {
       .def("DAQ", &module_t::DAQ) \
       .def("ShouldDoPhysics", &module_t::ShouldDoPhysics) \
       .def("Physics", &module_t::Physics) \
+      .def("PhysicsBatch", &module_t::PyPhysicsBatch) \
       .add_property("configuration", make_function(&module_t::GetConfiguration, return_internal_reference<>())) \
       .add_property("name", &module_t::GetName) \
       .add_property("context", make_function(&module_t::GetContext, return_internal_reference<>())) \
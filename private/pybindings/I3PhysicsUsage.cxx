@@ -5,10 +5,24 @@ using namespace boost::python;
 void
 register_I3PhysicsUsage()
 {
+  class_<I3StreamUsage>("I3StreamUsage")
+    .def_readwrite("ncall", &I3StreamUsage::ncall)
+    .def_readwrite("walltime", &I3StreamUsage::walltime)
+    ;
+
+  class_<std::map<std::string, I3StreamUsage> >("map_string_I3StreamUsage")
+    .def(map_indexing_suite<std::map<std::string, I3StreamUsage> >())
+    ;
+
   class_<I3PhysicsUsage>("I3PhysicsUsage")
     .def_readwrite("systime", &I3PhysicsUsage::systime)
     .def_readwrite("usertime", &I3PhysicsUsage::usertime)
     .def_readwrite("ncall", &I3PhysicsUsage::ncall)
+    .def_readwrite("walltime", &I3PhysicsUsage::walltime)
+    .def_readwrite("p50", &I3PhysicsUsage::p50)
+    .def_readwrite("p99", &I3PhysicsUsage::p99)
+    .def_readwrite("max", &I3PhysicsUsage::max)
+    .def_readwrite("streams", &I3PhysicsUsage::streams)
     .def(self_ns::str(self))
     ;
 
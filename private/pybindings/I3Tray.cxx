@@ -67,6 +67,17 @@ void register_I3Tray()
     .def("Usage", &I3Tray::Usage)
     .def("Finish", deprecated_finish)
     .def("RequestSuspension", &I3Tray::RequestSuspension)
+    .def("SetThreadPoolSize", &I3Tray::SetThreadPoolSize)
+    .def("SetPhysicsWorkers", &I3Tray::SetPhysicsWorkers)
+    .def("StartStage", &I3Tray::StartStage)
+    .def("SetStageQueueSize", &I3Tray::SetStageQueueSize)
+    .def("SetFifoCapacity", &I3Tray::SetFifoCapacity)
+    .def("SetFifoHighWater", &I3Tray::SetFifoHighWater)
+    .def("SetBatchSize", &I3Tray::SetBatchSize)
+    .def("SetWorkerProcesses", &I3Tray::SetWorkerProcesses)
+    .def("SetTraceFile", &I3Tray::SetTraceFile)
+    .def("SetMetricsAddress", &I3Tray::SetMetricsAddress)
+    .def("Metrics", &I3Tray::Metrics)
     .def("TrayInfo", &I3Tray::TrayInfo)
     .def("__str__", &I3TrayString)
     .add_property("tray_info", &I3Tray::TrayInfo)
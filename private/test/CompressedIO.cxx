@@ -103,8 +103,73 @@ TEST(plain){ test_format(".txt"); }
 //TEST(gzip){ test_format(".txt.gz"); }
 TEST(bzip2){ test_format(".txt.bz2"); }
 TEST(zstd){ test_format(".txt.zst"); }
+
+//Several MB, so that every worker gets a section to compress
+TEST(zstd_threads){
+	const std::string filepath=I3Test::testfile("compression_test_threads.txt.zst");
+	std::string block;
+	for(unsigned int i=0; i<65536; i++)
+		block+=char('!'+(i*i)%94);
+	{
+		boost::iostreams::filtering_ostream os;
+		I3::dataio::open(os,filepath,0,std::ios::binary,4);
+		for(unsigned int i=0; i<128; i++)
+			os.write(block.data(),block.size());
+	}
+	{
+		boost::iostreams::filtering_istream is;
+		I3::dataio::open(is,filepath);
+		std::string read(block.size(),0);
+		for(unsigned int i=0; i<128; i++){
+			is.read(&read[0],read.size());
+			ENSURE(!is.fail());
+			ENSURE(read==block);
+		}
+		char c;
+		is >> c;
+		ENSURE(is.eof());
+	}
+	std::remove(filepath.c_str());
+}
 #ifdef I3_WITH_LIBARCHIVE
 //We can read these but not write them, so the tests are a bit pointless
 //TEST(lzma){ test_format(".txt.lzma"); }
 //TEST(xz){ test_format(".txt.xz"); }
 #endif
+
+//Small buffers, so that the reading thread has to wait for the reader
+void test_readahead(const std::string& extension){
+	const std::string filepath=I3Test::testfile("compression_test_readahead"+extension);
+	{
+		boost::iostreams::filtering_ostream os;
+		I3::dataio::open(os,filepath);
+		for(unsigned int i=0; i<100000; i++)
+			os << i << ' ';
+	}
+	{
+		boost::iostreams::filtering_istream is;
+		I3::dataio::open_readahead(is,filepath,2,4096);
+		for(unsigned int i=0; i<100000; i++){
+			unsigned int j;
+			is >> j;
+			ENSURE(!is.fail());
+			ENSURE_EQUAL(j,i);
+		}
+		unsigned int k;
+		is >> k;
+		ENSURE(is.eof());
+	}
+	{
+		//stop reading early; the reading thread must not hang
+		boost::iostreams::filtering_istream is;
+		I3::dataio::open_readahead(is,filepath,2,4096);
+		unsigned int j;
+		is >> j;
+		ENSURE_EQUAL(j,0u);
+	}
+	std::remove(filepath.c_str());
+}
+
+TEST(readahead){ test_readahead(".txt.zst"); }
+//bzip2 hands out little at a time; each buffer must still fill up
+TEST(readahead_bzip2){ test_readahead(".txt.bz2"); }
@@ -0,0 +1,95 @@
+#include <I3Test.h>
+
+#include <string>
+#include <vector>
+
+#include <icetray/I3Tray.h>
+#include <icetray/I3Frame.h>
+#include <icetray/I3Module.h>
+
+TEST_GROUP(Dispatch);
+
+namespace {
+  // what DispatchRecord was called with, one letter per frame
+  std::string calls;
+
+  // one frame of each stream in turn, and one on the highest stream id
+  struct DispatchSource : public I3Module
+  {
+    DispatchSource(const I3Context& context) : I3Module(context)
+    {
+      AddOutBox("OutBox");
+    }
+
+    void Process()
+    {
+      const char streams[] = { 'G', 'C', 'D', 'Q', 'P', 'S', 'X', 'R', '\xff' };
+      for (size_t i = 0; i < sizeof(streams); i++)
+        PushFrame(I3FramePtr(new I3Frame(I3Frame::Stream(streams[i]))));
+      RequestSuspension();
+    }
+  };
+
+  struct DispatchRecord : public I3Module
+  {
+    DispatchRecord(const I3Context& context) : I3Module(context)
+    {
+      AddOutBox("OutBox");
+    }
+
+    void Configure()
+    {
+      Register(I3Frame::Stream('X'), &DispatchRecord::Extra);
+      Register(I3Frame::DAQ, &DispatchRecord::Extra);
+    }
+
+    void Extra(I3FramePtr frame) { calls += 'x'; PushFrame(frame); }
+
+    void Physics(I3FramePtr frame) { calls += 'p'; PushFrame(frame); }
+    void DAQ(I3FramePtr frame) { calls += 'q'; PushFrame(frame); }
+    void Geometry(I3FramePtr frame) { calls += 'g'; PushFrame(frame); }
+    void Calibration(I3FramePtr frame) { calls += 'c'; PushFrame(frame); }
+    void Simulation(I3FramePtr frame) { calls += 's'; PushFrame(frame); }
+    void OtherStops(I3FramePtr frame) { calls += 'o'; PushFrame(frame); }
+
+    // turned away: handled as an other stop
+    bool ShouldDoDetectorStatus(I3FramePtr) { return false; }
+  };
+
+  // still asks the ShouldDo it inherits, and a protected one that
+  // turns Simulation frames away too
+  class DispatchChild : public DispatchRecord
+  {
+  public:
+    DispatchChild(const I3Context& context) : DispatchRecord(context) { }
+
+  protected:
+    bool ShouldDoSimulation(I3FramePtr) { return false; }
+  };
+}
+
+I3_MODULE(DispatchSource);
+I3_MODULE(DispatchRecord);
+I3_MODULE(DispatchChild);
+
+// Registered handlers win over the built-in ones, and frames a ShouldDo
+// turns away, or on streams nothing handles, go to OtherStops().
+TEST(streams_reach_their_handlers)
+{
+  calls.clear();
+  I3Tray tray;
+  tray.AddModule("DispatchSource", "source");
+  tray.AddModule("DispatchRecord", "record");
+  tray.Execute(1);
+  ENSURE_EQUAL(calls, std::string("gcoxpsxoo"));
+}
+
+TEST(inherited_should_do)
+{
+  calls.clear();
+  I3Tray tray;
+  tray.AddModule("DispatchSource", "source");
+  tray.AddModule("DispatchChild", "child");
+  tray.Execute(1);
+  ENSURE_EQUAL(calls, std::string("gcoxpoxoo"));
+}
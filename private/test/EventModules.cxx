@@ -0,0 +1,165 @@
+#include "EventModules.h"
+
+#include <sstream>
+#include <unistd.h>
+
+#include <icetray/I3Int.h>
+
+EventLog event_log;
+
+int
+event_int(const I3Frame& frame, const std::string& key)
+{
+  I3IntConstPtr i = frame.Get<I3IntConstPtr>(key);
+  return i ? i->value : -1;
+}
+
+void
+EventLog::clear()
+{
+  records.clear();
+  threads.clear();
+  pids.clear();
+  finished = false;
+}
+
+EventSource::EventSource(const I3Context& context)
+  : I3Module(context), events_(60), status_every_(20), lone_physics_(false),
+    event_(0)
+{
+  AddParameter("Events", "How many events", events_);
+  AddParameter("StatusEvery", "Events per D frame", status_every_);
+  AddParameter("LonePhysics", "Follow the first D with a lone P frame",
+               lone_physics_);
+  AddOutBox("OutBox");
+}
+
+void
+EventSource::Configure()
+{
+  GetParameter("Events", events_);
+  GetParameter("StatusEvery", status_every_);
+  GetParameter("LonePhysics", lone_physics_);
+}
+
+void
+EventSource::Process()
+{
+  if (event_ == 0)
+    {
+      PushFrame(I3FramePtr(new I3Frame(I3Frame::Geometry)));
+      PushFrame(I3FramePtr(new I3Frame(I3Frame::Calibration)));
+    }
+  if (event_ == events_)
+    {
+      RequestSuspension();
+      return;
+    }
+  if (event_ % status_every_ == 0)
+    {
+      I3FramePtr d(new I3Frame(I3Frame::DetectorStatus));
+      d->Put("Status", I3IntPtr(new I3Int(event_ / status_every_)));
+      PushFrame(d);
+    }
+  if (event_ == 0 && lone_physics_)
+    PushFrame(I3FramePtr(new I3Frame(I3Frame::Physics)));
+  I3FramePtr q(new I3Frame(I3Frame::DAQ));
+  q->Put("Event", I3IntPtr(new I3Int(event_)));
+  PushFrame(q);
+  for (int s = 0; s < 2; s++)
+    {
+      I3FramePtr p(new I3Frame(I3Frame::Physics));
+      p->Put("Sub", I3IntPtr(new I3Int(s)));
+      PushFrame(p);
+    }
+  event_++;
+}
+
+EventCalibrate::EventCalibrate(const I3Context& context) : I3Module(context)
+{
+  AddOutBox("OutBox");
+}
+
+void
+EventCalibrate::DAQ(I3FramePtr frame)
+{
+  frame->Put("Calibrated", I3IntPtr(new I3Int(
+    10 * event_int(*frame, "Event") + event_int(*frame, "Status"))));
+  frame->Put("Pid", I3IntPtr(new I3Int(getpid())));
+  PushFrame(frame);
+}
+
+EventBuffer::EventBuffer(const I3Context& context) : I3Module(context)
+{
+  AddOutBox("OutBox");
+}
+
+void
+EventBuffer::Physics(I3FramePtr frame)
+{
+  held_.push_back(frame);
+}
+
+void
+EventBuffer::Finish()
+{
+  for (size_t i = 0; i < held_.size(); i++)
+    PushFrame(held_[i]);
+  held_.clear();
+  Flush();
+}
+
+EventSplit::EventSplit(const I3Context& context) : I3Module(context)
+{
+  AddOutBox("OutBox");
+  AddOutBox("Side");
+}
+
+EventThrow::EventThrow(const I3Context& context) : I3Module(context)
+{
+  AddOutBox("OutBox");
+}
+
+void
+EventThrow::DAQ(I3FramePtr frame)
+{
+  if (event_int(*frame, "Event") == 7)
+    log_fatal("event 7");
+  PushFrame(frame);
+}
+
+EventRecord::EventRecord(const I3Context& context) : I3Module(context)
+{
+  AddOutBox("OutBox");
+}
+
+void
+EventRecord::Process()
+{
+  I3FramePtr frame = PopFrame();
+  std::ostringstream s;
+  s << frame->GetStop().id() << ' ' << event_int(*frame, "Status") << ' '
+    << event_int(*frame, "Event") << ' ' << event_int(*frame, "Sub") << ' '
+    << event_int(*frame, "Calibrated") << ' ' << event_int(*frame, "Reco");
+  boost::mutex::scoped_lock lock(event_log.mtx);
+  event_log.records[GetName()].push_back(s.str());
+  event_log.threads.insert(boost::this_thread::get_id());
+  if (frame->Has("Pid"))
+    event_log.pids.insert(event_int(*frame, "Pid"));
+  lock.unlock();
+  PushFrame(frame);
+}
+
+void
+EventRecord::Finish()
+{
+  boost::mutex::scoped_lock lock(event_log.mtx);
+  event_log.finished = true;
+}
+
+I3_MODULE(EventSource);
+I3_MODULE(EventCalibrate);
+I3_MODULE(EventBuffer);
+I3_MODULE(EventSplit);
+I3_MODULE(EventThrow);
+I3_MODULE(EventRecord);
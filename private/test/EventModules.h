@@ -0,0 +1,102 @@
+#ifndef EVENTMODULES_H
+#define EVENTMODULES_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <icetray/I3Frame.h>
+#include <icetray/I3Module.h>
+
+// Modules for the tests that run a line of modules on stages, worker
+// threads or worker processes, and compare what comes out with a
+// serial tray.
+
+/// The I3Int at @a key in @a frame, or -1 if there is none.
+int event_int(const I3Frame& frame, const std::string& key);
+
+/// What the EventRecords saw, and where.
+struct EventLog
+{
+  /// each EventRecord's frames, by instance name
+  std::map<std::string, std::vector<std::string> > records;
+  std::set<boost::thread::id> threads;
+  /// the processes EventCalibrate ran in
+  std::set<int> pids;
+  /// whether an EventRecord's Finish() was called
+  bool finished;
+  /// held by EventRecords, which may run on several threads
+  boost::mutex mtx;
+
+  void clear();
+};
+
+extern EventLog event_log;
+
+/**
+ * G, C, then "Events" events of one DAQ and two Physics frames each,
+ * with a new D before every "StatusEvery"th.  With "LonePhysics", a
+ * Physics frame with no DAQ frame follows the first D.
+ */
+class EventSource : public I3Module
+{
+ public:
+  EventSource(const I3Context& context);
+  void Configure();
+  void Process();
+
+ private:
+  int events_, status_every_;
+  bool lone_physics_;
+  int event_;
+};
+
+/// Reads the D frame's status through the DAQ frame, and says which
+/// process it ran in.
+class EventCalibrate : public I3Module
+{
+ public:
+  EventCalibrate(const I3Context& context);
+  void DAQ(I3FramePtr frame);
+};
+
+/// Holds every Physics frame back until Finish().
+class EventBuffer : public I3Module
+{
+ public:
+  EventBuffer(const I3Context& context);
+  void Physics(I3FramePtr frame);
+  void Finish();
+
+ private:
+  std::vector<I3FramePtr> held_;
+};
+
+/// Pushes every frame to both of its outboxes, "OutBox" and "Side".
+class EventSplit : public I3Module
+{
+ public:
+  EventSplit(const I3Context& context);
+};
+
+/// Throws on event 7.
+class EventThrow : public I3Module
+{
+ public:
+  EventThrow(const I3Context& context);
+  void DAQ(I3FramePtr frame);
+};
+
+/// Writes every frame down in event_log.
+class EventRecord : public I3Module
+{
+ public:
+  EventRecord(const I3Context& context);
+  void Process();
+  void Finish();
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include <I3Test.h>
+
+#include <icetray/I3AsyncFrameWriter.h>
+#include <icetray/I3Frame.h>
+#include <icetray/I3Int.h>
+#include <icetray/open.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <boost/interprocess/streams/vectorstream.hpp>
+#include <boost/make_shared.hpp>
+
+TEST_GROUP(I3AsyncFrameWriterTest);
+
+namespace {
+  I3FramePtr
+  make_frame(int i)
+  {
+    I3FramePtr frame(new I3Frame(i % 10 == 0 ? I3Frame::DAQ : I3Frame::Physics));
+    frame->Put("i", boost::make_shared<I3Int>(i));
+    return frame;
+  }
+
+  void
+  check_file(const std::string& path, int nframes)
+  {
+    boost::iostreams::filtering_istream is;
+    I3::dataio::open(is, path);
+    for (int i = 0; i < nframes; i++)
+      {
+        I3Frame frame;
+        ENSURE(frame.load(is), "frame is there");
+        ENSURE_EQUAL(frame.Get<I3Int>("i").value, i);
+        ENSURE(frame.GetStop() == (i % 10 == 0 ? I3Frame::DAQ : I3Frame::Physics));
+      }
+    I3Frame frame;
+    ENSURE(!frame.load(is), "nothing after the last frame");
+  }
+}
+
+TEST(write_and_read_back)
+{
+  const std::string path = I3Test::testfile("async_writer.i3.zst");
+  const int nframes = 100;
+  I3AsyncFrameWriter::Stats stats;
+  {
+    I3AsyncFrameWriter writer(path, 2);
+    for (int i = 0; i < nframes; i++)
+      {
+        I3FramePtr frame = make_frame(i);
+        if (i % 2)
+          {
+            writer.Write(*frame);
+            // the queued copy must not see this
+            frame->Delete("i");
+          }
+        else
+          {
+            boost::interprocess::basic_vectorstream<std::vector<char> > buffer;
+            frame->save(buffer);
+            std::vector<char> bytes;
+            buffer.swap_vector(bytes);
+            writer.Write(bytes, frame->GetStop());
+            ENSURE(bytes.empty());
+          }
+      }
+    writer.Close();
+    stats = writer.GetStats();
+    try {
+      writer.Write(*make_frame(0));
+      FAIL("writing after Close() should throw");
+    } catch (const std::exception&) { }
+  }
+  ENSURE_EQUAL(stats.frames, (boost::uint64_t)nframes);
+  ENSURE(stats.bytes > 0);
+  ENSURE(stats.peak <= 2);
+  ENSURE_EQUAL(stats.depth, 0u);
+  check_file(path, nframes);
+  std::remove(path.c_str());
+}
+
+TEST(flush)
+{
+  const std::string path = I3Test::testfile("async_writer_flush.i3");
+  I3AsyncFrameWriter writer(path);
+  for (int i = 0; i < 10; i++)
+    writer.Write(*make_frame(i));
+  writer.Flush();
+  // an uncompressed file holds everything once Flush() returns
+  check_file(path, 10);
+  for (int i = 10; i < 20; i++)
+    writer.Write(*make_frame(i));
+  writer.Close();
+  check_file(path, 20);
+  ENSURE_EQUAL(writer.GetStats().frames, (boost::uint64_t)20);
+  std::remove(path.c_str());
+}
+
+TEST(seekable)
+{
+  const std::string path = I3Test::testfile("async_writer_seekable.i3.zst");
+  {
+    I3AsyncFrameWriter writer(path, 4, 0, 0, 10);
+    for (int i = 0; i < 50; i++)
+      writer.Write(*make_frame(i));
+  }
+  check_file(path, 50);
+  std::vector<I3::dataio::seek_point> table = I3::dataio::seek_table(path);
+  ENSURE(table.size() >= 5, "a seek point every 10 frames");
+  std::remove(path.c_str());
+}
@@ -0,0 +1,90 @@
+#include <I3Test.h>
+
+#include <icetray/I3FlatMap.h>
+#include <map>
+#include <string>
+#include <boost/lexical_cast.hpp>
+
+TEST_GROUP(I3FlatMapTest);
+
+typedef I3FlatMap<int, std::string> flat_t;
+
+TEST(insert_find_erase)
+{
+  flat_t m;
+  ENSURE(m.empty());
+  ENSURE(m.find(1) == m.end());
+  ENSURE_EQUAL(m.erase(1), 0u);
+
+  m[1] = "one";
+  ENSURE(m.insert(std::make_pair(2, std::string("two"))).second);
+  ENSURE(!m.insert(std::make_pair(2, std::string("deux"))).second,
+         "insert does not overwrite");
+  ENSURE_EQUAL(m.size(), 2u);
+  ENSURE_EQUAL(m.find(2)->second, "two");
+  ENSURE_EQUAL(m.count(1), 1u);
+
+  ENSURE_EQUAL(m.erase(1), 1u);
+  ENSURE_EQUAL(m.count(1), 0u);
+  ENSURE_EQUAL(m.size(), 1u);
+  m[1] = "again";
+  ENSURE_EQUAL(m.find(1)->second, "again");
+}
+
+// against std::map, through growth and lots of erased slots
+TEST(matches_std_map)
+{
+  flat_t m;
+  std::map<int, std::string> ref;
+  unsigned seed = 12345;
+  for (unsigned i = 0; i < 50000; i++)
+    {
+      seed = seed * 1103515245 + 12345;
+      int key = (seed >> 8) % 300;
+      std::string value = boost::lexical_cast<std::string>(i);
+      switch ((seed >> 20) % 3)
+        {
+        case 0:
+          m[key] = value;
+          ref[key] = value;
+          break;
+        case 1:
+          ENSURE_EQUAL(m.erase(key), ref.erase(key));
+          break;
+        default:
+          ENSURE_EQUAL(m.count(key), ref.count(key));
+          if (ref.count(key))
+            ENSURE_EQUAL(m.find(key)->second, ref[key]);
+        }
+      ENSURE_EQUAL(m.size(), ref.size());
+    }
+
+  unsigned n = 0;
+  for (flat_t::const_iterator it = m.begin(); it != m.end(); it++, n++)
+    ENSURE_EQUAL(it->second, ref[it->first]);
+  ENSURE_EQUAL(n, ref.size());
+}
+
+TEST(erase_while_iterating)
+{
+  flat_t m;
+  for (int i = 0; i < 100; i++)
+    m[i] = boost::lexical_cast<std::string>(i);
+
+  flat_t copy(m);
+  for (flat_t::iterator it = m.begin(); it != m.end(); )
+    {
+      if (it->first % 3 == 0)
+        m.erase(it++);
+      else
+        ++it;
+    }
+  ENSURE_EQUAL(m.size(), 66u);
+  for (int i = 0; i < 100; i++)
+    ENSURE_EQUAL(m.count(i), i % 3 == 0 ? 0u : 1u);
+  ENSURE_EQUAL(copy.size(), 100u, "copies are independent");
+
+  m.clear();
+  ENSURE(m.empty());
+  ENSURE(m.begin() == m.end());
+}
@@ -0,0 +1,188 @@
+#include <I3Test.h>
+
+#include <icetray/I3FrameFifo.h>
+#include <icetray/I3Tray.h>
+#include <icetray/I3Int.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <vector>
+
+TEST_GROUP(I3FrameFifoTest);
+
+namespace {
+  I3FramePtr
+  numbered(int i)
+  {
+    I3FramePtr frame(new I3Frame(I3Frame::Physics));
+    frame->Put("Number", I3IntPtr(new I3Int(i)));
+    return frame;
+  }
+
+  int
+  number(const I3FramePtr& frame)
+  {
+    return frame->Get<I3Int>("Number").value;
+  }
+
+  void
+  produce(I3FrameFifo& fifo, int n)
+  {
+    for (int i = 0; i < n; i++)
+      while (!fifo.push(numbered(i)))
+        boost::this_thread::yield();
+  }
+}
+
+TEST(bounded)
+{
+  // not a power of two, so slots wrap before the limit does
+  I3FrameFifo fifo(3);
+  ENSURE_EQUAL(fifo.capacity(), 3u);
+  ENSURE(fifo.empty());
+  ENSURE(!fifo.front());
+
+  for (int round = 0; round < 5; round++)
+    {
+      for (int i = 0; i < 3; i++)
+        ENSURE(fifo.push(numbered(3*round + i)));
+      ENSURE(fifo.full());
+      ENSURE(!fifo.push(numbered(-1)), "a full fifo refuses frames");
+      ENSURE_EQUAL(number(fifo.front()), 3*round);
+
+      I3FramePtr frame;
+      for (int i = 0; i < 3; i++)
+        {
+          ENSURE(fifo.pop(frame));
+          ENSURE_EQUAL(number(frame), 3*round + i);
+        }
+      ENSURE(!fifo.pop(frame));
+    }
+
+  I3FrameFifo::Stats stats = fifo.GetStats();
+  ENSURE_EQUAL(stats.pushed, 15u);
+  ENSURE_EQUAL(stats.stalls, 5u);
+  ENSURE_EQUAL(stats.peak, 3u);
+  ENSURE_EQUAL(stats.highwater, 5u);
+}
+
+TEST(highwater)
+{
+  I3FrameFifo fifo(8);
+  fifo.SetHighWater(4);
+  I3FramePtr frame;
+  // hovering at 3-4 counts once; pushing at 2 again rearms the mark
+  for (int round = 0; round < 3; round++)
+    {
+      while (fifo.size() < 4)
+        fifo.push(numbered(0));
+      fifo.pop(frame);
+      fifo.push(numbered(0));
+      while (fifo.size() > 1)
+        fifo.pop(frame);
+    }
+  ENSURE_EQUAL(fifo.GetStats().highwater, 3u);
+  ENSURE_EQUAL(fifo.GetStats().stalls, 0u);
+
+  ENSURE(!fifo.empty());
+  try {
+    fifo.SetCapacity(16);
+    FAIL("resizing a fifo with frames in it should throw");
+  } catch (const std::exception&) { }
+}
+
+TEST(threads)
+{
+  const int n = 100000;
+  I3FrameFifo fifo(16);
+  boost::thread producer(boost::bind(produce, boost::ref(fifo), n));
+
+  I3FramePtr frame;
+  for (int i = 0; i < n; i++)
+    {
+      while (!fifo.pop(frame))
+        boost::this_thread::yield();
+      ENSURE_EQUAL(number(frame), i);
+    }
+  producer.join();
+  ENSURE(fifo.empty());
+  ENSURE(fifo.GetStats().peak <= 16u);
+}
+
+namespace {
+  struct FifoSource : public I3Module
+  {
+    int n_;
+    FifoSource(const I3Context& context) : I3Module(context), n_(0)
+    {
+      AddOutBox("OutBox");
+    }
+
+    void Process()
+    {
+      if (n_ == 50)
+        RequestSuspension();
+      else
+        PushFrame(numbered(n_++));
+    }
+  };
+
+  // pushes everything at once from Finish()
+  struct FifoHold : public I3Module
+  {
+    std::vector<I3FramePtr> held_;
+    FifoHold(const I3Context& context) : I3Module(context)
+    {
+      AddOutBox("OutBox");
+    }
+
+    void Physics(I3FramePtr frame)
+    {
+      held_.push_back(frame);
+    }
+
+    void Finish()
+    {
+      for (size_t i = 0; i < held_.size(); i++)
+        PushFrame(held_[i]);
+      held_.clear();
+    }
+  };
+
+  std::vector<int> seen;
+
+  struct FifoCount : public I3Module
+  {
+    FifoCount(const I3Context& context) : I3Module(context)
+    {
+      AddOutBox("OutBox");
+    }
+
+    void Physics(I3FramePtr frame)
+    {
+      seen.push_back(number(frame));
+      PushFrame(frame);
+    }
+  };
+}
+
+I3_MODULE(FifoSource);
+I3_MODULE(FifoHold);
+I3_MODULE(FifoCount);
+
+// A module pushing more frames than the fifo holds makes the next
+// module take them as it goes.
+TEST(tray_drains_full_fifo)
+{
+  seen.clear();
+  I3Tray tray;
+  tray.SetFifoCapacity(2);
+  tray.AddModule("FifoSource", "source");
+  tray.AddModule("FifoHold", "hold");
+  tray.AddModule("FifoCount", "count");
+  tray.Execute();
+
+  ENSURE_EQUAL(seen.size(), 50u);
+  for (int i = 0; i < 50; i++)
+    ENSURE_EQUAL(seen[i], i);
+}
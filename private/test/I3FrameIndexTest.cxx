@@ -0,0 +1,226 @@
+#include <I3Test.h>
+
+#include <icetray/I3FrameIndex.h>
+#include <icetray/I3Int.h>
+#include <icetray/open.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+TEST_GROUP(I3FrameIndexTest);
+
+namespace {
+  // G C D P P D P, with each frame's I3Int "n" holding its position
+  const char stops[] = "GCDPPDP";
+
+  void
+  write_file(const std::string& filename)
+  {
+    boost::iostreams::filtering_ostream ofs;
+    I3::dataio::open(ofs, filename);
+    for (int i = 0; stops[i]; i++)
+      {
+        I3Frame f(stops[i]);
+        f.Put("n", I3IntPtr(new I3Int(i)));
+        if (stops[i] == 'P')
+          f.Put("extra", I3IntPtr(new I3Int(-i)));
+        f.save(ofs);
+      }
+  }
+
+  // the same, with a zstd frame starting every two I3Frames
+  void
+  write_seekable(const std::string& filename)
+  {
+    boost::iostreams::filtering_ostream ofs;
+    I3::dataio::open_seekable(ofs, filename, 2, 0);
+    for (int i = 0; stops[i]; i++)
+      {
+        I3Frame f(stops[i]);
+        f.Put("n", I3IntPtr(new I3Int(i)));
+        if (stops[i] == 'P')
+          f.Put("extra", I3IntPtr(new I3Int(-i)));
+        I3::dataio::mark_frame(ofs, f.GetStop().id());
+        f.save(ofs);
+      }
+  }
+
+  void
+  check_index(const I3FrameIndex& index)
+  {
+    ENSURE_EQUAL(index.size(), sizeof(stops) - 1);
+    ENSURE_EQUAL(index[0].offset, 0u);
+    for (size_t i = 0; i < index.size(); i++)
+      {
+        ENSURE_EQUAL(index[i].stop, I3Frame::Stream(stops[i]));
+        ENSURE_EQUAL(index[i].keys.size(), stops[i] == 'P' ? 2u : 1u);
+        ENSURE_EQUAL(index[i].sizes.size(), index[i].keys.size());
+        if (i > 0)
+          ENSURE(index[i].offset > index[i-1].offset);
+      }
+
+    ENSURE_EQUAL(index.Find(I3Frame::Physics), 3u);
+    ENSURE_EQUAL(index.Find(I3Frame::Physics, 2), 6u);
+    ENSURE_EQUAL(index.Find(I3Frame::Physics, 3), I3FrameIndex::npos);
+    ENSURE_EQUAL(index.Find(I3Frame::DAQ), I3FrameIndex::npos);
+    ENSURE_EQUAL(index.Next(5, I3Frame::Physics), 6u);
+    ENSURE_EQUAL(index.Next(6, I3Frame::Physics), I3FrameIndex::npos);
+
+    std::vector<size_t> deps = index.Dependencies(6);
+    ENSURE_EQUAL(deps.size(), 3u);
+    ENSURE_EQUAL(deps[0], 0u);
+    ENSURE_EQUAL(deps[1], 1u);
+    ENSURE_EQUAL(deps[2], 5u);
+  }
+
+  void
+  seek_and_load(const std::string& filename, const I3FrameIndex& index)
+  {
+    for (size_t i = index.size(); i-- > 0; )
+      {
+        boost::iostreams::filtering_istream ifs;
+        I3::dataio::open(ifs, filename, index[i].offset);
+        I3Frame f;
+        ENSURE(f.load(ifs));
+        ENSURE_EQUAL(f.GetStop(), I3Frame::Stream(stops[i]));
+        ENSURE_EQUAL(f.Get<I3Int>("n").value, int(i));
+      }
+  }
+
+  void
+  test_file(const std::string& filename)
+  {
+    std::remove(filename.c_str());
+    std::remove(I3FrameIndex::SidecarName(filename).c_str());
+    write_file(filename);
+
+    I3FrameIndex index = I3FrameIndex::Build(filename);
+    check_index(index);
+    seek_and_load(filename, index);
+
+    // Open() writes the sidecar, and reads it back the next time
+    I3FrameIndex opened = I3FrameIndex::Open(filename);
+    check_index(opened);
+    I3FrameIndex reloaded;
+    ENSURE(reloaded.Load(I3FrameIndex::SidecarName(filename)));
+    ENSURE_EQUAL(reloaded.FileSize(), index.FileSize());
+    ENSURE_EQUAL(reloaded.FileTime(), index.FileTime());
+    check_index(reloaded);
+    for (size_t i = 0; i < index.size(); i++)
+      {
+        ENSURE_EQUAL(reloaded[i].offset, index[i].offset);
+        ENSURE(reloaded[i].keys == index[i].keys);
+        ENSURE(reloaded[i].sizes == index[i].sizes);
+      }
+
+    std::remove(filename.c_str());
+    std::remove(I3FrameIndex::SidecarName(filename).c_str());
+  }
+}
+
+TEST(plain)
+{
+  test_file(I3Test::testfile("frame_index.i3"));
+}
+
+TEST(zstd)
+{
+  test_file(I3Test::testfile("frame_index.i3.zst"));
+}
+
+TEST(seekable_zstd)
+{
+  const std::string filename = I3Test::testfile("frame_index_seekable.i3.zst");
+  write_seekable(filename);
+
+  std::vector<I3::dataio::seek_point> table = I3::dataio::seek_table(filename);
+  ENSURE_EQUAL(table.size(), 4u);
+  for (size_t i = 0; i < table.size(); i++)
+    {
+      ENSURE_EQUAL(table[i].frame, 2*i);
+      ENSURE_EQUAL(table[i].stop, stops[2*i]);
+      if (i > 0)
+        {
+          ENSURE(table[i].compressed > table[i-1].compressed);
+          ENSURE(table[i].uncompressed > table[i-1].uncompressed);
+        }
+    }
+
+  // the seek table doesn't get in the way of reading straight through,
+  // and seeking starts from the zstd frame holding each I3Frame
+  I3FrameIndex index = I3FrameIndex::Build(filename);
+  check_index(index);
+  for (size_t i = 0; i < table.size(); i++)
+    ENSURE_EQUAL(index[2*i].offset, table[i].uncompressed);
+  seek_and_load(filename, index);
+
+  ENSURE(I3::dataio::seek_table(I3Test::testfile("frame_index_missing.i3.zst")).empty());
+  std::remove(filename.c_str());
+}
+
+TEST(mapped)
+{
+  const std::string filename = I3Test::testfile("frame_index_mapped.i3");
+  write_file(filename);
+  I3FrameIndex index = I3FrameIndex::Build(filename);
+  I3::dataio::mapped_file_ptr file = I3::dataio::open_mapped(filename);
+
+  size_t n = index.Find(I3Frame::Physics, 1);
+  uint64_t offset = index[n].offset;
+  I3Frame f;
+  ENSURE(f.load(file, offset));
+  ENSURE_EQUAL(f.Get<I3Int>("n").value, 4);
+  for (size_t i = 0; i < index[n].keys.size(); i++)
+    ENSURE_EQUAL(f.size(index[n].keys[i]), index[n].sizes[i]);
+  std::remove(filename.c_str());
+}
+
+TEST(not_an_index)
+{
+  const std::string filename = I3Test::testfile("frame_index_bogus.idx");
+  {
+    std::ofstream ofs(filename.c_str());
+    ofs << "this is not an index";
+  }
+  I3FrameIndex index;
+  ENSURE(!index.Load(filename));
+  ENSURE(!index.Load(I3Test::testfile("frame_index_missing.idx")));
+  ENSURE(index.empty());
+  std::remove(filename.c_str());
+}
+
+TEST(stale_sidecar)
+{
+  const std::string filename = I3Test::testfile("frame_index_stale.i3");
+  write_file(filename);
+  I3FrameIndex first = I3FrameIndex::Open(filename);
+
+  // rewrite the file to the same size, with the first frame moved to
+  // the end, and make sure its time differs
+  {
+    std::ifstream ifs(filename.c_str(), std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(ifs)),
+                      std::istreambuf_iterator<char>());
+    ifs.close();
+    size_t split = first[1].offset;
+    std::ofstream ofs(filename.c_str(), std::ios::binary);
+    ofs << bytes.substr(split) << bytes.substr(0, split);
+  }
+  struct timespec times[2];
+  times[0].tv_sec = times[1].tv_sec = 1000000000;
+  times[0].tv_nsec = times[1].tv_nsec = 0;
+  ENSURE_EQUAL(utimensat(AT_FDCWD, filename.c_str(), times, 0), 0);
+
+  I3FrameIndex second = I3FrameIndex::Open(filename);
+  ENSURE_EQUAL(second.FileSize(), first.FileSize());
+  ENSURE(second.FileTime() != first.FileTime());
+  ENSURE_EQUAL(second[0].stop, I3Frame::Calibration);
+  ENSURE_EQUAL(second[second.size() - 1].stop, I3Frame::Geometry);
+
+  std::remove(filename.c_str());
+  std::remove(I3FrameIndex::SidecarName(filename).c_str());
+}
@@ -0,0 +1,118 @@
+#include <I3Test.h>
+
+#include <icetray/I3FrameKeyMatcher.h>
+#include <icetray/I3Frame.h>
+#include <icetray/I3Int.h>
+#include <sstream>
+
+TEST_GROUP(I3FrameKeyMatcherTest);
+
+namespace {
+  I3FrameKeyMatcher
+  make_matcher()
+  {
+    std::vector<std::string> patterns;
+    patterns.push_back("InIcePulses");        // exact
+    patterns.push_back("Offline.*");          // prefix
+    patterns.push_back("I3MCTree\\.bak");     // escaped, still exact
+    patterns.push_back(".*_L2");              // real regex
+    patterns.push_back("Fit[0-9]+Params");    // real regex
+    return I3FrameKeyMatcher(patterns);
+  }
+}
+
+TEST(empty)
+{
+  I3FrameKeyMatcher m;
+  ENSURE(m.empty());
+  ENSURE(!m(""));
+  ENSURE(!m("anything"));
+  ENSURE(I3FrameKeyMatcher(std::vector<std::string>()).empty());
+}
+
+TEST(exact)
+{
+  I3FrameKeyMatcher m = make_matcher();
+  ENSURE(!m.empty());
+  ENSURE(m("InIcePulses"));
+  ENSURE(!m("InIcePulsesHLC"));
+  ENSURE(!m("InIce"));
+  ENSURE(m("I3MCTree.bak"));
+  ENSURE(!m("I3MCTreeXbak"));
+}
+
+TEST(prefix)
+{
+  I3FrameKeyMatcher m = make_matcher();
+  ENSURE(m("Offline"));
+  ENSURE(m("OfflinePulses"));
+  ENSURE(!m("Offlin"));
+  ENSURE(!m("MyOffline"));
+
+  std::vector<std::string> all(1, ".*");
+  I3FrameKeyMatcher everything(all);
+  ENSURE(everything(""));
+  ENSURE(everything("foo"));
+}
+
+TEST(regex)
+{
+  I3FrameKeyMatcher m = make_matcher();
+  ENSURE(m("SplineMPE_L2"));
+  ENSURE(!m("SplineMPE_L2x"));
+  ENSURE(m("Fit12Params"));
+  ENSURE(!m("FitParams"));
+  // alternatives must each match the whole key
+  ENSURE(!m("Fit1Params_L"));
+}
+
+TEST(same_as_regex_match)
+{
+  // the matcher must agree with the per-pattern regex_match it replaces
+  std::vector<std::string> patterns;
+  patterns.push_back("a\\.*");
+  patterns.push_back("b|c");
+  patterns.push_back("\\d+");
+  I3FrameKeyMatcher m(patterns);
+  ENSURE(m("a"));
+  ENSURE(m("a..."));
+  ENSURE(!m("ab"));
+  ENSURE(m("b"));
+  ENSURE(m("c"));
+  ENSURE(!m("bc"));
+  ENSURE(m("123"));
+  ENSURE(!m("d"));
+  ENSURE_EQUAL(m.patterns().size(), patterns.size());
+}
+
+TEST(frame_skip)
+{
+  I3Frame f(I3Frame::Physics);
+  f.Put("InIcePulses", I3IntPtr(new I3Int(1)));
+  f.Put("OfflinePulses", I3IntPtr(new I3Int(2)));
+  f.Put("Fit3Params", I3IntPtr(new I3Int(3)));
+  f.Put("Kept", I3IntPtr(new I3Int(4)));
+
+  I3FrameKeyMatcher skip = make_matcher();
+  // save() and load() are instantiated for plain ostream/istream,
+  // not for stringstreams
+  std::stringstream ss;
+  std::ostream& os = ss;
+  std::istream& is = ss;
+  f.save(os, skip);
+
+  I3Frame g;
+  ENSURE(g.load(is));
+  ENSURE_EQUAL(g.size(), 1u);
+  ENSURE(g.Has("Kept"));
+
+  // and when skipping on load
+  std::stringstream ss2;
+  std::ostream& os2 = ss2;
+  std::istream& is2 = ss2;
+  f.save(os2);
+  I3Frame h;
+  ENSURE(h.load(is2, skip));
+  ENSURE_EQUAL(h.size(), 1u);
+  ENSURE_EQUAL(h.Get<I3Int>("Kept").value, 4);
+}
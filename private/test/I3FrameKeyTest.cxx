@@ -0,0 +1,88 @@
+#include <I3Test.h>
+
+#include <icetray/I3FrameKey.h>
+#include <icetray/I3Frame.h>
+#include <icetray/I3Int.h>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread/thread.hpp>
+
+TEST_GROUP(I3FrameKeyTest);
+
+TEST(interning)
+{
+  I3FrameKey a("I3FrameKeyTest_a"), b("I3FrameKeyTest_a"), c("I3FrameKeyTest_c");
+  ENSURE(a == b);
+  ENSURE(a != c);
+  ENSURE(&a.str() == &b.str(), "keys for one name share the string");
+  ENSURE_EQUAL(c.str(), "I3FrameKeyTest_c");
+  ENSURE_EQUAL(I3FrameKey::hash()(a), I3FrameKey::hash()(b));
+  ENSURE_EQUAL(I3FrameKey().str(), "");
+}
+
+TEST(find_does_not_intern)
+{
+  I3FrameKey key;
+  ENSURE(!I3FrameKey::Find("I3FrameKeyTest_never_interned", key));
+  ENSURE(key == I3FrameKey());
+
+  I3Frame frame;
+  ENSURE(!frame.Has("I3FrameKeyTest_never_interned"));
+  ENSURE(!frame.Get<I3IntConstPtr>("I3FrameKeyTest_never_interned"));
+  ENSURE(!I3FrameKey::Find("I3FrameKeyTest_never_interned", key));
+
+  I3FrameKey made("I3FrameKeyTest_made");
+  ENSURE(I3FrameKey::Find("I3FrameKeyTest_made", key));
+  ENSURE(key == made);
+}
+
+TEST(frame_access)
+{
+  I3FrameKey key("I3FrameKeyTest_int");
+  I3Frame frame;
+  frame.Put(key, boost::make_shared<I3Int>(3));
+  ENSURE(frame.Has(key));
+  ENSURE(frame.Has("I3FrameKeyTest_int"));
+  ENSURE_EQUAL(frame.Get<I3Int>(key).value, 3);
+  ENSURE_EQUAL(frame.Get<I3IntConstPtr>("I3FrameKeyTest_int")->value, 3);
+
+  frame.Put("I3FrameKeyTest_other", boost::make_shared<I3Int>(4));
+  ENSURE_EQUAL(frame.Get<I3Int>(I3FrameKey("I3FrameKeyTest_other")).value, 4);
+  frame.Delete("I3FrameKeyTest_int");
+  ENSURE(!frame.Has(key));
+  ENSURE(!frame.Get<I3IntConstPtr>(key));
+
+  try {
+    frame.Get<I3Int>(key);
+    FAIL("getting a missing key by reference should throw");
+  } catch (const std::exception&) { }
+}
+
+namespace {
+  void intern_many(unsigned offset, unsigned n)
+  {
+    for (unsigned i = 0; i < n; i++)
+      {
+        std::string name = "I3FrameKeyTest_thread_" +
+          boost::lexical_cast<std::string>((i + offset) % n);
+        I3FrameKey key(name);
+        if (key.str() != name)
+          log_fatal("interned \"%s\" as \"%s\"", name.c_str(), key.str().c_str());
+      }
+  }
+}
+
+TEST(concurrent_interning)
+{
+  // enough names that the table grows while other threads read it
+  boost::thread_group threads;
+  for (unsigned t = 0; t < 4; t++)
+    threads.create_thread(boost::bind(intern_many, 1250 * t, 5000));
+  threads.join_all();
+
+  I3FrameKey key;
+  for (unsigned i = 0; i < 5000; i++)
+    ENSURE(I3FrameKey::Find("I3FrameKeyTest_thread_" +
+                            boost::lexical_cast<std::string>(i), key));
+}
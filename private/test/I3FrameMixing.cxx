@@ -457,3 +457,86 @@ TEST(MostRecentMixedStream_NoMixing){
 		ENSURE_EQUAL(*s,I3Frame::DAQ,"Should find correct previous stream");
 	}
 }
+
+TEST(MixedKeysAreOverlaid){
+	I3Frame q1(I3Frame::DAQ);
+	q1.Put("i1",boost::make_shared<I3Int>(1));
+	I3Frame p1(I3Frame::Physics);
+	p1.Put("i2",boost::make_shared<I3Int>(2));
+	
+	I3FrameMixer mixer;
+	mixer.Mix(q1);
+	mixer.Mix(p1);
+	ENSURE(p1.Get<I3IntConstPtr>("i1")==q1.Get<I3IntConstPtr>("i1"),
+	       "Mixed keys should refer to the parent's objects");
+	ENSURE_EQUAL(p1.size(),2UL);
+	ENSURE_EQUAL(p1.GetStop("i1"),I3Frame::DAQ);
+	
+	//a new Q frame must not change what earlier P frames see
+	I3Frame q2(I3Frame::DAQ);
+	q2.Put("i1",boost::make_shared<I3Int>(3));
+	mixer.Mix(q2);
+	I3Frame p2(I3Frame::Physics);
+	mixer.Mix(p2);
+	ENSURE_EQUAL(p1.Get<I3Int>("i1").value,1);
+	ENSURE_EQUAL(p2.Get<I3Int>("i1").value,3);
+	
+	//changing mixed keys in a child leaves the parent alone
+	p1.Delete("i1");
+	ENSURE(!p1.Has("i1"));
+	ENSURE(p2.Has("i1"),"Deleting from one child should not affect another");
+	p2.Rename("i1","i3");
+	ENSURE(!p2.Has("i1") && p2.Has("i3"));
+	ENSURE(q2.Has("i1"));
+	
+	//iterating sees mixed keys too
+	I3Frame p3(I3Frame::Physics);
+	mixer.Mix(p3);
+	unsigned n=0;
+	for(I3Frame::typename_iterator it=p3.typename_begin(); it!=p3.typename_end(); it++)
+		n++;
+	ENSURE_EQUAL(n,1u);
+	
+	//copies and re-mixing keep working
+	I3Frame p4(p3);
+	ENSURE(p4.Has("i1"));
+	mixer.Mix(p4);
+	ENSURE_EQUAL(p4.keys().size(),1UL);
+}
+
+TEST(SharedSnapshots){
+	I3FrameSnapshotsPtr snapshots=boost::make_shared<I3FrameSnapshots>();
+	I3FrameMixer upstream, downstream, changer;
+	upstream.ShareSnapshots(snapshots);
+	downstream.ShareSnapshots(snapshots);
+	changer.ShareSnapshots(snapshots);
+	
+	I3Frame q(I3Frame::DAQ);
+	q.Put("i1",boost::make_shared<I3Int>(1));
+	upstream.Mix(q);
+	downstream.Mix(q);
+	ENSURE(upstream.GetMixedFrames(I3Frame::Physics)[0]==
+	       downstream.GetMixedFrames(I3Frame::Physics)[0],
+	       "Mixers should share the entry for an unchanged frame");
+	
+	//a module that changes the frame gets its own entry
+	q.Put("i2",boost::make_shared<I3Int>(2));
+	changer.Mix(q);
+	ENSURE(changer.GetMixedFrames(I3Frame::Physics)[0]!=
+	       upstream.GetMixedFrames(I3Frame::Physics)[0]);
+	
+	I3Frame p(I3Frame::Physics);
+	upstream.Mix(p);
+	ENSURE(p.Has("i1") && !p.Has("i2"),
+	       "Frames should see the parents as their mixer last saw them");
+	downstream.Mix(p);
+	ENSURE(!p.Has("i2"));
+	changer.Mix(p);
+	ENSURE(p.Has("i2"));
+	
+	//keys put on other streams are still purged
+	p.Put("i3",boost::make_shared<I3Int>(3),I3Frame::DAQ);
+	changer.Mix(p);
+	ENSURE(!p.Has("i3"));
+	ENSURE(p.Has("i1") && p.Has("i2"));
+}
@@ -32,10 +32,15 @@
 #include <icetray/I3FrameObject.h>
 #include <icetray/serialization.h>
 #include <icetray/open.h>
+#include <map>
 #include <string>
 #include <fstream>
+#include <sstream>
 
 #include <boost/iostreams/filtering_stream.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
 namespace io = boost::iostreams;
 
 using namespace std;
@@ -566,3 +571,275 @@ TEST(putspacefilledstringframeobjname)
   } catch (const std::exception& e) { }
 }
 
+
+TEST(load_mapped)
+{
+  const std::string filename = "mapped.i3";
+  unlink(filename.c_str());
+  {
+    I3Frame f(I3Frame::DAQ), g(I3Frame::Physics);
+    f.Put("i", I3IntPtr(new I3Int(661)));
+    f.Put("j", I3IntPtr(new I3Int(662)));
+    g.Put("k", I3IntPtr(new I3Int(663)));
+    std::ofstream ofs(filename.c_str(), std::ios::binary);
+    f.save(ofs);
+    g.save(ofs);
+  }
+
+  I3FramePtr f(new I3Frame), g(new I3Frame);
+  f->drop_blobs(false);
+  {
+    I3::dataio::mapped_file_ptr file = I3::dataio::open_mapped(filename);
+    uint64_t offset = 0;
+    ENSURE(f->load(file, offset));
+    ENSURE(offset > 0u);
+    ENSURE(g->load(file, offset, std::vector<std::string>()));
+    ENSURE_EQUAL(offset, uint64_t(file->size()));
+    I3Frame h;
+    ENSURE(!h.load(file, offset));
+    // the frames now hold the only references to the mapping
+  }
+
+  ENSURE_EQUAL(f->GetStop(), I3Frame::DAQ);
+  ENSURE_EQUAL(g->GetStop(), I3Frame::Physics);
+  ENSURE(f->has_blob("i"));
+  ENSURE(!f->has_ptr("i"));
+  ENSURE_EQUAL(f->type_name("j"), icetray::name_of<I3Int>());
+  ENSURE_EQUAL(f->Get<I3Int>("i").value, 661);
+  ENSURE_EQUAL(f->Get<I3Int>("j").value, 662);
+  ENSURE_EQUAL(g->Get<I3Int>("k").value, 663);
+
+  // writing a frame that still points into the mapping gives the same
+  // bytes as the frame it was read from
+  I3FramePtr f2 = saveload(*f, "mapped2.i3");
+  ENSURE_EQUAL(f2->Get<I3Int>("i").value, 661);
+  ENSURE_EQUAL(f2->Get<I3Int>("j").value, 662);
+
+  remove(filename.c_str());
+}
+
+TEST(load_mapped_skip)
+{
+  const std::string filename = "mapped_skip.i3";
+  unlink(filename.c_str());
+  {
+    I3Frame f(I3Frame::Physics);
+    f.Put("keep", I3IntPtr(new I3Int(1)));
+    f.Put("skip", I3IntPtr(new I3Int(2)));
+    std::ofstream ofs(filename.c_str(), std::ios::binary);
+    f.save(ofs);
+  }
+
+  I3Frame f;
+  uint64_t offset = 0;
+  ENSURE(f.load(I3::dataio::open_mapped(filename), offset,
+                std::vector<std::string>(1, "sk.*")));
+  ENSURE(f.Has("keep"));
+  ENSURE(!f.Has("skip"));
+  ENSURE_EQUAL(f.Get<I3Int>("keep").value, 1);
+
+  remove(filename.c_str());
+}
+
+TEST(prefetch)
+{
+  I3Frame f;
+  for (int i = 0; i < 50; i++)
+    f.Put("k" + boost::lexical_cast<std::string>(i), I3IntPtr(new I3Int(i)));
+  I3FramePtr fp = saveload(f, "prefetch.i3");
+
+  std::vector<std::string> keys;
+  for (int i = 0; i < 50; i += 2)
+    keys.push_back("k" + boost::lexical_cast<std::string>(i));
+  keys.push_back("not_there");
+
+  I3ThreadPool pool(4);
+  fp->Prefetch(keys, pool);
+  // a second request for the same keys is a no-op
+  fp->Prefetch(keys, pool);
+  // copies share the prefetched objects
+  I3Frame copy(*fp);
+
+  for (int i = 0; i < 50; i++)
+    {
+      std::string key = "k" + boost::lexical_cast<std::string>(i);
+      ENSURE_EQUAL(fp->Get<I3Int>(key).value, i);
+      ENSURE(fp->has_ptr(key));
+      ENSURE_EQUAL(copy.Get<I3Int>(key).value, i);
+    }
+  ENSURE(!fp->Has("not_there"));
+
+  // writing a frame with prefetches in flight is still safe
+  I3FramePtr again = saveload(*fp, "prefetch2.i3");
+  again->Prefetch(keys, pool);
+  I3FramePtr thrice = saveload(*again, "prefetch3.i3");
+  ENSURE_EQUAL(thrice->Get<I3Int>("k48").value, 48);
+}
+
+namespace {
+  void read_ints(I3FramePtr frame, int n, int& sum)
+  {
+    for (int i = 0; i < n; i++)
+      sum += frame->Get<I3Int>("k" + boost::lexical_cast<std::string>(i)).value;
+  }
+}
+
+// Several worker lanes read a key they share through the same parent,
+// which nobody prefetched, and only some of them drop blobs.
+TEST(concurrent_parent_get)
+{
+  const int n = 50, nthreads = 4;
+  I3Frame d(I3Frame::DetectorStatus);
+  for (int i = 0; i < n; i++)
+    d.Put("k" + boost::lexical_cast<std::string>(i), I3IntPtr(new I3Int(i)));
+  std::ostringstream saved;
+  d.save(static_cast<std::ostream&>(saved));
+
+  for (int round = 0; round < 20; round++)
+    {
+      std::istringstream is(saved.str());
+      boost::shared_ptr<I3Frame> parent(new I3Frame);
+      parent->drop_blobs(false);
+      ENSURE(parent->load(static_cast<std::istream&>(is)));
+
+      std::vector<I3FramePtr> lanes;
+      std::vector<int> sums(nthreads, 0);
+      boost::thread_group threads;
+      for (int t = 0; t < nthreads; t++)
+        {
+          lanes.push_back(I3FramePtr(new I3Frame(I3Frame::Physics)));
+          lanes.back()->drop_blobs(t % 2 == 0);
+          lanes.back()->overlay(parent);
+        }
+      for (int t = 0; t < nthreads; t++)
+        threads.create_thread(boost::bind(read_ints, lanes[t], n,
+                                          boost::ref(sums[t])));
+      threads.join_all();
+      for (int t = 0; t < nthreads; t++)
+        ENSURE_EQUAL(sums[t], n * (n - 1) / 2);
+    }
+}
+
+namespace {
+  I3FramePtr many_ints(int n)
+  {
+    I3FramePtr f(new I3Frame);
+    for (int i = 0; i < n; i++)
+      f->Put("k" + boost::lexical_cast<std::string>(i), I3IntPtr(new I3Int(7*i)));
+    return f;
+  }
+}
+
+TEST(parallel_save)
+{
+  I3ThreadPool pool(4);
+
+  // save() and load() are instantiated for plain ostream/istream, not
+  // for stringstreams
+  std::ostringstream serial;
+  many_ints(40)->save(static_cast<std::ostream&>(serial));
+
+  // the same bytes, whether or not the objects were serialized in parallel
+  std::ostringstream parallel;
+  many_ints(40)->save(static_cast<std::ostream&>(parallel),
+                      I3FrameKeyMatcher(), &pool);
+  ENSURE(serial.str() == parallel.str());
+
+  I3FramePtr h = many_ints(40);
+  h->create_blobs(false, I3FrameKeyMatcher(), &pool);
+  for (int i = 0; i < 40; i++)
+    {
+      std::string key = "k" + boost::lexical_cast<std::string>(i);
+      ENSURE(h->has_blob(key));
+      ENSURE(h->has_ptr(key));
+    }
+  std::ostringstream from_blobs;
+  h->save(static_cast<std::ostream&>(from_blobs));
+  ENSURE(serial.str() == from_blobs.str());
+
+  std::istringstream is(parallel.str());
+  I3Frame loaded;
+  ENSURE(loaded.load(static_cast<std::istream&>(is)));
+  ENSURE_EQUAL(loaded.Get<I3Int>("k39").value, 7*39);
+}
+
+TEST(copy_on_write)
+{
+  I3Frame f(I3Frame::Physics);
+  f.Put("a", I3IntPtr(new I3Int(1)));
+  f.Put("b", I3IntPtr(new I3Int(2)));
+  f.Put("g", I3IntPtr(new I3Int(3)), I3Frame::Geometry);
+
+  I3Frame g(f), h, p(f);
+  h = f;
+
+  // changes to a copy stay in that copy
+  g.Put("c", I3IntPtr(new I3Int(4)));
+  g.Delete("a");
+  h.Rename("b", "bb");
+  h.ChangeStream("g", I3Frame::Physics);
+  p.purge();
+
+  ENSURE_EQUAL(f.size(), 3u);
+  ENSURE(f.Has("a") && f.Has("b") && f.Has("g") && !f.Has("c"));
+  ENSURE_EQUAL(f.GetStop("g"), I3Frame::Geometry);
+  ENSURE(g.Has("c") && !g.Has("a") && g.Has("b"));
+  ENSURE(h.Has("bb") && !h.Has("b"));
+  ENSURE_EQUAL(h.GetStop("g"), I3Frame::Physics);
+  ENSURE_EQUAL(p.size(), 2u);
+  ENSURE(!p.Has("g"));
+
+  // ...and vice versa
+  I3Frame q(f);
+  f.Delete("b");
+  ENSURE(q.Has("b"));
+
+  // the objects themselves are shared
+  ENSURE(f.Get<I3IntConstPtr>("a") == q.Get<I3IntConstPtr>("a"));
+  ENSURE_EQUAL(q.Get<I3Int>("b").value, 2);
+}
+
+TEST(overlay_iterator)
+{
+  boost::shared_ptr<I3Frame> p1(new I3Frame(I3Frame::Geometry));
+  p1->Put("a", I3IntPtr(new I3Int(1)));
+  p1->Put("b", I3IntPtr(new I3Int(2)));
+  boost::shared_ptr<I3Frame> p2(new I3Frame(I3Frame::Calibration));
+  p2->Put("b", I3IntPtr(new I3Int(3)));
+  p2->Put("c", I3IntPtr(new I3Int(4)));
+
+  I3Frame f(I3Frame::Physics);
+  f.Put("d", I3IntPtr(new I3Int(5)));
+  f.overlay(p1);
+  f.overlay(p2);
+
+  // each key once, with the value Get() sees: p1 hides p2's "b"
+  std::map<std::string, int> seen;
+  for (I3Frame::const_iterator iter = f.begin(); iter != f.end(); iter++)
+    {
+      ENSURE(!seen.count(iter->first));
+      seen[iter->first] = boost::dynamic_pointer_cast<const I3Int>(iter->second)->value;
+    }
+  ENSURE_EQUAL(seen.size(), 4u);
+  ENSURE_EQUAL(seen["a"], 1);
+  ENSURE_EQUAL(seen["b"], 2);
+  ENSURE_EQUAL(seen["c"], 4);
+  ENSURE_EQUAL(seen["d"], 5);
+
+  unsigned n = 0;
+  for (I3Frame::typename_iterator iter = f.typename_begin();
+       iter != f.typename_end(); iter++, n++)
+    ENSURE_EQUAL(iter->second, icetray::name_of<I3Int>());
+  ENSURE_EQUAL(n, 4u);
+
+  I3Frame::const_iterator iter = f.find("b");
+  ENSURE(iter != f.end());
+  ENSURE_EQUAL(boost::dynamic_pointer_cast<const I3Int>(iter->second)->value, 2);
+  ENSURE(f.find("e") == f.end());
+  ENSURE(f.typename_find("c") != f.typename_end());
+  ENSURE(f.typename_find("e") == f.typename_end());
+
+  // parents are left as they were
+  ENSURE_EQUAL(p1->size(), 2u);
+  ENSURE_EQUAL(p2->size(), 2u);
+}
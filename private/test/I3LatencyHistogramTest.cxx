@@ -0,0 +1,80 @@
+#include <I3Test.h>
+
+#include <icetray/I3LatencyHistogram.h>
+#include <icetray/I3Tray.h>
+#include <icetray/I3Module.h>
+
+#include <cmath>
+#include <map>
+#include <string>
+
+TEST_GROUP(I3LatencyHistogramTest);
+
+TEST(quantiles_within_a_bin)
+{
+  I3LatencyHistogram h;
+  ENSURE_EQUAL(h.GetQuantile(0.5), 0.0);
+
+  // 1..1000 microseconds
+  for (unsigned i = 1; i <= 1000; i++)
+    h.Add(i * 1000);
+  ENSURE_EQUAL(h.GetCount(), 1000u);
+  ENSURE_DISTANCE(h.GetMax(), 1e-3, 1e-12);
+  ENSURE(std::fabs(h.GetQuantile(0.5) - 500e-6) < 0.25 * 500e-6);
+  ENSURE(std::fabs(h.GetQuantile(0.99) - 990e-6) < 0.25 * 990e-6);
+  ENSURE(h.GetQuantile(1.0) <= h.GetMax());
+
+  I3LatencyHistogram other;
+  other.Add(5000000000ull);
+  h.Merge(other);
+  ENSURE_EQUAL(h.GetCount(), 1001u);
+  ENSURE_DISTANCE(h.GetMax(), 5.0, 1e-9);
+  ENSURE(std::fabs(h.GetQuantile(0.5) - 500e-6) < 0.25 * 500e-6);
+
+  h.Clear();
+  ENSURE_EQUAL(h.GetCount(), 0u);
+  h.Add(0);
+  h.Add(3);
+  ENSURE_EQUAL(h.GetQuantile(0.0), 0.0);
+  ENSURE_DISTANCE(h.GetQuantile(1.0), 3e-9, 1e-15);
+}
+
+namespace {
+  struct LatencySource : public I3Module
+  {
+    unsigned n_;
+    LatencySource(const I3Context& context) : I3Module(context), n_(0)
+    {
+      AddOutBox("OutBox");
+    }
+
+    void Process()
+    {
+      if (n_++ % 10 == 0)
+        PushFrame(I3FramePtr(new I3Frame(I3Frame::Geometry)));
+      PushFrame(I3FramePtr(new I3Frame(I3Frame::Physics)));
+    }
+  };
+}
+
+I3_MODULE(LatencySource);
+
+// Every stream is timed, and the tray reports it.
+TEST(usage_by_stream)
+{
+  I3Tray tray;
+  tray.AddModule("LatencySource", "source");
+  tray.AddModule("Keep", "keep");
+  tray.Execute(20);
+
+  std::map<std::string, I3PhysicsUsage> usage = tray.Usage();
+  I3PhysicsUsage& keep = usage["keep"];
+  ENSURE_EQUAL(keep.streams["Physics"].ncall, 20u);
+  ENSURE_EQUAL(keep.streams["Geometry"].ncall, 2u);
+  ENSURE(keep.p50 <= keep.p99);
+  ENSURE(keep.p99 <= keep.max);
+  ENSURE(keep.walltime >= keep.max);
+
+  // the driving module's calls have no frame to go by
+  ENSURE_EQUAL(usage["source"].streams["None"].ncall, 20u);
+}
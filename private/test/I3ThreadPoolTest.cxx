@@ -0,0 +1,173 @@
+#include <I3Test.h>
+
+#include <icetray/I3ThreadPool.h>
+#include <icetray/I3Tray.h>
+#include <icetray/I3Int.h>
+#include <icetray/open.h>
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+TEST_GROUP(I3ThreadPoolTest);
+
+namespace {
+  boost::mutex counter_mtx;
+
+  void increment(unsigned& counter)
+  {
+    boost::lock_guard<boost::mutex> lock(counter_mtx);
+    counter++;
+  }
+
+  void fail()
+  {
+    throw std::runtime_error("task failed");
+  }
+
+  void run_tasks(unsigned nthreads)
+  {
+    unsigned counter = 0;
+    {
+      I3ThreadPool pool(nthreads);
+      ENSURE_EQUAL(pool.size(), nthreads);
+      std::vector<I3ThreadPool::TaskPtr> tasks;
+      for (unsigned i = 0; i < 1000; i++)
+        tasks.push_back(pool.Submit(boost::bind(increment, boost::ref(counter))));
+      for (unsigned i = 0; i < tasks.size(); i++)
+        {
+          tasks[i]->Wait();
+          ENSURE(tasks[i]->Done());
+        }
+      ENSURE_EQUAL(counter, 1000u);
+
+      // left queued: the destructor finishes them
+      for (unsigned i = 0; i < 100; i++)
+        pool.Submit(boost::bind(increment, boost::ref(counter)));
+    }
+    ENSURE_EQUAL(counter, 1100u);
+  }
+}
+
+TEST(inline_pool)
+{
+  run_tasks(0);
+}
+
+TEST(threaded_pool)
+{
+  run_tasks(1);
+  run_tasks(4);
+}
+
+TEST(exceptions_reach_waiter)
+{
+  I3ThreadPool pool(2);
+  I3ThreadPool::TaskPtr task = pool.Submit(fail);
+  std::string what;
+  try {
+    task->Wait();
+  } catch (const std::runtime_error& e) {
+    what = e.what();
+  }
+  ENSURE_EQUAL(what, std::string("task failed"));
+}
+
+namespace {
+  const std::string prefetch_file = "prefetch_tray.i3";
+  unsigned frames_loaded;
+
+  // reads frames back out of prefetch_file
+  struct FileSource : public I3Module
+  {
+    boost::iostreams::filtering_istream ifs_;
+
+    FileSource(const I3Context& context) : I3Module(context)
+    {
+      AddOutBox("OutBox");
+    }
+
+    void Configure()
+    {
+      I3::dataio::open(ifs_, prefetch_file);
+    }
+
+    void Process()
+    {
+      I3FramePtr frame(new I3Frame);
+      if (!frame->load(ifs_))
+        {
+          RequestSuspension();
+          return;
+        }
+      frames_loaded++;
+      PushFrame(frame);
+    }
+  };
+
+  // asks for "a" and "b" ahead of time
+  struct PrefetchingModule : public I3Module
+  {
+    unsigned nframes_;
+
+    PrefetchingModule(const I3Context& context) : I3Module(context), nframes_(0)
+    {
+      AddOutBox("OutBox");
+    }
+
+    void Configure()
+    {
+      std::vector<std::string> keys;
+      keys.push_back("a");
+      keys.push_back("b");
+      Prefetch(keys);
+    }
+
+    void Physics(I3FramePtr frame)
+    {
+      // the next frame was pushed, and started deserializing, first
+      ENSURE_EQUAL(frames_loaded, std::min(nframes_ + 2, 100u));
+      ENSURE_EQUAL(frame->Get<I3Int>("a").value, int(nframes_));
+      ENSURE_EQUAL(frame->Get<I3Int>("b").value, -int(nframes_));
+      ENSURE_EQUAL(frame->Get<I3Int>("c").value, 2*int(nframes_));
+      nframes_++;
+      PushFrame(frame);
+    }
+
+    void Finish()
+    {
+      ENSURE_EQUAL(nframes_, 100u);
+    }
+  };
+}
+
+I3_MODULE(FileSource);
+I3_MODULE(PrefetchingModule);
+
+TEST(tray_prefetch)
+{
+  {
+    boost::iostreams::filtering_ostream ofs;
+    I3::dataio::open(ofs, prefetch_file);
+    for (int i = 0; i < 100; i++)
+      {
+        I3Frame frame(I3Frame::Physics);
+        frame.Put("a", I3IntPtr(new I3Int(i)));
+        frame.Put("b", I3IntPtr(new I3Int(-i)));
+        frame.Put("c", I3IntPtr(new I3Int(2*i)));
+        frame.save(ofs);
+      }
+  }
+
+  frames_loaded = 0;
+  I3Tray tray;
+  tray.SetThreadPoolSize(2);
+  tray.AddModule("FileSource");
+  tray.AddModule("PrefetchingModule");
+  tray.Execute();
+
+  std::remove(prefetch_file.c_str());
+}
@@ -0,0 +1,100 @@
+#include <I3Test.h>
+
+#include <icetray/I3Tracer.h>
+#include <icetray/I3Tray.h>
+#include <icetray/I3Module.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+TEST_GROUP(I3TracerTest);
+
+namespace {
+  std::string
+  trace_path()
+  {
+    std::ostringstream path;
+    path << "I3TracerTest-" << getpid() << ".json";
+    return path.str();
+  }
+
+  std::string
+  slurp(const std::string& path)
+  {
+    std::ifstream is(path.c_str());
+    std::ostringstream contents;
+    contents << is.rdbuf();
+    return contents.str();
+  }
+
+  size_t
+  count(const std::string& haystack, const std::string& needle)
+  {
+    size_t n = 0;
+    for (size_t pos = haystack.find(needle); pos != std::string::npos;
+         pos = haystack.find(needle, pos + 1))
+      n++;
+    return n;
+  }
+
+  struct TracedSource : public I3Module
+  {
+    TracedSource(const I3Context& context) : I3Module(context)
+    {
+      AddOutBox("OutBox");
+    }
+
+    void Process()
+    {
+      PushFrame(I3FramePtr(new I3Frame(I3Frame::Physics)));
+    }
+  };
+}
+
+I3_MODULE(TracedSource);
+
+TEST(nothing_while_off)
+{
+  const std::string path = trace_path();
+  const std::string name = "scope";
+  I3Tracer::Start();
+  {
+    I3TraceScope scope("test", name, 'P', 3);
+  }
+  I3Tracer::Stop();
+  ENSURE(!I3Tracer::IsEnabled());
+  {
+    I3TraceScope scope("test", name);
+  }
+  I3Tracer::Write(path);
+
+  std::string trace = slurp(path);
+  unlink(path.c_str());
+  ENSURE_EQUAL(count(trace, "\"name\":\"scope\""), 1u);
+  ENSURE_EQUAL(count(trace, "\"args\":{\"stop\":\"P\",\"seq\":3}"), 1u);
+}
+
+TEST(tray_timeline)
+{
+  const std::string path = trace_path();
+  {
+    I3Tray tray;
+    tray.SetTraceFile(path);
+    tray.AddModule("TracedSource", "source");
+    tray.AddModule("Keep", "keep");
+    tray.Execute(5);
+    ENSURE(!I3Tracer::IsEnabled());
+  }
+
+  std::string trace = slurp(path);
+  unlink(path.c_str());
+  ENSURE_EQUAL(trace.compare(0, 2, "{\""), 0);
+  ENSURE_EQUAL(count(trace, "\"name\":\"keep\",\"cat\":\"module\""), 5u);
+  ENSURE_EQUAL(count(trace, "\"name\":\"keep\",\"cat\":\"configure\""), 1u);
+  ENSURE_EQUAL(count(trace, "\"name\":\"keep\",\"cat\":\"finish\""), 1u);
+  // the fifth Physics frame keep saw
+  ENSURE_EQUAL(count(trace, "\"stop\":\"P\",\"seq\":4}"), 1u);
+}
@@ -0,0 +1,89 @@
+#include <I3Test.h>
+
+#include <icetray/I3Tray.h>
+#include <icetray/I3Module.h>
+
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "icetray/I3MetricsServer.h"
+
+TEST_GROUP(MetricsTest);
+
+namespace {
+  struct MetricsSource : public I3Module
+  {
+    MetricsSource(const I3Context& context) : I3Module(context)
+    {
+      AddOutBox("OutBox");
+    }
+
+    void Process()
+    {
+      PushFrame(I3FramePtr(new I3Frame(I3Frame::DAQ)));
+      PushFrame(I3FramePtr(new I3Frame(I3Frame::Physics)));
+    }
+  };
+
+  std::string
+  fetch(const std::string& path)
+  {
+    struct sockaddr_un sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    ENSURE(fd >= 0);
+    ENSURE_EQUAL(connect(fd, (struct sockaddr*)&sa, sizeof(sa)), 0);
+    const char request[] = "GET /metrics HTTP/1.0\r\n\r\n";
+    ENSURE_EQUAL(send(fd, request, sizeof(request) - 1, 0),
+                 ssize_t(sizeof(request) - 1));
+    std::string response;
+    char buf[1024];
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0)
+      response.append(buf, n);
+    close(fd);
+    return response;
+  }
+}
+
+I3_MODULE(MetricsSource);
+
+TEST(tray_metrics)
+{
+  I3Tray tray;
+  tray.AddModule("MetricsSource", "source");
+  tray.AddModule("Keep", "keep");
+  tray.Execute(5);
+
+  std::string metrics = tray.Metrics();
+  ENSURE(metrics.find("icetray_frames_total{stream=\"DAQ\"} 5\n")
+         != std::string::npos, metrics.c_str());
+  ENSURE(metrics.find("icetray_frames_total{stream=\"Physics\"} 5\n")
+         != std::string::npos);
+  ENSURE(metrics.find("icetray_module_calls_total{module=\"keep\","
+                      "stream=\"Physics\"} 5\n") != std::string::npos);
+  ENSURE(metrics.find("icetray_queue_pushed_total{module=\"source\","
+                      "outbox=\"OutBox\"} 10\n") != std::string::npos);
+  ENSURE(metrics.find("icetray_module_latency_seconds{module=\"keep\","
+                      "quantile=\"0.99\"}") != std::string::npos);
+  ENSURE(metrics.find("icetray_io_read_bytes_total ") != std::string::npos);
+}
+
+TEST(unix_socket)
+{
+  std::ostringstream path;
+  path << "MetricsTest-" << getpid() << ".sock";
+
+  I3MetricsServer server("unix:" + path.str());
+  server.Publish("icetray_test 1\n");
+  std::string response = fetch(path.str());
+  ENSURE_EQUAL(response.compare(0, 15, "HTTP/1.0 200 OK"), 0);
+  // nobody publishes a fresh one, so the last snapshot is served
+  ENSURE(response.find("\r\n\r\nicetray_test 1\n") != std::string::npos);
+}
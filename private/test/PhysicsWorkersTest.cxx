@@ -0,0 +1,105 @@
+#include <I3Test.h>
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/thread/thread.hpp>
+
+#include <icetray/I3Tray.h>
+#include <icetray/I3Frame.h>
+#include <icetray/I3Module.h>
+#include <icetray/I3Int.h>
+
+#include "EventModules.h"
+
+TEST_GROUP(PhysicsWorkers);
+
+namespace {
+  // keeps the detector status it was shown, as each instance must
+  struct WorkersCalibrate : public I3Module
+  {
+    int status_;
+
+    WorkersCalibrate(const I3Context& context) : I3Module(context), status_(-1)
+    {
+      AddOutBox("OutBox");
+      SetConcurrency(PerWorker);
+    }
+
+    void DetectorStatus(I3FramePtr frame)
+    {
+      status_ = frame->Get<I3Int>("Status").value;
+      PushFrame(frame);
+    }
+
+    void Physics(I3FramePtr frame)
+    {
+      ENSURE_EQUAL(event_int(*frame, "Status"), status_);
+      frame->Put("Calibrated", I3IntPtr(new I3Int(
+        100 * event_int(*frame, "Event") + 10 * status_ +
+        event_int(*frame, "Sub"))));
+      PushFrame(frame);
+    }
+  };
+
+  struct WorkersReconstruct : public I3Module
+  {
+    WorkersReconstruct(const I3Context& context) : I3Module(context)
+    {
+      AddOutBox("OutBox");
+      SetConcurrency(ThreadSafe);
+    }
+
+    void Physics(I3FramePtr frame)
+    {
+      // give the others a chance to overtake
+      for (int i = event_int(*frame, "Event") % 7; i > 0; i--)
+        boost::this_thread::yield();
+      frame->Put("Reco",
+                 I3IntPtr(new I3Int(2 * event_int(*frame, "Calibrated"))));
+      PushFrame(frame);
+    }
+  };
+
+  std::map<std::string, std::vector<std::string> >
+  run(unsigned nworkers, bool split)
+  {
+    event_log.clear();
+    I3Tray tray;
+    tray.SetPhysicsWorkers(nworkers);
+    tray.AddModule("EventSource")
+      ("Events", 40)
+      ("StatusEvery", 10)
+      ("LonePhysics", true);
+    tray.AddModule("WorkersCalibrate");
+    if (split)
+      tray.AddModule("EventRecord", "between");
+    tray.AddModule("WorkersReconstruct");
+    tray.AddModule("EventRecord", "last");
+    tray.Execute();
+    return event_log.records;
+  }
+}
+
+I3_MODULE(WorkersCalibrate);
+I3_MODULE(WorkersReconstruct);
+
+TEST(same_frames_as_serial)
+{
+  std::vector<std::string> serial = run(0, false)["last"];
+  ENSURE_EQUAL(serial.size(), 127u);
+  ENSURE_EQUAL(serial.back(), std::string("P 3 39 1 3931 7862"));
+
+  for (unsigned n = 1; n <= 4; n++)
+    ENSURE(run(n, false)["last"] == serial,
+           "frames leave the workers as they would have left the modules");
+}
+
+// Each module sees the same frames; when, relative to the other
+// modules, is up to the workers.
+TEST(serial_module_splits_chain)
+{
+  std::map<std::string, std::vector<std::string> > serial = run(0, true);
+  ENSURE_EQUAL(serial["between"].size(), 127u);
+  ENSURE(run(3, true) == serial);
+}
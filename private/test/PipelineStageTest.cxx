@@ -0,0 +1,128 @@
+#include <I3Test.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/thread/thread.hpp>
+
+#include <icetray/I3Tray.h>
+
+#include "EventModules.h"
+
+TEST_GROUP(PipelineStage);
+
+namespace {
+  std::vector<std::string>
+  run(const std::vector<std::string>& stages, bool buffer = false,
+      unsigned queue = 16)
+  {
+    event_log.clear();
+    I3Tray tray;
+    tray.SetStageQueueSize(queue);
+    tray.AddModule("EventSource", "source");
+    tray.AddModule("EventCalibrate", "calibrate");
+    if (buffer)
+      tray.AddModule("EventBuffer", "buffer");
+    tray.AddModule("EventRecord", "record");
+    for (size_t i = 0; i < stages.size(); i++)
+      tray.StartStage(stages[i]);
+    tray.Execute();
+    return event_log.records["record"];
+  }
+}
+
+TEST(same_frames_on_stages)
+{
+  std::vector<std::string> serial = run(std::vector<std::string>());
+  ENSURE_EQUAL(serial.size(), 185u);
+  ENSURE_EQUAL(serial.back(), std::string("P 2 59 1 592 -1"));
+  ENSURE(event_log.threads.count(boost::this_thread::get_id()));
+
+  std::vector<std::string> stages;
+  stages.push_back("calibrate");
+  ENSURE(run(stages) == serial);
+  ENSURE(!event_log.threads.count(boost::this_thread::get_id()),
+         "the last stage runs on a thread of its own");
+  ENSURE(event_log.finished);
+
+  // every frame has to wait for room
+  stages.push_back("record");
+  ENSURE(run(stages, false, 1) == serial);
+  ENSURE(event_log.finished);
+}
+
+// Frames pushed from Finish() still go through the later stages, and
+// those finish after them.
+TEST(finish_after_flush)
+{
+  std::vector<std::string> serial = run(std::vector<std::string>(), true);
+  ENSURE_EQUAL(serial.size(), 185u);
+  ENSURE_EQUAL(serial.back(), std::string("P 2 59 1 592 -1"));
+
+  std::vector<std::string> stages;
+  stages.push_back("buffer");
+  stages.push_back("record");
+  ENSURE(run(stages, true, 2) == serial);
+  ENSURE(event_log.finished);
+}
+
+namespace {
+  // source -> split, whose OutBox goes to calibrate -> staged, and
+  // whose Side goes to side
+  void
+  run_split(bool stage)
+  {
+    event_log.clear();
+    I3Tray tray;
+    tray.AddModule("EventSource", "source");
+    tray.AddModule("EventSplit", "split");
+    tray.AddModule("EventCalibrate", "calibrate");
+    tray.AddModule("EventRecord", "staged");
+    tray.AddModule("EventRecord", "side");
+    tray.ConnectBoxes("source", "OutBox", "split");
+    tray.ConnectBoxes("split", "OutBox", "calibrate");
+    tray.ConnectBoxes("calibrate", "OutBox", "staged");
+    tray.ConnectBoxes("split", "Side", "side");
+    if (stage)
+      tray.StartStage("calibrate");
+    tray.Execute();
+  }
+}
+
+// The stage gets a frame of its own, not the one the module before it
+// also pushes to its serial outbox.
+TEST(stage_and_serial_branch)
+{
+  run_split(false);
+  std::vector<std::string> serial = event_log.records["staged"];
+  ENSURE_EQUAL(serial.size(), 185u);
+
+  run_split(true);
+  ENSURE(event_log.records["staged"] == serial);
+  const std::vector<std::string>& side = event_log.records["side"];
+  ENSURE_EQUAL(side.size(), serial.size());
+  for (size_t i = 0; i < side.size(); i++)
+    {
+      std::istringstream fields(side[i]);
+      std::string stop, status, event, sub, calibrated;
+      fields >> stop >> status >> event >> sub >> calibrated;
+      // nothing the stage does shows up on the side
+      ENSURE_EQUAL(calibrated, std::string("-1"));
+    }
+}
+
+TEST(exception_reaches_caller)
+{
+  I3Tray tray;
+  tray.SetStageQueueSize(1);
+  tray.AddModule("EventSource", "source");
+  tray.AddModule("EventThrow", "throw");
+  tray.AddModule("EventRecord", "record");
+  tray.StartStage("throw");
+  try {
+    tray.Execute();
+    FAIL("the stage's exception should come out of Execute()");
+  } catch (const std::exception& e) {
+    ENSURE(std::string(e.what()).find("event 7") != std::string::npos);
+  }
+}
@@ -0,0 +1,71 @@
+#include <I3Test.h>
+
+#include <set>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include <icetray/I3Tray.h>
+
+#include "EventModules.h"
+
+TEST_GROUP(ProcessWorkers);
+
+namespace {
+  std::vector<std::string>
+  run(unsigned nprocs, bool buffer = false)
+  {
+    event_log.clear();
+    I3Tray tray;
+    tray.AddModule("EventSource", "source");
+    tray.AddModule("EventCalibrate", "calibrate");
+    if (buffer)
+      tray.AddModule("EventBuffer", "buffer");
+    tray.AddModule("EventRecord", "record");
+    if (nprocs > 0)
+      tray.SetWorkerProcesses(nprocs, "calibrate",
+                              buffer ? "buffer" : "calibrate");
+    tray.Execute();
+    return event_log.records["record"];
+  }
+}
+
+TEST(same_frames_in_workers)
+{
+  std::vector<std::string> serial = run(0);
+  ENSURE_EQUAL(serial.size(), 185u);
+  ENSURE_EQUAL(serial.back(), std::string("P 2 59 1 592 -1"));
+  ENSURE_EQUAL(event_log.pids.size(), 1u);
+
+  ENSURE(run(1) == serial);
+  ENSURE(!event_log.pids.count(getpid()), "the workers are other processes");
+
+  ENSURE(run(3) == serial);
+  ENSURE_EQUAL(event_log.pids.size(), 3u);
+}
+
+// Each worker's Finish() is what flushes its frames, so they come in a
+// different order, but they all come.
+TEST(finish_in_workers)
+{
+  std::vector<std::string> serial = run(0, true);
+  std::multiset<std::string> expected(serial.begin(), serial.end());
+
+  std::vector<std::string> workers = run(2, true);
+  ENSURE(std::multiset<std::string>(workers.begin(), workers.end()) == expected);
+}
+
+TEST(exception_reaches_caller)
+{
+  I3Tray tray;
+  tray.AddModule("EventSource", "source");
+  tray.AddModule("EventThrow", "throw");
+  tray.AddModule("EventRecord", "record");
+  tray.SetWorkerProcesses(2, "throw", "throw");
+  try {
+    tray.Execute();
+    FAIL("the worker's exception should come out of Execute()");
+  } catch (const std::exception& e) {
+    ENSURE(std::string(e.what()).find("event 7") != std::string::npos);
+  }
+}
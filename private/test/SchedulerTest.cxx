@@ -0,0 +1,257 @@
+#include <I3Test.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/assign/list_of.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <icetray/I3Tray.h>
+#include <icetray/I3Frame.h>
+#include <icetray/I3Module.h>
+#include <icetray/I3Int.h>
+
+using boost::assign::list_of;
+
+TEST_GROUP(Scheduler);
+
+namespace {
+  // what each SchedLog saw, and the order modules finished in
+  std::map<std::string, std::vector<int> > seen;
+  std::vector<std::string> finished;
+
+  I3FramePtr
+  numbered(int n)
+  {
+    I3FramePtr frame(new I3Frame(I3Frame::Physics));
+    frame->Put("N", I3IntPtr(new I3Int(n)));
+    return frame;
+  }
+
+  // one frame per call, and a burst of three every fifth call
+  struct SchedSource : public I3Module
+  {
+    int n_;
+    SchedSource(const I3Context& context) : I3Module(context), n_(0)
+    {
+      AddOutBox("OutBox");
+    }
+
+    void Process()
+    {
+      int nframes = (n_ % 5 == 4) ? 3 : 1;
+      for (int i = 0; i < nframes; i++)
+        PushFrame(numbered(100*n_ + i));
+      n_++;
+    }
+
+    void Finish() { finished.push_back(GetName()); }
+  };
+
+  struct SchedDouble : public I3Module
+  {
+    SchedDouble(const I3Context& context) : I3Module(context)
+    {
+      AddOutBox("OutBox");
+    }
+
+    void Physics(I3FramePtr frame)
+    {
+      int n = frame->Get<I3Int>("N").value;
+      PushFrame(frame);
+      PushFrame(numbered(n + 50));
+    }
+
+    void Finish() { finished.push_back(GetName()); }
+  };
+
+  // holds everything back until Finish()
+  struct SchedHold : public I3Module
+  {
+    std::vector<I3FramePtr> held_;
+    SchedHold(const I3Context& context) : I3Module(context)
+    {
+      AddOutBox("OutBox");
+    }
+
+    void Physics(I3FramePtr frame) { held_.push_back(frame); }
+
+    void Finish()
+    {
+      finished.push_back(GetName());
+      for (size_t i = 0; i < held_.size(); i++)
+        PushFrame(held_[i]);
+    }
+  };
+
+  struct SchedLog : public I3Module
+  {
+    SchedLog(const I3Context& context) : I3Module(context)
+    {
+      AddOutBox("OutBox");
+    }
+
+    void Physics(I3FramePtr frame)
+    {
+      seen[GetName()].push_back(frame->Get<I3Int>("N").value);
+      PushFrame(frame);
+    }
+
+    void Finish() { finished.push_back(GetName()); }
+  };
+
+  void
+  run(unsigned batch)
+  {
+    seen.clear();
+    finished.clear();
+    I3Tray tray;
+    tray.SetBatchSize(batch);
+    tray.AddModule("SchedSource", "source");
+    tray.AddModule("SchedDouble", "double");
+    tray.AddModule("Fork", "fork")
+      ("Outboxes", std::vector<std::string>(list_of("left")("right")));
+    tray.AddModule("SchedLog", "left");
+    tray.AddModule("SchedHold", "hold");
+    tray.AddModule("SchedLog", "end");
+    tray.AddModule("SchedLog", "right");
+    tray.ConnectBoxes("source", "OutBox", "double");
+    tray.ConnectBoxes("double", "OutBox", "fork");
+    tray.ConnectBoxes("fork", "left", "left");
+    tray.ConnectBoxes("left", "OutBox", "hold");
+    tray.ConnectBoxes("hold", "OutBox", "end");
+    tray.ConnectBoxes("fork", "right", "right");
+    tray.Execute(20);
+  }
+
+  size_t
+  position(const std::string& module)
+  {
+    return std::find(finished.begin(), finished.end(), module) -
+      finished.begin();
+  }
+}
+
+I3_MODULE(SchedSource);
+I3_MODULE(SchedDouble);
+I3_MODULE(SchedHold);
+I3_MODULE(SchedLog);
+
+// Every module sees the same frames in the same order whatever the
+// batch size, and finishes after everything upstream of it.
+TEST(same_order_for_any_batch)
+{
+  run(0);
+  std::map<std::string, std::vector<int> > recursive = seen;
+  ENSURE_EQUAL(recursive["left"].size(), 2*(20u + 2*4));
+  ENSURE(recursive["end"] == recursive["left"]);
+  ENSURE(recursive["right"] == recursive["left"]);
+
+  unsigned batches[] = { 1, 2, 7, 1000 };
+  for (unsigned i = 0; i < sizeof(batches)/sizeof(batches[0]); i++)
+    {
+      run(batches[i]);
+      ENSURE(seen == recursive);
+      ENSURE_EQUAL(finished.size(), 6u);
+      ENSURE(position("source") < position("double"));
+      ENSURE(position("double") < position("left"));
+      ENSURE(position("double") < position("right"));
+      ENSURE(position("left") < position("hold"));
+      ENSURE(position("hold") < position("end"));
+    }
+}
+
+// A tray longer than the stack would allow recursive Do() calls for.
+TEST(long_tray)
+{
+  seen.clear();
+  I3Tray tray;
+  tray.SetBatchSize(4);
+  tray.AddModule("SchedSource", "source");
+  for (int i = 0; i < 5000; i++)
+    tray.AddModule("SchedLog", "log" + boost::lexical_cast<std::string>(i));
+  tray.Execute(10);
+  ENSURE_EQUAL(seen["log4999"].size(), 10u + 2*2);
+  ENSURE(seen["log4999"] == seen["log0"]);
+}
+
+namespace {
+  // a DAQ frame and six Physics frames per call
+  struct BatchSource : public I3Module
+  {
+    int n_;
+    BatchSource(const I3Context& context) : I3Module(context), n_(0)
+    {
+      AddOutBox("OutBox");
+    }
+
+    void Process()
+    {
+      PushFrame(I3FramePtr(new I3Frame(I3Frame::DAQ)));
+      for (int i = 0; i < 6; i++)
+        PushFrame(numbered(10*n_ + i));
+      n_++;
+    }
+  };
+
+  std::vector<size_t> batches;
+
+  // takes batches, but not of the third Physics frame of each event
+  struct BatchRecord : public I3Module
+  {
+    BatchRecord(const I3Context& context) : I3Module(context)
+    {
+      AddOutBox("OutBox");
+    }
+
+    bool ShouldDoPhysics(I3FramePtr frame)
+    {
+      return frame->Get<I3Int>("N").value % 10 != 2;
+    }
+
+    void PhysicsBatch(std::vector<I3FramePtr>& frames)
+    {
+      batches.push_back(frames.size());
+      for (size_t i = 0; i < frames.size(); i++)
+        PushFrame(frames[i]);
+    }
+  };
+
+  void
+  run_batches(unsigned batch)
+  {
+    seen.clear();
+    batches.clear();
+    I3Tray tray;
+    tray.SetBatchSize(batch);
+    tray.AddModule("BatchSource", "source");
+    tray.AddModule("BatchRecord", "record");
+    tray.AddModule("SchedLog", "plain");
+    tray.AddModule("SchedLog", "end");
+    tray.Execute(3);
+  }
+}
+
+I3_MODULE(BatchSource);
+I3_MODULE(BatchRecord);
+
+// Batches end at other stops and at frames the module turns away, and
+// modules without PhysicsBatch() get the frames one by one.
+TEST(physics_batches)
+{
+  run_batches(1);
+  ENSURE(batches.empty());
+  std::map<std::string, std::vector<int> > single = seen;
+  ENSURE_EQUAL(single["end"].size(), 18u);
+
+  run_batches(4);
+  ENSURE(seen == single);
+  ENSURE_EQUAL(batches.size(), 6u);
+  for (size_t i = 0; i < batches.size(); i++)
+    ENSURE_EQUAL(batches[i], i % 2 ? 3u : 2u);
+
+  run_batches(2);
+  ENSURE(seen == single);
+  ENSURE_EQUAL(batches.size(), 9u);
+}
@@ -0,0 +1,116 @@
+#ifndef ICETRAY_I3ASYNCFRAMEWRITER_H_INCLUDED
+#define ICETRAY_I3ASYNCFRAMEWRITER_H_INCLUDED
+
+#include <deque>
+#include <exception>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <icetray/I3Frame.h>
+#include <icetray/I3Logging.h>
+
+/**
+ * Writes frames to a file on a thread of its own, so that serializing,
+ * compressing and writing them doesn't hold up the tray:
+ *
+ *   I3AsyncFrameWriter writer("out.i3.zst");
+ *   writer.Write(*frame);    // returns once the frame is queued
+ *   ...
+ *   writer.Close();          // everything written and on disk
+ *
+ * The file is opened with I3::dataio::open(), so the usual compression
+ * by extension applies.  The queue holds up to @a capacity frames; a
+ * Write() that finds it full waits for room (backpressure), which
+ * GetStats() reports.  An error on the writing thread is thrown from
+ * the next Write(), Flush() or Close().
+ */
+class I3AsyncFrameWriter
+{
+ public:
+  struct Stats
+  {
+    boost::uint64_t frames;
+    /// Bytes of serialized frames written, before compression.
+    boost::uint64_t bytes;
+    /// Writes that found the queue full, and the time they waited.
+    boost::uint64_t stalls;
+    double stall_seconds;
+    size_t peak;
+    /// Frames waiting when the stats were taken.
+    size_t depth;
+  };
+
+  /**
+   * Open @a filename for writing.  @a compression_level and @a nthreads
+   * are as for I3::dataio::open(); with @a frames_per_seek, a .zst file
+   * is written seekable (I3::dataio::open_seekable()).
+   */
+  explicit I3AsyncFrameWriter(const std::string& filename,
+                              size_t capacity = 64,
+                              int compression_level = 0,
+                              unsigned nthreads = 0,
+                              unsigned frames_per_seek = 0);
+  /// Close(), logging rather than throwing any error.
+  ~I3AsyncFrameWriter();
+
+  /// Queue @a frame, to be serialized on the writing thread.  The frame
+  /// may be changed or reused as soon as this returns.
+  void Write(const I3Frame& frame);
+
+  /// Queue a frame on stream @a stop that is already serialized.  Takes
+  /// the contents of @a serialized, leaving it empty.
+  void Write(std::vector<char>& serialized, const I3Frame::Stream& stop);
+
+  /// Wait until everything queued so far has been handed to the file.
+  /// Compressors may still hold some of it back until Close().
+  void Flush();
+
+  /// Write everything queued, close the file and fsync() it.
+  void Close();
+
+  Stats GetStats() const;
+
+  SET_LOGGER("I3AsyncFrameWriter");
+
+ private:
+  I3AsyncFrameWriter(const I3AsyncFrameWriter&);
+  I3AsyncFrameWriter& operator=(const I3AsyncFrameWriter&);
+
+  struct Item
+  {
+    I3FramePtr frame;
+    std::vector<char> bytes;
+    char stop;
+  };
+
+  /// The writing thread.
+  void Run();
+  void Put(Item& item);
+  /// Rethrow what the writing thread threw, if anything.  Call locked.
+  void Check();
+
+  std::string filename_;
+  const size_t capacity_;
+  boost::iostreams::filtering_ostream ofs_;
+
+  mutable boost::mutex mtx_;
+  boost::condition_variable changed_;
+  std::deque<Item> queue_;
+  /// Flushes asked for and done, to tell Flush() when it's through.
+  boost::uint64_t flushes_asked_, flushes_done_;
+  bool closing_, closed_;
+  std::exception_ptr error_;
+  Stats stats_;
+
+  boost::thread thread_;
+};
+
+I3_POINTER_TYPEDEFS(I3AsyncFrameWriter);
+
+#endif
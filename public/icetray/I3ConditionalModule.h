@@ -23,6 +23,7 @@
 
 #include "icetray/I3Module.h"
 #include "icetray/I3IcePick.h"
+#include <boost/atomic.hpp>
 
 /**
  * @brief This class is meant to be a wedge between an I3Module and any module
@@ -51,6 +52,12 @@ class I3ConditionalModule : public I3Module
     return true; 
   }
 
+  /// Serial if there is an If, which is Python.
+  Concurrency GetConcurrency() const
+  {
+    return use_if_ ? Serial : I3Module::GetConcurrency();
+  }
+
   SET_LOGGER("I3ConditionalModule");
 
  protected:
@@ -76,8 +83,8 @@ class I3ConditionalModule : public I3Module
 
   bool use_if_;
   bool use_pick_;
-  unsigned nexecuted_;
-  unsigned nskipped_;
+  boost::atomic<unsigned> nexecuted_;
+  boost::atomic<unsigned> nskipped_;
 };
 
 #endif
@@ -113,6 +113,21 @@ struct StandardCreate
   }
 };
 
+/// StandardCreate for modules, which also tells each module which
+/// ShouldDoX() checks its type overrides.
+template <class FactoryProductType, class ModuleType>
+struct ModuleCreate
+{
+  static
+  boost::shared_ptr<FactoryProductType>
+  Create (const I3Context& c)
+  {
+    boost::shared_ptr<FactoryProductType> module =
+      StandardCreate<FactoryProductType, ModuleType>::Create(c);
+    module->template FindOverrides<ModuleType>();
+    return module;
+  }
+};
 
 template <class FactoryProductType,
           class ActualDerivedType,
@@ -156,7 +171,7 @@ private:
 
 
 
-#define I3_MODULE(TYPE) I3_REGISTER(I3Module, TYPE, StandardCreate)
+#define I3_MODULE(TYPE) I3_REGISTER(I3Module, TYPE, ModuleCreate)
 
 #define I3_SERVICE_FACTORY(TYPE) I3_REGISTER(I3ServiceFactory, TYPE, StandardCreate)
 
@@ -0,0 +1,232 @@
+#ifndef ICETRAY_I3FLATMAP_H_INCLUDED
+#define ICETRAY_I3FLATMAP_H_INCLUDED
+
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include <boost/functional/hash.hpp>
+#include <boost/iterator/iterator_facade.hpp>
+
+/**
+ * A hash map that keeps its entries in one flat array, probed linearly,
+ * instead of in one heap node per entry.  Made for the I3Frame's slot
+ * table: small entries, few keys, lots of lookups and copies.
+ *
+ * It has the parts of the hash_map interface the frame uses.
+ * Differences:
+ *  - keys are mutable through iterators; don't.
+ *  - inserting may move entries and invalidates all iterators.
+ *    Erasing invalidates none, so erase(it++) works while iterating.
+ *
+ * Key must be default-constructible and copyable.
+ */
+template <typename Key, typename T, typename Hash = boost::hash<Key> >
+class I3FlatMap
+{
+ public:
+  typedef Key key_type;
+  typedef T mapped_type;
+  typedef std::pair<Key, T> value_type;
+  typedef size_t size_type;
+  typedef value_type& reference;
+  typedef const value_type& const_reference;
+
+ private:
+  enum { empty_slot = 0, full_slot = 1, erased_slot = 2 };
+
+  template <bool Const>
+  class iter_base
+    : public boost::iterator_facade<iter_base<Const>,
+                                    typename std::conditional<Const, const value_type, value_type>::type,
+                                    boost::forward_traversal_tag>
+  {
+    typedef typename std::conditional<Const, const I3FlatMap, I3FlatMap>::type map_type;
+    typedef typename std::conditional<Const, const value_type, value_type>::type entry_type;
+
+   public:
+    iter_base() : map_(0), pos_(0) { }
+    iter_base(map_type* map, size_t pos) : map_(map), pos_(pos) { skip(); }
+    // iterator -> const_iterator
+    template <bool C>
+    iter_base(const iter_base<C>& rhs) : map_(rhs.map_), pos_(rhs.pos_) { }
+
+   private:
+    friend class boost::iterator_core_access;
+    template <bool> friend class iter_base;
+    friend class I3FlatMap;
+
+    void skip()
+    {
+      while (pos_ < map_->state_.size() && map_->state_[pos_] != full_slot)
+        pos_++;
+    }
+    void increment() { pos_++; skip(); }
+    template <bool C>
+    bool equal(const iter_base<C>& rhs) const { return pos_ == rhs.pos_; }
+    entry_type& dereference() const { return map_->slots_[pos_]; }
+
+    map_type* map_;
+    size_t pos_;
+  };
+
+ public:
+  typedef iter_base<false> iterator;
+  typedef iter_base<true> const_iterator;
+
+  I3FlatMap() : size_(0), used_(0) { }
+
+  size_type size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  iterator begin() { return iterator(this, 0); }
+  iterator end() { return iterator(this, state_.size()); }
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, state_.size()); }
+
+  iterator find(const Key& key)
+  {
+    size_t pos = locate(key);
+    return pos == npos ? end() : iterator(this, pos);
+  }
+  const_iterator find(const Key& key) const
+  {
+    size_t pos = locate(key);
+    return pos == npos ? end() : const_iterator(this, pos);
+  }
+  size_type count(const Key& key) const { return locate(key) == npos ? 0 : 1; }
+
+  /// Insert @a value unless its key is there already.
+  std::pair<iterator, bool> insert(const value_type& value)
+  {
+    size_t pos = locate(value.first);
+    if (pos != npos)
+      return std::make_pair(iterator(this, pos), false);
+    pos = place(value.first);
+    slots_[pos].second = value.second;
+    return std::make_pair(iterator(this, pos), true);
+  }
+
+  template <typename InputIterator>
+  void insert(InputIterator first, InputIterator last)
+  {
+    for (; first != last; ++first)
+      insert(*first);
+  }
+
+  T& operator[](const Key& key)
+  {
+    size_t pos = locate(key);
+    if (pos == npos)
+      pos = place(key);
+    return slots_[pos].second;
+  }
+
+  void erase(iterator it)
+  {
+    state_[it.pos_] = erased_slot;
+    slots_[it.pos_] = value_type();
+    size_--;
+  }
+  size_type erase(const Key& key)
+  {
+    size_t pos = locate(key);
+    if (pos == npos)
+      return 0;
+    erase(iterator(this, pos));
+    return 1;
+  }
+
+  void clear()
+  {
+    slots_.clear();
+    state_.clear();
+    size_ = used_ = 0;
+  }
+
+  /// Make room for @a n entries without rehashing.
+  void reserve(size_type n)
+  {
+    if (n > (state_.size() * 7) / 8)
+      rehash(capacity_for(n));
+  }
+
+ private:
+  static const size_t npos = size_t(-1);
+
+  static size_t capacity_for(size_t n)
+  {
+    size_t cap = 8;
+    while ((cap * 7) / 8 < n)
+      cap *= 2;
+    return cap;
+  }
+
+  // Spread the bits of the user's hash; pointer hashes in particular
+  // have all their entropy in the middle.
+  size_t home(const Key& key) const
+  {
+    uint64_t h = uint64_t(Hash()(key)) * 0x9E3779B97F4A7C15ULL;
+    return size_t(h ^ (h >> 32)) & (state_.size() - 1);
+  }
+
+  size_t locate(const Key& key) const
+  {
+    if (size_ == 0)
+      return npos;
+    size_t mask = state_.size() - 1;
+    for (size_t pos = home(key); ; pos = (pos + 1) & mask)
+      {
+        if (state_[pos] == empty_slot)
+          return npos;
+        if (state_[pos] == full_slot && slots_[pos].first == key)
+          return pos;
+      }
+  }
+
+  // Claim a slot for key, which must not be in the map.
+  size_t place(const Key& key)
+  {
+    if (used_ + 1 > (state_.size() * 7) / 8)
+      rehash(capacity_for(size_ + 1 > state_.size() / 2 ? 2 * (size_ + 1) : size_ + 1));
+    size_t mask = state_.size() - 1;
+    size_t pos = home(key);
+    while (state_[pos] == full_slot)
+      pos = (pos + 1) & mask;
+    if (state_[pos] == empty_slot)
+      used_++;
+    state_[pos] = full_slot;
+    slots_[pos].first = key;
+    size_++;
+    return pos;
+  }
+
+  void rehash(size_t cap)
+  {
+    std::vector<value_type> slots(cap);
+    std::vector<unsigned char> state(cap, empty_slot);
+    slots_.swap(slots);
+    state_.swap(state);
+    size_t mask = cap - 1;
+    for (size_t i = 0; i < state.size(); i++)
+      {
+        if (state[i] != full_slot)
+          continue;
+        size_t pos = home(slots[i].first);
+        while (state_[pos] != empty_slot)
+          pos = (pos + 1) & mask;
+        state_[pos] = full_slot;
+        // swap rather than copy: entries may be expensive to copy
+        std::swap(slots_[pos], slots[i]);
+      }
+    used_ = size_;
+  }
+
+  std::vector<value_type> slots_;
+  std::vector<unsigned char> state_;
+  size_t size_;
+  /// Slots that are full or erased; probes stop only at empty ones.
+  size_t used_;
+};
+
+#endif
@@ -26,6 +26,7 @@
 #include <vector>
 #include <I3/hash_map.h>
 #include <stdint.h>
+#include <boost/iterator/iterator_facade.hpp>
 #include <boost/iterator/transform_iterator.hpp>
 #include <boost/utility/enable_if.hpp>
 #include <boost/type_traits/is_const.hpp>
@@ -33,11 +34,17 @@
 #include "icetray/serialization.h"
 #include <icetray/I3DefaultName.h>
 #include <icetray/I3FrameObject.h>
+#include <icetray/I3FrameKey.h>
+#include <icetray/I3FlatMap.h>
+#include <icetray/I3FrameKeyMatcher.h>
+#include <icetray/I3ThreadPool.h>
 #include <icetray/I3Logging.h>
 #include <icetray/IcetrayFwd.h>
 #include <icetray/is_shared_ptr.h>
 #include <I3/name_of.h>
 
+namespace boost { namespace iostreams { class mapped_file_source; } }
+
 /**
    The I3Frame is the container that I3Modules use to communicate with
    one another.  It is passed from I3Module to I3Module by the icetray
@@ -101,41 +108,40 @@ class I3Frame
   {
     std::string type_name;
     std::vector<char> buf;
+    /// For frames loaded from a memory-mapped file: the serialized
+    /// object, in place in the mapping.  Holding this keeps the
+    /// mapping alive.
+    boost::shared_ptr<const char> mapped;
+    size_t mapped_size;
+
+    blob_t() : mapped_size(0) { }
+    const char* data() const
+    {
+      return mapped ? mapped.get() : (buf.empty() ? 0 : &buf[0]);
+    }
+    size_t size() const { return mapped ? mapped_size : buf.size(); }
     void reset() {
       type_name = "";
       std::vector<char>().swap(buf); // special brute-force-clear
+      mapped.reset();
+      mapped_size = 0;
     }
   };
 
+  /// Values may be shared by frames on several threads; get_impl()
+  /// and Prefetch() fill them in under a lock (see I3Frame.cxx).
   struct value_t
   {
     blob_t blob;
     size_t size;
     I3FrameObjectConstPtr ptr;
     I3Frame::Stream stream;
+    /// Set while a Prefetch() of this value may still be writing ptr.
+    I3ThreadPool::TaskPtr pending;
   };
 
-  struct hashed_str_t
-  {
-    hashed_str_t(const std::string &str) : string(str), hash(::hash<std::string>()(str)) {}
-    bool operator == (const hashed_str_t &b) const {
-      if (hash != b.hash) return false;
-      return string == b.string;
-    }
-    hashed_str_t & operator = (const hashed_str_t &b) {
-      string = b.string;
-      hash = b.hash;
-      return *this;
-    }
-    std::string string;
-    size_t hash;
-  };
-  struct hashed_str_t_hash
-  {
-    size_t operator()(const hashed_str_t &h) const { return h.hash; }
-  };
-
-  typedef hash_map<hashed_str_t, boost::shared_ptr<value_t>, hashed_str_t_hash> map_t;
+  /// Values are allocated with make_shared, object and count in one go.
+  typedef I3FlatMap<I3FrameKey, boost::shared_ptr<value_t>, I3FrameKey::hash> map_t;
   /// may change type_name field in value
   static std::string type_name(const value_t&);
 
@@ -147,17 +153,163 @@ class I3Frame
   /// that you're just going to have to serialize them again.
   bool drop_blobs_;
 
-  mutable map_t map_;
+  /// Copies of a frame share one table until either of them changes
+  /// it; anything that adds, removes or replaces entries goes through
+  /// mutable_map().  Values are shared between tables regardless.
+  boost::shared_ptr<map_t> map_;
+
+  /// map_, made private to this frame first if it is shared.
+  map_t& mutable_map();
+
+  /// Frames mixed in with overlay(), searched in order after map_.
+  /// Only their own tables are searched; overlay() lifts a parent's
+  /// parents into this list.
+  mutable std::vector<boost::shared_ptr<const I3Frame> > parents_;
+
+  /// Set while map_ is known to hold only keys on stop_, so that purge()
+  /// has nothing to look for.  Cleared by anything that might break that.
+  mutable bool pure_;
+
+  /// The value at @a key in map_ or, failing that, in the first parent
+  /// that has it.  Null if there is none.
+  const boost::shared_ptr<value_t>* lookup(const I3FrameKey& key) const
+  {
+    size_t table;
+    map_t::const_iterator iter;
+    return lookup(key, table, iter) ? &iter->second : 0;
+  }
+  /// As above, but say where: in table(@a table), at @a iter.
+  bool lookup(const I3FrameKey& key, size_t& table, map_t::const_iterator& iter) const
+  {
+    iter = map_->find(key);
+    if (iter != map_->end())
+      {
+        table = 0;
+        return true;
+      }
+    for (table = 1; table <= parents_.size(); table++)
+      {
+        const map_t& map = *parents_[table - 1]->map_;
+        iter = map.find(key);
+        if (iter != map.end())
+          return true;
+      }
+    return false;
+  }
+  const boost::shared_ptr<value_t>* lookup(const std::string& name) const
+  {
+    I3FrameKey key;
+    if (!I3FrameKey::Find(name, key))
+      return 0;
+    return lookup(key);
+  }
+  /// True if some parent has @a key.
+  bool inherits(const I3FrameKey& key) const;
+  /// Copy the parents' entries into map_ and let go of the parents.
+  /// Done before anything walks map_ directly or changes what an
+  /// inherited key refers to.
+  void flatten() const;
+  /// map_ for 0, else the table of parents_[@a n - 1].
+  const map_t& table(size_t n) const
+  {
+    return n == 0 ? *map_ : *parents_[n - 1]->map_;
+  }
 
  public:
   typedef map_t::size_type size_type;
 
+  /// Walks map_ and then the parents' tables, passing over keys that an
+  /// earlier table holds too, so it sees each entry lookup() would.
+  class entry_iterator
+    : public boost::iterator_facade<entry_iterator, const map_t::value_type,
+                                    boost::forward_traversal_tag>
+  {
+   public:
+    entry_iterator() : frame_(0), table_(0) { }
+    entry_iterator(const I3Frame* frame, size_t table, map_t::const_iterator iter)
+      : frame_(frame), table_(table), iter_(iter)
+    {
+      settle();
+    }
+
+   private:
+    friend class boost::iterator_core_access;
+
+    bool shadowed() const
+    {
+      for (size_t n = 0; n < table_; n++)
+        if (frame_->table(n).count(iter_->first))
+          return true;
+      return false;
+    }
+    /// Move on to the first entry from here that isn't shadowed, or to
+    /// the end of the last table.
+    void settle()
+    {
+      for (;;)
+        {
+          if (iter_ == frame_->table(table_).end())
+            {
+              if (table_ == frame_->parents_.size())
+                return;
+              iter_ = frame_->table(++table_).begin();
+            }
+          else if (table_ > 0 && shadowed())
+            ++iter_;
+          else
+            return;
+        }
+    }
+    void increment() { ++iter_; settle(); }
+    bool equal(const entry_iterator& rhs) const
+    {
+      return table_ == rhs.table_ && iter_ == rhs.iter_;
+    }
+    const map_t::value_type& dereference() const { return *iter_; }
+
+    const I3Frame* frame_;
+    size_t table_;
+    map_t::const_iterator iter_;
+  };
+
+ private:
+  entry_iterator entries_begin() const
+  {
+    return entry_iterator(this, 0, map_->begin());
+  }
+  entry_iterator entries_end() const
+  {
+    return entry_iterator(this, parents_.size(), table(parents_.size()).end());
+  }
+  entry_iterator entries_find(const std::string& name) const
+  {
+    I3FrameKey key;
+    size_t n;
+    map_t::const_iterator iter;
+    if (!I3FrameKey::Find(name, key) || !lookup(key, n, iter))
+      return entries_end();
+    return entry_iterator(this, n, iter);
+  }
+
  private:
   /// Internal implementation of Get, where the actual deserialization
   /// is done.
-  I3FrameObjectConstPtr get_impl(map_t::const_reference value) const;
+  I3FrameObjectConstPtr get_impl(const std::string& key, value_t& value) const;
+  I3FrameObjectConstPtr get_impl(map_t::const_reference pr) const
+  {
+    return get_impl(pr.first.str(), *pr.second);
+  }
 
   static void create_blob_impl(value_t &value);
+  /// Run create_blob_impl() for those of @a keys without a blob on @a pool.
+  void create_blobs_parallel(const std::vector<std::string>& keys, I3ThreadPool& pool) const;
+
+  /// Deserialize value.blob.  Throws on archive errors.
+  static I3FrameObjectPtr load_blob(const value_t& value);
+  /// Worker side of Prefetch().
+  static void prefetch_impl(boost::shared_ptr<value_t> value);
+  /// Wait for an outstanding Prefetch() of value, if there is one.
+  static void settle(value_t& value);
 
   size_type size(const value_t& value) const { return value.size; }
 
@@ -171,14 +323,14 @@ class I3Frame
     mutable pair_t result;
     result_type operator()(map_t::const_reference pr) const
     {
-      result.first = pr.first.string;
+      result.first = pr.first.str();
       result.second = I3Frame::type_name(*pr.second);
 
       return result;
     }
   };
   typedef boost::transform_iterator<typename_transform, 
-                                    map_t::const_iterator,
+                                    entry_iterator,
                                     const std::pair<std::string, std::string>&
                                     > typename_iterator_t;
 
@@ -199,19 +351,19 @@ class I3Frame
     explicit deserialize_transform(const I3Frame* frame) : frame_(frame) { }
     result_type operator()(map_t::const_reference pr) const
     {
-      result.first = pr.first.string;
+      result.first = pr.first.str();
       result.second = frame_->get_impl(pr);
 
       return result;
     }
   };
   typedef boost::transform_iterator<deserialize_transform, 
-                                    map_t::const_iterator,
+                                    entry_iterator,
                                     const std::pair<std::string, I3FrameObjectConstPtr>&
                                     > deserialize_iterator;
 
   struct typename_iterator : typename_iterator_t { 
-    typename_iterator(const map_t::const_iterator& iter)
+    typename_iterator(const entry_iterator& iter)
       : typename_iterator_t(iter) 
     { }
   };
@@ -220,7 +372,7 @@ class I3Frame
   {
    public:
     const_iterator() { }
-    const_iterator(const map_t::const_iterator& iter, const I3Frame* frame) :
+    const_iterator(const entry_iterator& iter, const I3Frame* frame) :
       deserialize_iterator(iter, deserialize_transform(frame))
     { }
     const_iterator& operator=(const const_iterator& rhs)
@@ -238,7 +390,12 @@ class I3Frame
   I3Frame& operator=(const I3Frame& rhs);
 
   Stream GetStop() const { return stop_; }
-  void SetStop(Stream newstop) { stop_ = newstop; }
+  void SetStop(Stream newstop)
+  {
+    if (newstop != stop_ && !map_->empty())
+      pure_ = false;
+    stop_ = newstop;
+  }
 
   bool drop_blobs() const { return drop_blobs_; }
   /** Determine policy: Drop the blobs after deserialization?
@@ -247,42 +404,61 @@ class I3Frame
    */
   void drop_blobs(bool drop) { drop_blobs_ = drop; }
 
-  size_type size() const { return map_.size(); }
-  void clear() { map_.clear(); }
+  size_type size() const;
+  void clear() { map_.reset(new map_t); parents_.clear(); pure_ = true; }
 
-  const_iterator begin() const { return const_iterator(map_.begin(), this); } 
-  const_iterator end() const { return const_iterator(map_.end(), this); } 
+  // Iteration takes in overlaid keys (see overlay()) as it goes, in no
+  // particular order; keys() is sorted.
+  const_iterator begin() const { return const_iterator(entries_begin(), this); } 
+  const_iterator end() const { return const_iterator(entries_end(), this); } 
 
-  typename_iterator typename_begin() const { return typename_iterator(map_.begin()); }
-  typename_iterator typename_end() const { return typename_iterator(map_.end()); }
+  typename_iterator typename_begin() const { return typename_iterator(entries_begin()); }
+  typename_iterator typename_end() const { return typename_iterator(entries_end()); }
   typename_iterator typename_find(const std::string& key) const 
   { 
-    return typename_iterator(map_.find(key));
+    return typename_iterator(entries_find(key));
   }
 
   size_type size(const std::string& key) const;
-  size_type count(const std::string& key) const { return map_.count(key); }
+  size_type count(const std::string& key) const { return lookup(key) ? 1 : 0; }
   const_iterator find(const std::string& key) const 
   { 
-    return const_iterator(map_.find(key), this); 
+    return const_iterator(entries_find(key), this); 
   }
   /** Test, if a frame object exists at a given "slot".
    * 
    * @param key The "slot" in the frame to check.
    * @return true, if something exists in the frame at slot <VAR>key</VAR>, otherwise false.
    */
-  bool Has(const std::string& key) const { return map_.count(key); }
+  bool Has(const std::string& key) const { return lookup(key) != 0; }
+  bool Has(const I3FrameKey& key) const { return lookup(key) != 0; }
 
   I3Frame::Stream GetStop(const std::string& key) const;
 
   void merge(const I3Frame& rhs);
 
+  /** Make the keys of @a parent visible in this frame without copying
+   * them.  Lookups that miss in this frame fall through to the frames
+   * overlaid on it, in the order they were overlaid; as with merge(),
+   * keys already present win.  @a parent must not be changed
+   * afterwards: the I3FrameMixer only overlays cache entries it
+   * replaces rather than modifies.
+   */
+  void overlay(const boost::shared_ptr<const I3Frame>& parent);
+
   // delete any frame objects we're carrying that are on stream 'what'
   void purge(const Stream& what);
 
   // delete all frame objects we're carrying that aren't on our stream 
   void purge();
 
+  /** Give this frame a key table and values of its own, so that it can
+   * go to another thread while copies of it (in frame mixers, say)
+   * stay behind.  Copies otherwise share values, which Get() and
+   * save() fill in lazily.  The objects themselves are still shared.
+   */
+  void unshare();
+
   //
   //  takes "what" from rhs into *this as "as", buffers and all.
   //
@@ -320,13 +496,25 @@ class I3Frame
       typename boost::enable_if<is_shared_ptr<T> >::type * = 0,
       typename boost::enable_if<boost::is_const<typename T::element_type> >::type* = 0) const
   {
-    log_trace("Get<%s>(\"%s\")", I3::name_of<T>().c_str(), name.c_str());
+    I3FrameKey key;
+    if (!I3FrameKey::Find(name, key))
+      return boost::shared_ptr<typename T::element_type>();
+    return this->template Get<T>(key);
+  }
+  /// Get a frame object by a key made beforehand.
+  template <typename T>
+  T
+  Get(const I3FrameKey& key,
+      typename boost::enable_if<is_shared_ptr<T> >::type * = 0,
+      typename boost::enable_if<boost::is_const<typename T::element_type> >::type* = 0) const
+  {
+    log_trace("Get<%s>(\"%s\")", I3::name_of<T>().c_str(), key.str().c_str());
 
-    map_t::iterator iter = map_.find(name);
-    if (iter == map_.end())
+    const boost::shared_ptr<value_t>* value = lookup(key);
+    if (!value)
       return boost::shared_ptr<typename T::element_type>();
 
-    I3FrameObjectConstPtr focp = get_impl(*iter);
+    I3FrameObjectConstPtr focp = get_impl(key.str(), **value);
          
     return boost::dynamic_pointer_cast<typename T::element_type>(focp);
   }
@@ -341,11 +529,21 @@ class I3Frame
   Get(const std::string& name = I3DefaultName<T>::value(), 
       typename boost::disable_if<is_shared_ptr<T> >::type * = 0) const
   {
-    log_trace("Get<%s>(\"%s\")", I3::name_of<T>().c_str(), name.c_str());
-
-    boost::shared_ptr<const T> sp_t = this->template Get<boost::shared_ptr<const T> >(name);
+    I3FrameKey key;
+    if (!I3FrameKey::Find(name, key))
+      log_fatal("object in frame at \"%s\" doesn't exist. ", name.c_str());
+    return this->template Get<T>(key);
+  }
+  /// Get a frame object by reference, by a key made beforehand.
+  template <typename T>
+  const T&
+  Get(const I3FrameKey& key,
+      typename boost::disable_if<is_shared_ptr<T> >::type * = 0) const
+  {
+    const std::string& name = key.str();
+    boost::shared_ptr<const T> sp_t = this->template Get<boost::shared_ptr<const T> >(key);
     if (!sp_t){
-      if(!this->Has(name)){
+      if(!this->Has(key)){
           log_fatal("object in frame at \"%s\" doesn't exist. ", name.c_str());                    
         }else{
           log_fatal("object in frame at \"%s\" exists, but "
@@ -378,6 +576,13 @@ class I3Frame
   void Put(const std::string& name, 
 	   boost::shared_ptr<const I3FrameObject> element);
 
+  void Put(const I3FrameKey& key,
+	   boost::shared_ptr<const I3FrameObject> element,
+	   const I3Frame::Stream& stream);
+
+  void Put(const I3FrameKey& key,
+	   boost::shared_ptr<const I3FrameObject> element);
+
   /** Puts something into the frame at its "default" location.
    *
    * @param element What to put in there.
@@ -401,6 +606,16 @@ class I3Frame
   void ChangeStream(const std::string& key, Stream stream);
 
   ///
+  /** Start deserializing some keys on a thread pool.
+   *
+   * Each of @a keys that is in the frame but not yet deserialized is
+   * handed to @a pool; a later Get() returns the result, waiting for
+   * it only if the worker has not got to it yet.  Keys that are
+   * missing or already deserialized are ignored.  The I3Tray issues
+   * this for the keys its modules declare with I3Module::Prefetch().
+   */
+  void Prefetch(const std::vector<std::string>& keys, I3ThreadPool& pool) const;
+
   /// Deletes something.  
   ///
   void Delete(const std::string& key);
@@ -413,15 +628,45 @@ class I3Frame
   std::vector<std::string> keys() const;
 
   void create_blob(bool drop_memory_data, const std::string &key) const;
-  void create_blobs(bool drop_memory_data, const std::vector<std::string>& skip = std::vector<std::string>()) const;
+  /** Serialize every object on this frame's stream that has no blob yet.
+   *
+   * @param pool If given, the objects are serialized concurrently on it.
+   */
+  void create_blobs(bool drop_memory_data, const I3FrameKeyMatcher& skip = I3FrameKeyMatcher(),
+                    I3ThreadPool* pool = 0) const;
 
+  /** Write the frame.
+   *
+   * @param pool If given, objects that still need serializing are
+   * serialized concurrently on it before anything is written.  The
+   * output is the same either way.
+   */
   template <typename OStreamT>
   void 
-  save(OStreamT& os, const std::vector<std::string>& vs = std::vector<std::string>()) const;
+  save(OStreamT& os, const I3FrameKeyMatcher& skip = I3FrameKeyMatcher(),
+       I3ThreadPool* pool = 0) const;
 
   template <typename IStreamT>
   bool 
-  load(IStreamT& is, const std::vector<std::string>& vs = std::vector<std::string>(), bool verify_checksums = true);
+  load(IStreamT& is, const I3FrameKeyMatcher& skip = I3FrameKeyMatcher(), bool verify_checksums = true);
+
+  /** Load a frame out of a memory-mapped, uncompressed .i3 file
+   *  (see I3::dataio::open_mapped()).
+   *
+   *  Object buffers are not copied out of the file: the frame refers
+   *  to them in place, and the mapping stays valid for as long as any
+   *  frame still does.  Keys that are never Get() cost nothing.
+   *
+   * @param file The mapped file.
+   * @param offset Byte offset of the frame in the file; on success it
+   *               is advanced to the start of the next frame.
+   * @return false if @a offset is at the end of the file.
+   */
+  bool
+  load(const boost::shared_ptr<const boost::iostreams::mapped_file_source>& file,
+       uint64_t& offset,
+       const I3FrameKeyMatcher& skip = I3FrameKeyMatcher(),
+       bool verify_checksums = true);
 
   std::string Dump() const;
 
@@ -432,35 +677,41 @@ class I3Frame
 #ifdef I3_I3FRAME_TESTING
   bool has_blob(const std::string& name) const
   {
-    map_t::const_iterator iter = map_.find(name);
-    if (iter == map_.end())
+    const boost::shared_ptr<value_t>* value = lookup(name);
+    if (!value)
       return false;
-    return iter->second->blob.buf.size() != 0;
+    return (*value)->blob.size() != 0;
   }
   bool has_ptr(const std::string& name) const
   {
-    map_t::const_iterator iter = map_.find(name);
-    if (iter == map_.end())
+    const boost::shared_ptr<value_t>* value = lookup(name);
+    if (!value)
       return false;
-    return (bool)iter->second->ptr;
+    settle(**value);
+    return (bool)(*value)->ptr;
   }
 #endif
 
  private:
 
   template <typename IStreamT>
-  bool load_old(IStreamT& ifs, const std::vector<std::string>& skip, 
+  bool load_frame(IStreamT& is, const I3FrameKeyMatcher& skip,
+       bool verify_checksums, const boost::shared_ptr<const char>& mapping);
+
+  template <typename IStreamT>
+  bool load_old(IStreamT& ifs, const I3FrameKeyMatcher& skip, 
 		unsigned version);
 
   template <typename IStreamT>
-  bool load_v4(IStreamT& ifs, const std::vector<std::string>& skip);
+  bool load_v4(IStreamT& ifs, const I3FrameKeyMatcher& skip);
 
   template <typename IStreamT>
-  bool load_v56(IStreamT& ifs, const std::vector<std::string>& skip, bool v6,
-       bool verify_checksums);
+  bool load_v56(IStreamT& ifs, const I3FrameKeyMatcher& skip, bool v6,
+       bool verify_checksums, const boost::shared_ptr<const char>& mapping);
 
 
   friend std::ostream& operator<<(std::ostream& o, const I3Frame& frame);
+  friend class I3FrameMixer;
 };
 
 std::ostream& operator<<(std::ostream& os, const I3Frame::Stream& stream);
@@ -468,7 +719,9 @@ std::ostream& operator<<(std::ostream& os, const I3Frame& frame);
 
 I3_POINTER_TYPEDEFS(I3Frame);
 
-typedef std::deque<I3FramePtr> FrameFifo;
+// defined in icetray/I3FrameFifo.h
+class I3FrameFifo;
+typedef I3FrameFifo FrameFifo;
 I3_POINTER_TYPEDEFS(FrameFifo);
 
 #endif // ICETRAY_I3FRAME_H_INCLUDED
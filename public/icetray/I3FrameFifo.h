@@ -0,0 +1,132 @@
+#ifndef ICETRAY_I3FRAMEFIFO_H_INCLUDED
+#define ICETRAY_I3FRAMEFIFO_H_INCLUDED
+
+#include <cstddef>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+
+#include <icetray/I3Frame.h>
+
+/**
+ * The queue of frames between two modules: a ring buffer of fixed
+ * capacity with one producer (the module pushing) and one consumer
+ * (the module popping).  It takes no locks, so the two may be on
+ * different threads (see I3PipelineStage); push() fails instead of
+ * growing when the buffer is full, and it is up to the producer to
+ * wait or to drain the consumer first, as I3Module::PushFrame() does.
+ *
+ * Depth is tracked on the producer side: the fifo counts frames
+ * pushed, failed pushes (stalls), the deepest it got, and how often it
+ * rose to its high-water mark, which is logged the first time.
+ */
+class I3FrameFifo
+{
+ public:
+  static const size_t DefaultCapacity = 1024;
+
+  struct Stats
+  {
+    boost::uint64_t pushed;
+    /// pushes that found the fifo full
+    boost::uint64_t stalls;
+    /// times the depth rose to the high-water mark
+    boost::uint64_t highwater;
+    size_t peak;
+    /// frames waiting when the stats were taken
+    size_t depth;
+  };
+
+  /// A fifo of @a capacity frames, high-water mark at capacity.
+  explicit I3FrameFifo(size_t capacity = DefaultCapacity);
+
+  /// Append @a frame, unless the fifo is full.  Producer only.
+  bool push(const I3FramePtr& frame)
+  {
+    size_t tail = tail_.load(boost::memory_order_relaxed);
+    size_t depth = tail - head_.load(boost::memory_order_acquire);
+    if (depth >= capacity_)
+      {
+        stalls_.fetch_add(1, boost::memory_order_relaxed);
+        return false;
+      }
+    slots_[tail & mask_] = frame;
+    tail_.store(tail + 1, boost::memory_order_release);
+    pushed_.fetch_add(1, boost::memory_order_relaxed);
+    if (++depth > peak_.load(boost::memory_order_relaxed))
+      peak_.store(depth, boost::memory_order_relaxed);
+    if (depth >= highwater_ || above_)
+      Watermark(depth);
+    return true;
+  }
+
+  /// Take the oldest frame into @a frame; false if there is none.
+  /// Consumer only.
+  bool pop(I3FramePtr& frame)
+  {
+    size_t head = head_.load(boost::memory_order_relaxed);
+    if (head == tail_.load(boost::memory_order_acquire))
+      return false;
+    frame.swap(slots_[head & mask_]);
+    slots_[head & mask_].reset();
+    head_.store(head + 1, boost::memory_order_release);
+    return true;
+  }
+
+  /// The oldest frame, or null if the fifo is empty.  Consumer only.
+  I3FramePtr front() const
+  {
+    size_t head = head_.load(boost::memory_order_relaxed);
+    if (head == tail_.load(boost::memory_order_acquire))
+      return I3FramePtr();
+    return slots_[head & mask_];
+  }
+
+  size_t size() const
+  {
+    return tail_.load(boost::memory_order_acquire) -
+      head_.load(boost::memory_order_acquire);
+  }
+  bool empty() const { return size() == 0; }
+  bool full() const { return size() >= capacity_; }
+  size_t capacity() const { return capacity_; }
+
+  /// Change the capacity.  Only while the fifo is empty and nobody is
+  /// pushing to or popping from it, e.g. before the tray runs.
+  void SetCapacity(size_t capacity);
+  /// Log and count the depth reaching @a nframes; 0 means capacity.
+  void SetHighWater(size_t nframes);
+
+  Stats GetStats() const;
+
+  SET_LOGGER("I3FrameFifo");
+
+ private:
+  I3FrameFifo(const I3FrameFifo&);
+  I3FrameFifo& operator=(const I3FrameFifo&);
+
+  /// Producer side of the high-water mark, off the fast path.
+  void Watermark(size_t depth);
+
+  // Producer and consumer indices each get a cache line of their own;
+  // both only ever increase, and index slots_ modulo its size.
+  char pad0_[64];
+  boost::atomic<size_t> head_;
+  char pad1_[64 - sizeof(boost::atomic<size_t>)];
+  boost::atomic<size_t> tail_;
+  char pad2_[64 - sizeof(boost::atomic<size_t>)];
+
+  /// A power of two at least capacity_ long.
+  std::vector<I3FramePtr> slots_;
+  size_t mask_;
+  size_t capacity_;
+  size_t highwater_;
+  /// Whether the depth is at the high-water mark since it last fell
+  /// well below it.  Producer only.
+  bool above_;
+
+  boost::atomic<boost::uint64_t> pushed_, stalls_, crossings_;
+  boost::atomic<size_t> peak_;
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef ICETRAY_I3FRAMEINDEX_H_INCLUDED
+#define ICETRAY_I3FRAMEINDEX_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <icetray/I3Frame.h>
+
+/**
+ * Table of contents of an .i3 file: the byte offset, stop, keys and
+ * object sizes of every frame in it.  With one in hand a reader can go
+ * straight to the N-th frame (or the next Physics frame after some
+ * DetectorStatus frame) instead of streaming through the whole file:
+ *
+ *   I3FrameIndex index = I3FrameIndex::Open("run.i3");
+ *   size_t n = index.Find(I3Frame::Physics, 1000);
+ *   boost::iostreams::filtering_istream ifs;
+ *   I3::dataio::open(ifs, "run.i3", index[n].offset);
+ *   I3Frame frame;
+ *   frame.load(ifs);
+ *
+ * Offsets are positions in the uncompressed stream, so seeking is O(1)
+ * for plain (or memory-mapped) files; compressed files still have to
+ * be decompressed up to the offset, or, if written with
+ * I3::dataio::open_seekable(), from the zstd frame holding it.
+ *
+ * Indices are stored next to the file they describe, see SidecarName().
+ */
+class I3FrameIndex
+{
+ public:
+  struct Entry
+  {
+    /// Offset of the frame in the uncompressed file.
+    uint64_t offset;
+    I3Frame::Stream stop;
+    /// Keys on the frame's own stream.
+    std::vector<std::string> keys;
+    /// Serialized size of the object under the corresponding key.
+    std::vector<uint32_t> sizes;
+  };
+
+  /// Returned by the lookup functions when there is no such frame.
+  static const size_t npos = size_t(-1);
+
+  I3FrameIndex() : file_size_(0), file_mtime_(0) { }
+
+  /// Scan @a filename (which may be compressed) and index its frames.
+  static I3FrameIndex Build(const std::string& filename);
+
+  /**
+   * Load the sidecar index of @a filename if there is one and it
+   * matches the file's size and modification time; otherwise build it,
+   * and try to write the sidecar for next time.
+   */
+  static I3FrameIndex Open(const std::string& filename);
+
+  /// Where the index of @a filename is kept.
+  static std::string SidecarName(const std::string& filename)
+  { return filename + ".idx"; }
+
+  void Save(const std::string& indexfile) const;
+  /// @return false if @a indexfile does not exist or is not an index.
+  bool Load(const std::string& indexfile);
+
+  size_t size() const { return entries_.size(); }
+  bool empty() const { return entries_.empty(); }
+  const Entry& operator[](size_t n) const { return entries_[n]; }
+
+  /// Size of the file on disk when it was indexed.
+  uint64_t FileSize() const { return file_size_; }
+  /// Its modification time then, in ns since the epoch.
+  uint64_t FileTime() const { return file_mtime_; }
+
+  /// Position of the @a n-th (from 0) frame on stream @a stop.  O(1).
+  size_t Find(I3Frame::Stream stop, size_t n = 0) const;
+
+  /// Position of the first frame on stream @a stop after position
+  /// @a after.  O(log) of the frames on @a stop.
+  size_t Next(size_t after, I3Frame::Stream stop) const;
+
+  /**
+   * Positions of the frames that would be mixed into frame @a n by an
+   * I3FrameMixer: the latest preceding frame on each other stream,
+   * except Physics and TrayInfo.  Load these first to reconstruct the
+   * frame as a tray would have seen it.  O(1) in the size of the file.
+   */
+  std::vector<size_t> Dependencies(size_t n) const;
+
+ private:
+  /// Fill in the lookup tables below from entries_.
+  void Tabulate();
+
+  std::vector<Entry> entries_;
+  uint64_t file_size_, file_mtime_;
+
+  /// Positions of the frames on each stream, by stream id.
+  std::vector<std::vector<size_t> > positions_;
+  /// The streams Dependencies() looks at, and for each frame n the
+  /// latest position before it on each of them (npos if none), at
+  /// latest_[n * mixed_.size() + s].
+  std::vector<I3Frame::Stream> mixed_;
+  std::vector<size_t> latest_;
+};
+
+#endif
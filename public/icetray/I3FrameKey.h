@@ -0,0 +1,59 @@
+#ifndef ICETRAY_I3FRAMEKEY_H_INCLUDED
+#define ICETRAY_I3FRAMEKEY_H_INCLUDED
+
+#include <string>
+#include <boost/functional/hash.hpp>
+
+/**
+ * A frame key, interned: every I3FrameKey for the same name refers to
+ * one copy of it in a process-wide table, so keys compare and hash as
+ * pointers.  The I3Frame stores its objects under these, and a module
+ * that looks up the same names on every frame can make its keys once,
+ * in Configure(), and skip hashing the strings each time:
+ *
+ *   key_ = I3FrameKey("OfflinePulses");
+ *   ...
+ *   if (frame->Has(key_)) ...
+ *
+ * Interned names are never released: the table grows with every
+ * distinct name the process sees, keys read from files included, and
+ * keeps its outgrown arrays (together at most the size of the current
+ * one).  Lookups of known names take no lock, so the table is safe and
+ * cheap to use from any thread; only interning a new name serializes.
+ */
+class I3FrameKey
+{
+ public:
+  /// A key no frame holds anything under.
+  I3FrameKey() : name_(0) { }
+
+  /// The key for @a name, interning it if this is its first use.
+  explicit I3FrameKey(const std::string& name);
+
+  /**
+   * Look @a name up without interning it.
+   *
+   * @return false (and leave @a key alone) if @a name was never
+   * interned, in which case no frame can hold anything under it.
+   */
+  static bool Find(const std::string& name, I3FrameKey& key);
+
+  /// The name; empty for a default-constructed key.
+  const std::string& str() const;
+
+  bool operator==(const I3FrameKey& rhs) const { return name_ == rhs.name_; }
+  bool operator!=(const I3FrameKey& rhs) const { return name_ != rhs.name_; }
+
+  struct hash
+  {
+    size_t operator()(const I3FrameKey& key) const
+    {
+      return boost::hash<const std::string*>()(key.name_);
+    }
+  };
+
+ private:
+  const std::string* name_;
+};
+
+#endif
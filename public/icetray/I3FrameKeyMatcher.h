@@ -0,0 +1,43 @@
+#ifndef ICETRAY_I3FRAMEKEYMATCHER_H_INCLUDED
+#define ICETRAY_I3FRAMEKEYMATCHER_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+/**
+ * A set of frame key patterns (the skip lists taken by I3Frame::load(),
+ * I3Frame::save() and I3Frame::create_blobs()), compiled once.
+ *
+ * Each pattern is a regular expression which must match the whole key.
+ * Patterns without regex syntax are looked up in a hash set, patterns
+ * of the form "Literal.*" are looked up in a prefix tree, and only the
+ * remainder is folded into a single combined regex.  Build one of these
+ * per module (e.g. in Configure()) rather than per frame; copies are
+ * cheap and share the compiled state.
+ */
+class I3FrameKeyMatcher
+{
+ public:
+  /// A matcher that matches nothing.
+  I3FrameKeyMatcher();
+
+  /// Compile a list of patterns.  Deliberately not explicit, so that
+  /// code passing a std::vector<std::string> skip list keeps working.
+  I3FrameKeyMatcher(const std::vector<std::string>& patterns);
+
+  /// Whether @a key matches any of the patterns.
+  bool operator()(const std::string& key) const;
+
+  /// True if no patterns were given, i.e. nothing can match.
+  bool empty() const { return !impl_; }
+
+  /// The patterns this matcher was compiled from.
+  std::vector<std::string> patterns() const;
+
+ private:
+  struct impl;
+  boost::shared_ptr<const impl> impl_;
+};
+
+#endif
@@ -4,6 +4,25 @@
 #include <boost/optional.hpp>
 #include "icetray/I3Frame.h"
 
+/**
+ * The latest cache entry for each stream, shared by the mixers of every
+ * module in a tray.  A mixer handed a frame that another mixer has
+ * already cached reuses that entry instead of copying the frame again.
+ * Frames then reach each module overlaid with the very entries the
+ * module's own mixer holds, and mixing them again is a no-op that
+ * I3FrameMixer::Mix() can detect with a few pointer comparisons.
+ *
+ * Each module still keeps its own mixer, so modules that hold back,
+ * drop or reorder frames mix exactly as they would on their own.
+ */
+class I3FrameSnapshots{
+private:
+  friend class I3FrameMixer;
+  std::vector<boost::shared_ptr<I3Frame> > latest_;
+};
+
+I3_POINTER_TYPEDEFS(I3FrameSnapshots);
+
 /**
  * When I3Frames are processed keys are mixed to subsequent frames on different
  * streams. This class encapsulates the necessary logic in one place, and 
@@ -73,10 +92,30 @@ public:
   void TrackOrder(bool t){ track_order_ = t; }
   bool MixingDisabled() const{ return(disable_mixing_); }
   void Reset(){ parent_cache_.clear(); }
+
+  /**
+   * Take cache entries from, and offer them to, snapshots shared with
+   * other mixers, rather than copying every frame.
+   */
+  void ShareSnapshots(I3FrameSnapshotsPtr snapshots){ snapshots_ = snapshots; }
 private:
   bool track_order_;
   const bool disable_mixing_;
   std::vector<boost::shared_ptr<I3Frame> > parent_cache_;
+  I3FrameSnapshotsPtr snapshots_;
+
+  /**
+   * Whether Mix() would leave frame as it is: it holds only its own
+   * keys, is (for miscible streams) the cache entry for its stream, and
+   * is overlaid with exactly the other cache entries, in order.
+   */
+  bool IsMixed(const I3Frame& frame) const;
+
+  /**
+   * A cache entry for frame: the one in snapshots_ if that is still a
+   * copy of it, otherwise a new copy (which then goes in snapshots_).
+   */
+  boost::shared_ptr<I3Frame> Snapshot(const I3Frame& frame);
   
   /**
    * The internal implementation of UpdateDependencies which assumes that the 
@@ -23,25 +23,33 @@
 #define ICETRAY_I3MODULE_H_INCLUDED
 
 #include <cstdlib>
+#include <deque>
+#include <map>
 #include <string>
 #include <set>
+#include <vector>
 #include <icetray/Version.h>
 #include <icetray/I3Logging.h>
 #include <icetray/I3Context.h>
 #include <icetray/I3PointerTypedefs.h>
 #include <icetray/I3Frame.h>
+#include <icetray/I3FrameFifo.h>
+#include <icetray/I3FrameMixing.h>
+#include <icetray/I3ThreadPool.h>
 #include <icetray/I3Configuration.h>
 #include <icetray/I3PhysicsUsage.h>
+#include <icetray/I3LatencyHistogram.h>
 #include <boost/type_traits/is_const.hpp>
 #include <boost/utility/enable_if.hpp>
 #include <boost/python/object.hpp>
 #include <boost/python/extract.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/function.hpp>
 #include <boost/bind.hpp>
+#include <boost/thread/tss.hpp>
 
 class I3Configuration;
 class I3Context;
-class I3FrameMixer;
 
 /**
  * This class defines the interface which should be implementaed by all 
@@ -76,6 +84,10 @@ public:
 
   void Do(void (I3Module::*f)());
 
+  /// Call @a f on this module alone; Do() also passes on to the next
+  /// modules.
+  void Call(void (I3Module::*f)());
+
   /**
    * The purpose of this transition is to give this object an opportunity to
    * access all of its parameters so that it will be able to process data.
@@ -122,6 +134,25 @@ public:
    */
   virtual void SetName(const std::string& name) { name_ = name; }
 
+  /**
+   * How I3Tray may run this module when it has physics workers (see
+   * I3Tray::SetPhysicsWorkers()).  Frames other than DAQ and Physics
+   * always reach a module one at a time and in order.
+   */
+  enum Concurrency {
+    /// One frame at a time; the default.
+    Serial,
+    /// DAQ and Physics frames may be handed to this instance from
+    /// several threads at once.
+    ThreadSafe,
+    /// Each worker gets an instance of its own, created from the module
+    /// factory and configured like this one.  DAQ and Physics frames go
+    /// to one instance each; all the others go to every instance.
+    PerWorker
+  };
+
+  virtual Concurrency GetConcurrency() const { return concurrency_; }
+
  protected:
 
   void Register(const I3Frame::Stream& when, boost::function<void(I3FramePtr)>);
@@ -159,6 +190,18 @@ public:
    *    and push the frame out early if not interested.
    */
   virtual bool ShouldDoPhysics(I3FramePtr frame);
+
+  /**
+   * Called instead of Physics() with consecutive Physics frames from
+   * the inbox, when the tray runs modules in batches (see
+   * I3Tray::SetBatchSize()).  Consecutive Physics frames were mixed
+   * with the same parent frames, so setup that depends only on those
+   * can be done once per batch.  Each frame has passed ShouldDoProcess()
+   * and ShouldDoPhysics().  The default calls Physics() on each in
+   * turn; frames are pushed on only by what the module pushes, as
+   * with Physics().
+   */
+  virtual void PhysicsBatch(std::vector<I3FramePtr>& frames);
   
   /**
    * Called when the frame was generated by a new Geometry record.
@@ -222,6 +265,20 @@ public:
    */
   void RequestSuspension() const;
 
+  /**
+   * Declare how this module may be run concurrently; call from the
+   * constructor or Configure().
+   */
+  void SetConcurrency(Concurrency c) { concurrency_ = c; }
+
+  /**
+   * Declare frame objects this module will Get() from most frames.
+   * If the tray has a thread pool (I3Tray::SetThreadPoolSize()), they
+   * are deserialized in the background from the moment the frame
+   * enters the tray.  Call from Configure().
+   */
+  void Prefetch(const std::vector<std::string>& keys);
+
   /**
    * If this module buffers frames, when it receives a Finish() it
    * must push all remaining frames and then Flush() to be sure the
@@ -244,7 +301,9 @@ public:
   void AddOutBox(const std::string& name);
 
   /**
-   * Puts the specified I3Frame into the specifed OutBox.
+   * Puts the specified I3Frame into the specifed OutBox.  If the
+   * OutBox's fifo is full, the module it feeds runs first to make
+   * room; frames pushed to an OutBox connected to nothing are dropped.
    *
    * @param frame the I3Frame to put into the OutBox.
    * @param name the name associated with the OutBox.
@@ -345,18 +404,172 @@ public:
 
   I3PhysicsUsage ReportUsage();
 
+  /// Depth counters of each outbox's fifo.
+  std::map<std::string, I3FrameFifo::Stats> ReportFifos() const;
+
+  /// Frames pushed so far, by stream name.  Each PushFrame() call
+  /// counts once, however many outboxes it feeds.
+  std::map<std::string, boost::uint64_t> ReportPushes() const;
+
+  ///Give every outbox a fifo of @a capacity frames, logging when one
+  ///fills to @a highwater (0: to capacity).  Used by I3Tray before
+  ///the first frame is pushed.
+  void SetFifoLimits(unsigned capacity, unsigned highwater);
+
+  /// Keys declared with Prefetch().
+  const std::vector<std::string>& GetPrefetchKeys() const { return prefetch_keys_; }
+
+  ///Have every frame this module pushes start deserializing @a keys on
+  ///@a pool.  Each frame is held back until the next one is pushed (or
+  ///the module finishes), so that its objects are read while the frame
+  ///before it goes through the tray.  Used by I3Tray on the driving
+  ///module.
+  void PrefetchOnPush(const std::vector<std::string>& keys, I3ThreadPoolPtr pool);
+
  private:
 
   /** module name */
   std::string name_;
 
   unsigned nphyscall_, ndaqcall_;
-  double sysphystime_, userphystime_;
-  double sysdaqtime_, userdaqtime_;
+  /// CPU time of the calling thread, system time included.
+  double userphystime_, userdaqtime_;
+
+  /// How long each Process_() call took, and the calls and time
+  /// (in ns) by stream id.
+  class ProcessTimer;
+  I3LatencyHistogram latency_;
+  unsigned streamcalls_[256];
+  boost::uint64_t streamtime_[256];
+  /// PushFrame() calls by stream id; ReportPushes() reads them from
+  /// other threads.
+  boost::atomic<boost::uint64_t> pushed_[256];
+
+  std::vector<std::string> prefetch_keys_;
+  std::vector<std::string> push_prefetch_keys_;
+  I3ThreadPoolPtr prefetch_pool_;
+  /// While prefetching, the last frame pushed and its outboxes: it is
+  /// queued once the next one has started deserializing.
+  I3FramePtr ahead_;
+  std::vector<outboxmap_t::iterator> ahead_outboxes_;
+  void ReleaseAhead();
 
   // cache of previous metadata frames (per-outbox)
   std::map<std::string, boost::shared_ptr<I3FrameMixer> > cachemap_;
   void SyncCache(std::string outbox, I3FramePtr frame);
+  /// Queue @a frame on the outbox at @a iter, first running the next
+  /// module while its fifo is full.
+  void Enqueue(outboxmap_t::iterator iter, const I3FramePtr& frame);
+
+  /// Cache entries the mixers share with the modules around this one:
+  /// the tray's, or those of this module's pipeline stage.
+  I3FrameSnapshotsPtr snapshots_;
+  I3FrameSnapshotsPtr GetSnapshots();
+
+  Concurrency concurrency_;
+
+  /// How many Physics frames Process() may hand to PhysicsBatch() at
+  /// once; set by I3Scheduler.
+  unsigned batch_size_;
+  /// Process() for a Physics @a frame: gather the ones after it and
+  /// call PhysicsBatch().
+  void ProcessPhysicsBatch(I3FramePtr frame);
+
+  typedef void (I3Module::*handler_t)(I3FramePtr);
+  /// What Process() calls for a frame on stream s: dispatch_[s.id()],
+  /// one of the handlers below, or X() itself.
+  handler_t dispatch_[256];
+  /// Where frames that ShouldDoX() turns away go.
+  handler_t otherstops_;
+  /// Point every stream at its built-in handler, then at what was
+  /// registered for it.  Called from the constructor and Configure_().
+  void CompileDispatch();
+
+  /// The ShouldDoX() the module overrides, and so must be asked.
+  enum {
+    CheckPhysics = 1, CheckDAQ = 2, CheckGeometry = 4, CheckCalibration = 8,
+    CheckDetectorStatus = 16, CheckSimulation = 32, CheckOtherStops = 64,
+    CheckAll = 127
+  };
+  unsigned should_do_;
+
+  /// Process() for a frame on each built-in stream, if ShouldDoX() is
+  /// overridden: check it, call X() or OtherStops().
+  void DispatchPhysics(I3FramePtr frame);
+  void DispatchDAQ(I3FramePtr frame);
+  void DispatchGeometry(I3FramePtr frame);
+  void DispatchCalibration(I3FramePtr frame);
+  void DispatchDetectorStatus(I3FramePtr frame);
+  void DispatchSimulation(I3FramePtr frame);
+  void DispatchOtherStops(I3FramePtr frame);
+  /// Physics() and DAQ() with their timers, once the frame is let in.
+  void RunPhysics(I3FramePtr frame);
+  void RunDAQ(I3FramePtr frame);
+  /// The function given to Register() for the frame's stream.
+  void DispatchRegistered(I3FramePtr frame);
+  /// methods_, by stream id, for DispatchRegistered().
+  boost::function<void(I3FramePtr)> registered_[256];
+
+  // For FindOverrides(): a char if &T::ShouldDoX is still I3Module's.
+  // An override that can't be seen from here counts as one.
+  static char Inherited(bool (I3Module::*)(I3FramePtr));
+  template <class C> static long Inherited(bool (C::*)(I3FramePtr));
+#define I3MODULE_INHERITS(X)                                            \
+  template <class T> static bool                                        \
+  Inherits##X(char (*)[sizeof(Inherited(&T::ShouldDo##X))])             \
+  { return sizeof(Inherited(&T::ShouldDo##X)) == 1; }                  \
+  template <class T> static bool Inherits##X(...) { return false; }
+  I3MODULE_INHERITS(Physics)
+  I3MODULE_INHERITS(DAQ)
+  I3MODULE_INHERITS(Geometry)
+  I3MODULE_INHERITS(Calibration)
+  I3MODULE_INHERITS(DetectorStatus)
+  I3MODULE_INHERITS(Simulation)
+  I3MODULE_INHERITS(OtherStops)
+#undef I3MODULE_INHERITS
+
+  /// Skip the ShouldDoX() checks that @a T leaves to I3Module, which
+  /// always say yes.  Called by I3_MODULE's factory function; modules
+  /// made any other way are asked every time.
+  template <class T>
+  void FindOverrides()
+  {
+    should_do_ = (InheritsPhysics<T>(0) ? 0 : CheckPhysics)
+      | (InheritsDAQ<T>(0) ? 0 : CheckDAQ)
+      | (InheritsGeometry<T>(0) ? 0 : CheckGeometry)
+      | (InheritsCalibration<T>(0) ? 0 : CheckCalibration)
+      | (InheritsDetectorStatus<T>(0) ? 0 : CheckDetectorStatus)
+      | (InheritsSimulation<T>(0) ? 0 : CheckSimulation)
+      | (InheritsOtherStops<T>(0) ? 0 : CheckOtherStops);
+    CompileDispatch();
+  }
+  template <class, class> friend struct ModuleCreate;
+
+  /**
+   * The inbox and outbox of a module while I3PhysicsWorkers runs it,
+   * in place of the fifos: while one is set for the calling thread,
+   * PopFrame() and PeekFrame() take from inbox and PushFrame() mixes
+   * with mixer (if any) and appends to outbox.
+   */
+  struct Lane
+  {
+    Lane() : mixer(0) { }
+    std::deque<I3FramePtr> inbox;
+    std::vector<I3FramePtr> outbox;
+    I3FrameMixer* mixer;
+  };
+  /// Set for modules that I3PhysicsWorkers runs; only those look for
+  /// a lane.
+  bool laned_;
+  /// Set for modules that run on an I3PipelineStage's thread, while
+  /// the tray's thread may read their timers (I3Tray::Metrics()).
+  bool staged_;
+  static boost::thread_specific_ptr<Lane> lane_;
+  static void LeaveLane(Lane*) { }
+  friend class I3PhysicsWorkers;
+  friend class I3PipelineStage;
+  friend class I3ProcessWorkers;
+  friend class I3Scheduler;
 
   /// only report usage times if greater than this
   const static double min_report_time_;
@@ -22,19 +22,43 @@
 #ifndef ICETRAY_I3PHYSICSUSAGE_H_INCLUDED
 #define ICETRAY_I3PHYSICSUSAGE_H_INCLUDED
 
+#include <map>
 #include <string>
 #include <icetray/I3PointerTypedefs.h>
 
+/// Process() calls for frames on one stream, and their wall-clock time.
+struct I3StreamUsage
+{
+  unsigned ncall;
+  double walltime;
+
+  I3StreamUsage():
+    ncall(0),
+    walltime(0){};
+};
+
 struct I3PhysicsUsage
 {
+  /// CPU time of the Physics and DAQ calls: usertime is that of the
+  /// thread that made them, system time included; systime is 0.
   double systime;
   double usertime;
   unsigned ncall;
+
+  /// Wall-clock time of every Process() call, whatever the stream.
+  double walltime;
+  /// Wall-clock time of one Process() call: median, 99th percentile
+  /// and longest, in seconds.
+  double p50, p99, max;
+  /// By stream name ("Physics", "Geometry", ...).
+  std::map<std::string, I3StreamUsage> streams;
   
   I3PhysicsUsage():
     systime(0),
     usertime(0),
-    ncall(0){};
+    ncall(0),
+    walltime(0),
+    p50(0), p99(0), max(0){};
   
 };
 
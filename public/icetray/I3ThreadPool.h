@@ -0,0 +1,79 @@
+#ifndef ICETRAY_I3THREADPOOL_H_INCLUDED
+#define ICETRAY_I3THREADPOOL_H_INCLUDED
+
+#include <deque>
+#include <exception>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <icetray/I3PointerTypedefs.h>
+
+/**
+ * A fixed set of worker threads running tasks off a shared queue.
+ * The tray owns one (see I3Tray::SetThreadPoolSize()) and lends it to
+ * whatever wants to spread work over cores, e.g. I3Frame::Prefetch().
+ *
+ * A pool of size zero has no threads and runs every task inline in
+ * Submit().
+ */
+class I3ThreadPool
+{
+ public:
+  /// Handle on one submitted function.
+  class Task
+  {
+   public:
+    /// True once the function has returned (or thrown).
+    bool Done() const;
+
+    /**
+     * Block until the function has run, and rethrow anything it
+     * threw.  A task that no worker has picked up yet is run right
+     * here instead, so waiting never costs more than doing the work.
+     */
+    void Wait();
+
+   private:
+    friend class I3ThreadPool;
+    enum state_t { Queued, Running, Finished };
+
+    explicit Task(const boost::function<void ()>& f) : f_(f), state_(Queued) { }
+    /// Run f_ if nobody else has claimed it yet.
+    void Run();
+
+    boost::function<void ()> f_;
+    state_t state_;
+    std::exception_ptr error_;
+    mutable boost::mutex mtx_;
+    boost::condition_variable done_;
+  };
+  typedef boost::shared_ptr<Task> TaskPtr;
+
+  explicit I3ThreadPool(unsigned nthreads);
+  /// Finishes the queued tasks, then joins the workers.
+  ~I3ThreadPool();
+
+  unsigned size() const { return threads_.size(); }
+
+  TaskPtr Submit(const boost::function<void ()>& f);
+
+ private:
+  I3ThreadPool(const I3ThreadPool&);
+  I3ThreadPool& operator=(const I3ThreadPool&);
+
+  void Work();
+
+  std::vector<boost::shared_ptr<boost::thread> > threads_;
+  std::deque<TaskPtr> queue_;
+  bool stopping_;
+  boost::mutex mtx_;
+  boost::condition_variable wakeup_;
+};
+
+I3_POINTER_TYPEDEFS(I3ThreadPool);
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef ICETRAY_I3TRACER_H_INCLUDED
+#define ICETRAY_I3TRACER_H_INCLUDED
+
+#include <string>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+
+/**
+ * Records a timeline of what the tray does -- module calls, frames
+ * loaded and saved, services configured and finished -- and writes it
+ * in the Chrome trace-event format, which chrome://tracing and Perfetto
+ * read.  I3Tray turns it on for a run when given a file to write to
+ * (I3Tray::SetTraceFile()).
+ *
+ * Every thread appends to a buffer of its own, so recording takes no
+ * locks.  While the tracer is off, an I3TraceScope costs one relaxed
+ * load of a flag.
+ */
+class I3Tracer
+{
+ public:
+  static bool IsEnabled() { return enabled_.load(boost::memory_order_relaxed); }
+
+  /// Drop whatever was recorded, and record from now on.
+  static void Start();
+  static void Stop();
+
+  /// Write what was recorded as trace-event JSON.  Call when no other
+  /// thread is recording.
+  static void Write(const std::string& path);
+
+  /// Nanoseconds on the monotonic clock.
+  static boost::uint64_t Now();
+
+  /**
+   * Record that @a name (in @a category) ran from @a start to @a end.
+   * @a stop, if not 0, and @a seq, if not negative, go in the event's
+   * arguments.
+   */
+  static void Record(const char* category, const std::string& name,
+                     char stop, boost::int64_t seq,
+                     boost::uint64_t start, boost::uint64_t end);
+
+ private:
+  static boost::atomic<bool> enabled_;
+};
+
+/**
+ * Records the time between its construction and destruction, if the
+ * tracer is on.  @a name must outlive it.
+ */
+class I3TraceScope
+{
+ public:
+  I3TraceScope(const char* category, const std::string& name,
+               char stop = 0, boost::int64_t seq = -1)
+    : active_(I3Tracer::IsEnabled())
+  {
+    if (!active_)
+      return;
+    category_ = category;
+    name_ = &name;
+    stop_ = stop;
+    seq_ = seq;
+    start_ = I3Tracer::Now();
+  }
+
+  ~I3TraceScope()
+  {
+    if (active_)
+      I3Tracer::Record(category_, *name_, stop_, seq_, start_, I3Tracer::Now());
+  }
+
+  /// For when the stream is known only at the end, as for loads.
+  void SetStop(char stop) { stop_ = stop; }
+
+ private:
+  I3TraceScope(const I3TraceScope&);
+  I3TraceScope& operator=(const I3TraceScope&);
+
+  bool active_;
+  const char* category_;
+  const std::string* name_;
+  char stop_;
+  boost::int64_t seq_;
+  boost::uint64_t start_;
+};
+
+#endif
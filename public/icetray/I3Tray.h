@@ -38,12 +38,16 @@
 #include <icetray/init.h>
 #include <icetray/is_shared_ptr.h>
 
+#include <boost/atomic.hpp>
 #include <boost/mpl/or.hpp>
 #include <boost/utility/enable_if.hpp>
 #include <boost/utility/result_of.hpp>
 #include <boost/type_traits/is_base_of.hpp>
 
 class I3ServiceFactory;
+class I3ThreadPool;
+class I3Scheduler;
+class I3MetricsServer;
 
 /**
    This is I3Tray.
@@ -200,6 +204,97 @@ public:
    */
   void Finish();
 
+  /**
+   * Give the tray a pool of @a nthreads worker threads, shared by all
+   * its modules (see I3Module::Prefetch()).  Zero, the default, means
+   * no pool.  Must be called before Execute().
+   */
+  void SetThreadPoolSize(unsigned nthreads);
+
+  /**
+   * Run DAQ frames, and the Physics frames after them, on @a nthreads
+   * worker threads wherever consecutive modules declared they can be
+   * (see I3Module::Concurrency).  Other frames still go through one at
+   * a time, after everything before them, and frames leave such a
+   * stretch of modules in the order they entered it.  Zero, the
+   * default, runs everything on the calling thread.  Must be called
+   * before Execute().
+   */
+  void SetPhysicsWorkers(unsigned nthreads);
+
+  /**
+   * Run @a module, and the modules after it up to the start of the
+   * next stage, on a thread of their own.  Frames reach the stage
+   * through a queue of SetStageQueueSize() frames; the modules feeding
+   * it wait while that is full.  Modules written in Python cannot be
+   * part of a stage other than the first.  Must be called before
+   * Execute().
+   */
+  void StartStage(const std::string& module);
+
+  /// How many frames may wait between stages; 16 by default.
+  void SetStageQueueSize(unsigned nframes);
+
+  /**
+   * How many frames may wait between two modules; 1024 by default.  A
+   * module pushing to a full outbox runs the next module first to
+   * make room.  Must be called before Execute().
+   */
+  void SetFifoCapacity(unsigned nframes);
+
+  /**
+   * Count (and log, the first time) every time a fifo between two
+   * modules fills to @a nframes frames; 0, the default, means to
+   * capacity.  The counts are logged when the tray finishes.
+   */
+  void SetFifoHighWater(unsigned nframes);
+
+  /**
+   * Run each module over up to @a nframes frames before moving on to
+   * the next (see I3Scheduler); the driving module is called until it
+   * has pushed that many, and modules get consecutive Physics frames
+   * together in I3Module::PhysicsBatch().  With 1, each frame goes
+   * through the tray before the driving module is called again.  The
+   * default, 0, takes frames through with recursive I3Module::Do()
+   * calls, as trays always have.  Must be called before Execute().
+   */
+  void SetBatchSize(unsigned nframes);
+
+  /**
+   * Run the modules from @a first to @a last, which must follow one
+   * another in a single line, in @a nprocs processes forked from this
+   * one once the tray is configured (see I3ProcessWorkers).  Frames
+   * travel to and from them serialized, and leave @a last in the order
+   * they reached @a first.  Cannot be combined with pipeline stages,
+   * physics workers or a thread pool.  Must be called before Execute().
+   */
+  void SetWorkerProcesses(unsigned nprocs, const std::string& first,
+                          const std::string& last);
+
+  /**
+   * Record what the tray does while it executes -- every module call,
+   * frame load and save, and service configuration -- and write the
+   * timeline to @a path in the Chrome trace-event format (see
+   * I3Tracer).  An empty path, the default, records nothing.  Must be
+   * called before Execute().
+   */
+  void SetTraceFile(const std::string& path);
+
+  /**
+   * While the tray executes, answer HTTP requests on @a address --
+   * "unix:PATH" for a Unix socket, or "localhost:PORT" -- with
+   * Metrics().  Must be called before Execute().
+   */
+  void SetMetricsAddress(const std::string& address);
+
+  /**
+   * Counters of the running tray in the Prometheus text format: frames
+   * pushed by the driving module on each stream, calls and time of
+   * every module, fifo depths, bytes read and written, and memory by
+   * label.  Sending the process SIGUSR1 logs this.
+   */
+  std::string Metrics();
+
   /**
    * Get the tray info object for this tray.
    */
@@ -297,7 +392,31 @@ private:
   bool boxes_connected;
   bool configure_called;
   bool execute_called;
-  bool suspension_requested;
+  // may be set from any stage's thread
+  boost::atomic<bool> suspension_requested;
+
+  unsigned thread_pool_size;
+  boost::shared_ptr<I3ThreadPool> thread_pool;
+
+  unsigned physics_workers;
+  boost::shared_ptr<I3ThreadPool> physics_pool;
+
+  std::vector<std::string> stage_starts;
+  unsigned stage_queue_size;
+
+  unsigned fifo_capacity;
+  unsigned fifo_highwater;
+
+  unsigned batch_size;
+  boost::shared_ptr<I3Scheduler> scheduler;
+
+  unsigned worker_processes;
+  std::string workers_first, workers_last;
+
+  std::string trace_file;
+
+  std::string metrics_address;
+  boost::shared_ptr<I3MetricsServer> metrics_server;
 
   SET_LOGGER("I3Tray");
 
@@ -307,6 +426,9 @@ private:
   static void die_messily(int sig);
   static void report_usage(int sig);
 
+  static volatile sig_atomic_t snapshot_requested;
+  static void request_snapshot(int sig);
+
   friend void I3Module::Do(void (I3Module::*)());
 
   friend class I3TrayInfoService;
@@ -15,6 +15,8 @@
 #endif
 
 #include <algorithm>  // count.
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/iostreams/categories.hpp>
 #include <boost/iostreams/char_traits.hpp>
 #include <boost/iostreams/operations.hpp>
@@ -42,8 +44,11 @@ namespace boost {
           multichar_tag,
           optimally_buffered_tag
       { };
-      explicit basic_counter64(uint64_t first_char = 0)
-        : chars_(first_char)
+      /// Also add every character to @a total, if given; that may be
+      /// read from other threads.
+      explicit basic_counter64(uint64_t first_char = 0,
+                               boost::atomic<uint64_t>* total = 0)
+        : chars_(first_char), total_(total)
       { }
 
       uint64_t characters() const { return chars_; }
@@ -56,7 +61,7 @@ namespace boost {
         std::streamsize result = iostreams::read(src, s, n);
         if (result == -1)
 	  return -1;
-        chars_ += result;
+        Count(result);
         return result;
       }
 
@@ -64,11 +69,19 @@ namespace boost {
       std::streamsize write(Sink& snk, const char_type* s, std::streamsize n)
       {
         std::streamsize result = iostreams::write(snk, s, n);
-        chars_ += result;
+        Count(result);
         return result;
       }
     private:
+      void Count(std::streamsize n)
+      {
+        chars_ += n;
+        if (total_)
+          total_->fetch_add(n, boost::memory_order_relaxed);
+      }
+
       uint64_t chars_;
+      boost::atomic<uint64_t>* total_;
     };
     BOOST_IOSTREAMS_PIPABLE(basic_counter64, 1)
 
@@ -23,13 +23,42 @@
 #define ICETRAY_OPEN_H_INCLUDED
 
 #include <string>
+#include <vector>
+#include <stdint.h>
+#include <boost/shared_ptr.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 
 namespace I3 {
   namespace dataio {
 
+    /**
+     * Open an input file, decompressing it if indicated by an extension
+     * on the file name.  If $I3_READAHEAD is set to a number of buffers,
+     * this is open_readahead() with that many.
+     */
     void open(boost::iostreams::filtering_istream&, const std::string& filename);
 
+    /**
+     * Like open(), but read and decompress on a thread of its own, up to
+     * @a nbuffers buffers of at most @a buffer_size bytes ahead of the
+     * reader, so that I/O and decompression overlap with processing.
+     * socket:// and http:// inputs are opened as by open(), without.
+     */
+    void open_readahead(boost::iostreams::filtering_istream&,
+                        const std::string& filename,
+                        unsigned nbuffers = 4,
+                        size_t buffer_size = 1 << 20);
+
+    /**
+     * Open an input file positioned at @a offset bytes into its
+     * uncompressed contents, e.g. at a frame found in an I3FrameIndex.
+     * Plain files are seeked directly; compressed and remote ones are
+     * read and discarded up to the offset.
+     */
+    void open(boost::iostreams::filtering_istream&, const std::string& filename,
+              uint64_t offset);
+
     /**
      * Open an output file using compression if indicated by an extension on the
      * file name.
@@ -41,11 +70,71 @@ namespace I3 {
      *         6 for bzip2 (.bz2)
      *         4 for zstd (.zst)
      * \param mode the mode to use when writing
+     * \param nthreads for zstd, the number of threads to compress on. The
+     *        default of zero takes it from $I3_ZSTD_THREADS, if set, and
+     *        otherwise compresses on the calling thread.
      */
     void open(boost::iostreams::filtering_ostream&, 
               const std::string& filename,
               int compression_level_ = 0,
-              std::ios::openmode mode = std::ios::binary);
+              std::ios::openmode mode = std::ios::binary,
+              unsigned nthreads = 0);
+
+    /**
+     * Open a .zst output file that can be read from the middle.  A new
+     * zstd frame starts every @a frames_per_seek I3Frames or
+     * @a bytes_per_seek bytes, whichever comes first, at the next I3Frame
+     * boundary given to mark_frame(); if mark_frame() is never called,
+     * every @a bytes_per_seek bytes.  At the end goes a seek table (see
+     * seek_table()), in a skippable frame that other zstd readers ignore.
+     * open(ifs, filename, offset) uses it to start decompressing at the
+     * zstd frame holding @a offset.
+     */
+    void open_seekable(boost::iostreams::filtering_ostream&,
+                       const std::string& filename,
+                       unsigned frames_per_seek,
+                       uint64_t bytes_per_seek,
+                       int compression_level_ = 0,
+                       unsigned nthreads = 0);
+
+    /**
+     * Tell a file opened with open_seekable() that an I3Frame on stream
+     * @a stop (I3Frame::Stream::id()) starts with the next byte written.
+     * Does nothing for other files.
+     */
+    void mark_frame(boost::iostreams::filtering_ostream&, char stop);
+
+    /// Where a zstd frame of a seekable file starts.
+    struct seek_point
+    {
+      /// Offsets in the file and in its uncompressed contents.
+      uint64_t compressed, uncompressed;
+      /// Number (from 0) and stream of the I3Frame the zstd frame
+      /// starts with; npos and 0 if it doesn't start on one.
+      uint64_t frame;
+      char stop;
+
+      static const uint64_t npos = uint64_t(-1);
+    };
+
+    /// The seek table of a file written by open_seekable(); empty for
+    /// any other file.
+    std::vector<seek_point> seek_table(const std::string& filename);
+
+    typedef boost::shared_ptr<const boost::iostreams::mapped_file_source> mapped_file_ptr;
+
+    /**
+     * Map an uncompressed .i3 file read-only into memory, to read
+     * frames from with I3Frame::load(mapped_file_ptr, offset).  Frames
+     * loaded this way point into the mapping instead of copying their
+     * objects out of it.
+     */
+    mapped_file_ptr open_mapped(const std::string& filename);
+
+    /// Bytes read from, and written to, files opened with open() so
+    /// far, by all threads: as stored, i.e. compressed.
+    uint64_t bytes_read();
+    uint64_t bytes_written();
 
   } // namespace dataio
 }  //  namespace I3